@@ -1,5 +1,6 @@
 #include "log_config.h"
 #include <BLEDevice.h>
+#include <esp_timer.h>
 
 static const char* TAG = "BLE";
 
@@ -32,10 +33,127 @@ static const char* kGATTServerEventNames[] = {
   "SEND_SERVICE_CHANGE",
 };
 
-void handleBLEServerEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gatts_cb_param_t* param) {
-  ESP_LOGD(TAG, "%s", kGATTServerEventNames[event]);
+static const size_t kGATTServerEventNameCount = sizeof(kGATTServerEventNames) / sizeof(kGATTServerEventNames[0]);
+
+// Must be a power of 2
+static const uint32_t kTraceCapacity = 64;
+
+static const uint16_t kNoConnectionID = 0xFFFF;
+
+typedef struct {
+  uint32_t sequence; // Index of the record + 1, written last to publish the record
+  uint32_t timestampMicros;
+  uint8_t event;
+  uint8_t gattInterface;
+  uint16_t connectionID;
+  uint32_t parameter;
+} GATTServerEventRecord;
+
+static GATTServerEventRecord trace[kTraceCapacity];
+static uint32_t traceHead = 0;
+
+// The last one is for unknown events
+static uint32_t eventCounts[kGATTServerEventNameCount + 1];
+
+static const char* getGATTServerEventName(uint8_t event) {
+  return event < kGATTServerEventNameCount ? kGATTServerEventNames[event] : "UNKNOWN";
 }
 
-void enableBLEServerEventLogging() {
+static void extractEventParameters(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t* param, uint16_t* connectionID, uint32_t* parameter) {
+  *connectionID = kNoConnectionID;
+  *parameter = 0;
+
+  switch (event) {
+    case ESP_GATTS_READ_EVT:
+      *connectionID = param->read.conn_id;
+      *parameter = param->read.handle;
+      break;
+    case ESP_GATTS_WRITE_EVT:
+      *connectionID = param->write.conn_id;
+      *parameter = param->write.handle | (param->write.len << 16);
+      break;
+    case ESP_GATTS_MTU_EVT:
+      *connectionID = param->mtu.conn_id;
+      *parameter = param->mtu.mtu;
+      break;
+    case ESP_GATTS_CONF_EVT:
+      *connectionID = param->conf.conn_id;
+      *parameter = param->conf.status;
+      break;
+    case ESP_GATTS_CONNECT_EVT:
+      *connectionID = param->connect.conn_id;
+      break;
+    case ESP_GATTS_DISCONNECT_EVT:
+      *connectionID = param->disconnect.conn_id;
+      *parameter = param->disconnect.reason;
+      break;
+    case ESP_GATTS_CONGEST_EVT:
+      *connectionID = param->congest.conn_id;
+      *parameter = param->congest.congested;
+      break;
+    default:
+      break;
+  }
+}
+
+// This is invoked in the Bluedroid task, so we only record the event in binary
+// and defer the formatting until the trace is dumped.
+static void handleBLEServerEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gatts_cb_param_t* param) {
+  size_t countIndex = event < kGATTServerEventNameCount ? event : kGATTServerEventNameCount;
+  __atomic_fetch_add(&eventCounts[countIndex], 1, __ATOMIC_RELAXED);
+
+  uint32_t index = __atomic_fetch_add(&traceHead, 1, __ATOMIC_RELAXED);
+  GATTServerEventRecord* record = &trace[index & (kTraceCapacity - 1)];
+
+  // Invalidate the slot while we're overwriting it
+  __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+  record->timestampMicros = (uint32_t)esp_timer_get_time();
+  record->event = event;
+  record->gattInterface = gattc_if;
+  extractEventParameters(event, param, &record->connectionID, &record->parameter);
+  __atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+void enableBLEServerEventTracing() {
   BLEDevice::setCustomGattsHandler(handleBLEServerEvent);
 }
+
+void dumpBLEServerEventTrace() {
+  uint32_t head = __atomic_load_n(&traceHead, __ATOMIC_ACQUIRE);
+  uint32_t start = head > kTraceCapacity ? head - kTraceCapacity : 0;
+
+  ESP_LOGI(TAG, "Last %u GATT server events:", head - start);
+
+  for (uint32_t index = start; index < head; index++) {
+    GATTServerEventRecord* slot = &trace[index & (kTraceCapacity - 1)];
+
+    uint32_t sequenceBeforeCopy = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    GATTServerEventRecord record = *slot;
+    uint32_t sequenceAfterCopy = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+    // The record has been overwritten by a newer event (or is being written) while dumping
+    if (sequenceBeforeCopy != index + 1 || sequenceAfterCopy != index + 1) {
+      continue;
+    }
+
+    ESP_LOGI(
+      TAG,
+      "%10u us %-20s if: %u, conn: %d, param: 0x%08x",
+      record.timestampMicros,
+      getGATTServerEventName(record.event),
+      record.gattInterface,
+      record.connectionID == kNoConnectionID ? -1 : record.connectionID,
+      record.parameter
+    );
+  }
+
+  ESP_LOGI(TAG, "GATT server event counts:");
+
+  for (size_t i = 0; i <= kGATTServerEventNameCount; i++) {
+    uint32_t count = __atomic_load_n(&eventCounts[i], __ATOMIC_RELAXED);
+
+    if (count > 0) {
+      ESP_LOGI(TAG, "%-20s %u", getGATTServerEventName(i), count);
+    }
+  }
+}
@@ -1 +1,2 @@
-void enableBLEServerEventLogging();
+void enableBLEServerEventTracing();
+void dumpBLEServerEventTrace();
@@ -0,0 +1,123 @@
+#include "log_config.h"
+#include "dispatcher.h"
+#include "Arduino.h"
+#include <esp_timer.h>
+
+static const char* TAG = "Dispatcher";
+
+static void dispatchMessages(void* pvParameters) {
+  Dispatcher* dispatcher = (Dispatcher*)pvParameters;
+
+  while (true) {
+    // Block until any of the mailboxes receives a message.
+    // The queue set returns mailboxes in the order messages were sent to them.
+    QueueSetMemberHandle_t mailbox = xQueueSelectFromSet(dispatcher->mailboxSet, portMAX_DELAY);
+
+    Actor* actor = dispatcher->findActor(mailbox);
+    if (actor == nullptr) {
+      continue;
+    }
+
+    Message message;
+    if (xQueueReceive(actor->mailbox, &message, 0) != pdTRUE) {
+      continue;
+    }
+
+    int64_t startMicros = esp_timer_get_time();
+    actor->handleMessage(message);
+    uint32_t elapsedMicros = esp_timer_get_time() - startMicros;
+
+    actor->statistics.processedMessageCount++;
+    actor->statistics.totalProcessingMicros += elapsedMicros;
+    if (elapsedMicros > actor->statistics.maxProcessingMicros) {
+      actor->statistics.maxProcessingMicros = elapsedMicros;
+    }
+  }
+}
+
+Actor::Actor(const char* name) {
+  this->name = name;
+  this->mailbox = xQueueCreateStatic(kActorMailboxCapacity, sizeof(Message), mailboxStorage, &mailboxBuffer);
+  memset(&this->statistics, 0, sizeof(ActorStatistics));
+}
+
+bool Actor::send(MessageType type, int32_t argument) {
+  Message message = {type, argument};
+
+  if (xQueueSend(mailbox, &message, 0) != pdTRUE) {
+    // Senders are in any task or ISR
+    __atomic_fetch_add(&statistics.droppedMessageCount, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  return true;
+}
+
+bool Actor::sendFromISR(MessageType type, int32_t argument) {
+  Message message = {type, argument};
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+
+  if (xQueueSendFromISR(mailbox, &message, &higherPriorityTaskWoken) != pdTRUE) {
+    __atomic_fetch_add(&statistics.droppedMessageCount, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  if (higherPriorityTaskWoken) {
+    portYIELD_FROM_ISR();
+  }
+
+  return true;
+}
+
+Dispatcher::Dispatcher() {
+  this->actorCount = 0;
+  this->mailboxSet = xQueueCreateSet(kMaxActorCount * kActorMailboxCapacity);
+}
+
+// This needs to be called before anyone sends a message to the actor
+// since a queue can be added to a queue set only while it's empty.
+void Dispatcher::registerActor(Actor* actor) {
+  if (actorCount >= kMaxActorCount) {
+    ESP_LOGE(TAG, "Cannot register more than %u actors", (unsigned)kMaxActorCount);
+    return;
+  }
+
+  if (xQueueAddToSet(actor->mailbox, mailboxSet) != pdPASS) {
+    ESP_LOGE(TAG, "Failed registering %s", actor->name);
+    return;
+  }
+
+  actors[actorCount++] = actor;
+}
+
+void Dispatcher::start() {
+  xTaskCreatePinnedToCore(dispatchMessages, "Dispatcher", 4096, this, 1, nullptr, CONFIG_ARDUINO_RUNNING_CORE);
+}
+
+Actor* Dispatcher::findActor(QueueSetMemberHandle_t mailbox) {
+  for (size_t i = 0; i < actorCount; i++) {
+    if (actors[i]->mailbox == mailbox) {
+      return actors[i];
+    }
+  }
+
+  return nullptr;
+}
+
+void Dispatcher::logStatistics() {
+  for (size_t i = 0; i < actorCount; i++) {
+    Actor* actor = actors[i];
+    ActorStatistics* statistics = &actor->statistics;
+    uint32_t averageMicros = statistics->processedMessageCount == 0 ? 0 : statistics->totalProcessingMicros / statistics->processedMessageCount;
+
+    ESP_LOGI(
+      TAG,
+      "%s: processed %u, dropped %u, average %u us, max %u us",
+      actor->name,
+      statistics->processedMessageCount,
+      __atomic_load_n(&statistics->droppedMessageCount, __ATOMIC_RELAXED),
+      averageMicros,
+      statistics->maxProcessingMicros
+    );
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef IPAD_CAR_INTEGRATION_DISPATCHER_H_
+#define IPAD_CAR_INTEGRATION_DISPATCHER_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+static const size_t kActorMailboxCapacity = 16;
+
+typedef enum {
+  MessageTypeNone = 0,
+
+  // iPad connection
+  MessageTypeConnect,
+  MessageTypeDisconnect,
+  MessageTypeKeepAwake,
+
+  // SteeringRemote
+  MessageTypeSampleSteeringRemoteInput,
+
+  // HID (argument: HIDConsumerInput or (HIDKeyboardModifierKey << 8 | HIDKeyboardKey))
+  MessageTypePerformConsumerInput,
+  MessageTypePressConsumerInput,
+  MessageTypeReleaseConsumerInput,
+  MessageTypePerformKeyboardInput,
+
+  // SerialBLEBridge
+  MessageTypeSerialDataReceive,
+} MessageType;
+
+// Messages are copied into the mailbox by value, so keep them small and fixed-size.
+typedef struct {
+  MessageType type;
+  int32_t argument;
+} Message;
+
+typedef struct {
+  uint32_t processedMessageCount;
+  uint32_t droppedMessageCount;
+  uint64_t totalProcessingMicros;
+  uint32_t maxProcessingMicros;
+} ActorStatistics;
+
+class Actor {
+public:
+  const char* name;
+  QueueHandle_t mailbox;
+  ActorStatistics statistics;
+
+  Actor(const char* name);
+  bool send(MessageType type, int32_t argument = 0);
+  bool sendFromISR(MessageType type, int32_t argument = 0);
+  virtual void handleMessage(Message message) = 0;
+
+private:
+  StaticQueue_t mailboxBuffer;
+  uint8_t mailboxStorage[kActorMailboxCapacity * sizeof(Message)];
+};
+
+// Services all the registered actors in a single task
+// so that messages are handled one by one in the order they were sent.
+class Dispatcher {
+public:
+  static const size_t kMaxActorCount = 8;
+
+  Actor* actors[kMaxActorCount];
+  size_t actorCount;
+  QueueSetHandle_t mailboxSet;
+
+  Dispatcher();
+  void registerActor(Actor* actor);
+  void start();
+  Actor* findActor(QueueSetMemberHandle_t mailbox);
+  void logStatistics();
+};
+
+#endif
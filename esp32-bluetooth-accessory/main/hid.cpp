@@ -94,8 +94,9 @@ static const uint8_t kReportMap[] = {
   END_COLLECTION(0)
 };
 
-HID::HID(BLEServer* server) {
+HID::HID(BLEServer* server) : Actor(TAG) {
   this->server = server;
+  this->callbacks = nullptr;
   hidDevice = createHIDDevice();
   keyboardInputReportCharacteristic = hidDevice->inputReport(kKeyboardReportID);
   consumerInputReportCharacteristic = hidDevice->inputReport(kConsumerReportID);
@@ -108,6 +109,10 @@ BLEHIDDevice* HID::createHIDDevice() {
   return hidDevice;
 };
 
+void HID::setCallbacks(HIDCallbacks* callbacks) {
+  this->callbacks = callbacks;
+}
+
 BLEService* HID::getHIDService() {
   return hidDevice->hidService();
 }
@@ -116,6 +121,25 @@ void HID::startServices() {
   hidDevice->startServices();
 };
 
+void HID::handleMessage(Message message) {
+  switch (message.type) {
+    case MessageTypePerformConsumerInput:
+      performConsumerInput((HIDConsumerInput)message.argument);
+      break;
+    case MessageTypePressConsumerInput:
+      pressConsumerInput((HIDConsumerInput)message.argument);
+      break;
+    case MessageTypeReleaseConsumerInput:
+      releaseConsumerInput();
+      break;
+    case MessageTypePerformKeyboardInput:
+      performKeyboardInput((HIDKeyboardModifierKey)(message.argument >> 8), (HIDKeyboardKey)(message.argument & 0xFF));
+      break;
+    default:
+      break;
+  }
+}
+
 void HID::performKeyboardInput(HIDKeyboardModifierKey modifierKey, HIDKeyboardKey key) {
   pressKeyboardInput(modifierKey, key);
   releaseKeyboardInput();
@@ -132,8 +156,7 @@ void HID::releaseKeyboardInput() {
 }
 
 void HID::notifyKeyboardInputReport(uint8_t* report, size_t size) {
-  keyboardInputReportCharacteristic->setValue(report, size);
-  keyboardInputReportCharacteristic->notify(true);
+  notifyInputReport(keyboardInputReportCharacteristic, report, size);
 }
 
 void HID::performConsumerInput(HIDConsumerInput input) {
@@ -152,6 +175,17 @@ void HID::releaseConsumerInput() {
 }
 
 void HID::notifyConsumerInputReport(uint8_t* report, size_t size) {
-  consumerInputReportCharacteristic->setValue(report, size);
-  consumerInputReportCharacteristic->notify(true);
+  notifyInputReport(consumerInputReportCharacteristic, report, size);
+}
+
+void HID::notifyInputReport(BLECharacteristic* characteristic, uint8_t* report, size_t size) {
+  characteristic->setValue(report, size);
+  characteristic->notify(true);
+
+  if (callbacks != nullptr) {
+    callbacks->onInputReportNotify(this);
+  }
+}
+
+void HIDCallbacks::onInputReportNotify(HID* hid) {
 }
@@ -1,6 +1,8 @@
 #ifndef IPAD_CAR_INTEGRATION_HID_H_
 #define IPAD_CAR_INTEGRATION_HID_H_
 
+#include "dispatcher.h"
+
 #include <BLEHIDDevice.h>
 #include <BLEServer.h>
 #include <BLEService.h>
@@ -73,16 +75,21 @@ typedef enum {
   HIDConsumerInputGlobe             = 1 << 7,
 } HIDConsumerInput;
 
-class HID {
+class HIDCallbacks;
+
+class HID : public Actor {
 public:
   BLEServer* server;
+  HIDCallbacks* callbacks;
   BLEHIDDevice* hidDevice;
   BLECharacteristic* keyboardInputReportCharacteristic;
   BLECharacteristic* consumerInputReportCharacteristic;
 
   HID(BLEServer* server);
   BLEService* getHIDService();
+  void setCallbacks(HIDCallbacks* callbacks);
   void startServices();
+  void handleMessage(Message message);
 
   void performKeyboardInput(HIDKeyboardModifierKey modifierKey, HIDKeyboardKey key);
   void pressKeyboardInput(HIDKeyboardModifierKey modifierKey, HIDKeyboardKey key);
@@ -96,6 +103,12 @@ private:
   BLEHIDDevice* createHIDDevice();
   void notifyKeyboardInputReport(uint8_t* report, size_t size);
   void notifyConsumerInputReport(uint8_t* report, size_t size);
+  void notifyInputReport(BLECharacteristic* characteristic, uint8_t* report, size_t size);
+};
+
+class HIDCallbacks {
+public:
+  virtual void onInputReportNotify(HID* hid);
 };
 
 #endif
@@ -4,7 +4,9 @@ void setupLogLevel() {
   esp_log_level_set("main",            LOG_LOCAL_LEVEL);
   esp_log_level_set("BLE",             LOG_LOCAL_LEVEL);
   esp_log_level_set("BLEUART",         LOG_LOCAL_LEVEL);
+  esp_log_level_set("Dispatcher",      LOG_LOCAL_LEVEL);
   esp_log_level_set("HID",             LOG_LOCAL_LEVEL);
+  esp_log_level_set("PowerManagement", LOG_LOCAL_LEVEL);
   esp_log_level_set("SerialBLEBridge", LOG_LOCAL_LEVEL);
   esp_log_level_set("SteeringRemote",  LOG_LOCAL_LEVEL);
 }
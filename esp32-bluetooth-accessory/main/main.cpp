@@ -1,9 +1,14 @@
 #include "log_config.h" // This needs to be the top
 #include "ble_debug.h"
+#include "dispatcher.h"
 #include "hid.h"
+#include "power_management.h"
 #include "serial_ble_bridge.h"
 #include "steering_remote.h"
 #include "Arduino.h"
+#include <freertos/timers.h>
+#include <driver/uart.h>
+#include <deferred_log.h>
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEHIDDevice.h>
@@ -15,58 +20,161 @@ static const int kSteeringRemoteInputPinA = 34; // Connect to the brown-yellow w
 static const int kSteeringRemoteInputPinB = 35; // Connect to the brown-white wire in the car
 static const int kiPadSleepPreventionIntervalMillis = 30 * 1000;
 
-// 16 pin for RX
-// 17 pin for TX
+// The same pins as Serial2 of Arduino core
 // https://github.com/espressif/arduino-esp32/blob/1.0.4/cores/esp32/HardwareSerial.cpp#L17-L53
-static HardwareSerial* etcDeviceSerial = &Serial2;
+// but with UART1 since only UART0 and UART1 can wake up the chip from light sleep.
+static const uart_port_t kETCDeviceSerialPort = UART_NUM_1;
+static const int kETCDeviceSerialRXPin = 16;
+static const int kETCDeviceSerialTXPin = 17;
 
+class iPadConnection;
+
+static Dispatcher* dispatcher;
 static HID* hid;
 static SerialBLEBridge* serialBLEBridge;
 static SteeringRemote* steeringRemote;
-static bool isiPadConnected = false;
-static unsigned long lastiPadSleepPreventionMillis = 0;
+static iPadConnection* iPad;
+static TimerHandle_t iPadSleepPreventionTimer;
 
-static void startSteeringRemoteInputObservation();
+static void configureETCDeviceSerial();
+static void createSteeringRemote();
 static void startBLEServer();
+static void createiPadSleepPreventionTimer();
 static void sendBluetoothCommandForSteeringRemoteInput(SteeringRemoteInput steeringRemoteInput);
-static void keepiPadAwake();
+static void requestKeepingiPadAwake(TimerHandle_t timer);
+
+// Owns the connection state, which is accessed only in the dispatcher task.
+class iPadConnection : public Actor {
+public:
+  bool isConnected;
+
+  iPadConnection() : Actor("iPadConnection") {
+    this->isConnected = false;
+  }
+
+  void handleMessage(Message message) {
+    switch (message.type) {
+      case MessageTypeConnect:
+        if (!isConnected) {
+          isConnected = true;
+          enterFullSpeedMode();
+          steeringRemote->startInputObservation();
+          xTimerStart(iPadSleepPreventionTimer, 0);
+        }
+        break;
+      case MessageTypeDisconnect:
+        if (isConnected) {
+          isConnected = false;
+          xTimerStop(iPadSleepPreventionTimer, 0);
+          // Steering remote inputs are not sent anyway while disconnected
+          steeringRemote->stopInputObservation();
+          exitFullSpeedMode();
+        }
+        dispatcher->logStatistics();
+        serialBLEBridge->logSerialStatistics();
+        logPowerStatistics();
+        dumpBLEServerEventTrace();
+        break;
+      case MessageTypeKeepAwake:
+        keepAwake();
+        break;
+      default:
+        break;
+    }
+  }
+
+private:
+  // Invoked only after kiPadSleepPreventionIntervalMillis of inactivity
+  // since the timer is reset on every input report.
+  void keepAwake() {
+    if (!isConnected) {
+      return;
+    }
+
+    ESP_LOGI(TAG, "Sending Help key code to keep the iPad awake");
+    hid->send(MessageTypePerformConsumerInput, HIDConsumerInputHelp);
+  }
+};
 
 class MySteeringRemoteCallbacks : public SteeringRemoteCallbacks {
+  // Invoked in the dispatcher task
   void onInputChange(SteeringRemote* steeringRemote, SteeringRemoteInput input) {
-    if (isiPadConnected) {
+    if (iPad->isConnected) {
       sendBluetoothCommandForSteeringRemoteInput(input);
     }
   }
 };
 
+class MyHIDCallbacks : public HIDCallbacks {
+  // Invoked in the dispatcher task
+  void onInputReportNotify(HID* hid) {
+    // xTimerReset() also starts a dormant timer,
+    // so a report processed after the disconnection must not touch it.
+    if (!iPad->isConnected) {
+      return;
+    }
+
+    // Any report sent to the iPad keeps it awake,
+    // so we postpone the next sleep prevention.
+    xTimerReset(iPadSleepPreventionTimer, 0);
+  }
+};
+
 class MyBLEServerCallbacks : public BLEServerCallbacks {
   void onConnect(BLEServer* server) {
-    isiPadConnected = true;
+    iPad->send(MessageTypeConnect);
   }
 
   void onDisconnect(BLEServer* server) {
-    isiPadConnected = false;
+    iPad->send(MessageTypeDisconnect);
   }
 };
 
 void setup() {
   setupLogLevel();
-  enableBLEServerEventLogging();
-  startSteeringRemoteInputObservation();
-  etcDeviceSerial->begin(19200, SERIAL_8E1);
+  startDeferredLogging();
+  setDeferredLogLevel(LOG_LOCAL_LEVEL);
+  enableBLEServerEventTracing();
+  configureETCDeviceSerial();
+  createiPadSleepPreventionTimer();
+
+  dispatcher = new Dispatcher();
+  iPad = new iPadConnection();
+  dispatcher->registerActor(iPad);
+
+  createSteeringRemote();
   startBLEServer();
+  configurePowerManagement(kETCDeviceSerialPort);
+
+  dispatcher->start();
 }
 
 void loop() {
-  if (isiPadConnected) {
-    keepiPadAwake();
-  }
+  // Everything is driven by the dispatcher, timers and BLE callbacks,
+  // so we don't need the Arduino loop task anymore.
+  vTaskDelete(NULL);
 }
 
-static void startSteeringRemoteInputObservation() {
+static void configureETCDeviceSerial() {
+  uart_config_t config = {
+    .baud_rate = 19200,
+    .data_bits = UART_DATA_8_BITS,
+    .parity = UART_PARITY_EVEN,
+    .stop_bits = UART_STOP_BITS_1,
+    .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    .rx_flow_ctrl_thresh = 0,
+    .use_ref_tick = false,
+  };
+
+  ESP_ERROR_CHECK(uart_param_config(kETCDeviceSerialPort, &config));
+  ESP_ERROR_CHECK(uart_set_pin(kETCDeviceSerialPort, kETCDeviceSerialTXPin, kETCDeviceSerialRXPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+}
+
+// The input observation is started when the iPad is connected.
+static void createSteeringRemote() {
   steeringRemote = new SteeringRemote(kSteeringRemoteInputPinA, kSteeringRemoteInputPinB);
   steeringRemote->setCallbacks(new MySteeringRemoteCallbacks());
-  steeringRemote->startInputObservation();
+  dispatcher->registerActor(steeringRemote);
 }
 
 static void startBLEServer() {
@@ -76,9 +184,12 @@ static void startBLEServer() {
   server->setCallbacks(new MyBLEServerCallbacks());
 
   hid = new HID(server);
+  hid->setCallbacks(new MyHIDCallbacks());
+  dispatcher->registerActor(hid);
   hid->startServices();
 
-  serialBLEBridge = new SerialBLEBridge(etcDeviceSerial, server);
+  serialBLEBridge = new SerialBLEBridge(kETCDeviceSerialPort, server);
+  dispatcher->registerActor(serialBLEBridge);
   serialBLEBridge->start();
 
   // TODO: Use BLEAdvertisementData::setName() to show the name properly even before unpaired
@@ -89,40 +200,45 @@ static void startBLEServer() {
   advertising->start();
 };
 
+static void createiPadSleepPreventionTimer() {
+  iPadSleepPreventionTimer = xTimerCreate(
+    "iPadSleepPrevention",
+    pdMS_TO_TICKS(kiPadSleepPreventionIntervalMillis),
+    pdTRUE, // Auto reload
+    nullptr,
+    requestKeepingiPadAwake
+  );
+}
+
 static void sendBluetoothCommandForSteeringRemoteInput(SteeringRemoteInput steeringRemoteInput) {
   switch (steeringRemoteInput) {
     case SteeringRemoteInputNext:
-      hid->performConsumerInput(HIDConsumerInputScanNextTrack);
+      hid->send(MessageTypePerformConsumerInput, HIDConsumerInputScanNextTrack);
       break;
     case SteeringRemoteInputPrevious:
-      hid->performConsumerInput(HIDConsumerInputScanPreviousTrack);
+      hid->send(MessageTypePerformConsumerInput, HIDConsumerInputScanPreviousTrack);
       break;
     case SteeringRemoteInputPlus:
-      hid->performConsumerInput(HIDConsumerInputVolumeIncrement);
+      hid->send(MessageTypePerformConsumerInput, HIDConsumerInputVolumeIncrement);
       break;
     case SteeringRemoteInputMinus:
-      hid->performConsumerInput(HIDConsumerInputVolumeDecrement);
+      hid->send(MessageTypePerformConsumerInput, HIDConsumerInputVolumeDecrement);
       break;
     case SteeringRemoteInputMute:
-      hid->performConsumerInput(HIDConsumerInputPlayPause);
+      hid->send(MessageTypePerformConsumerInput, HIDConsumerInputPlayPause);
       break;
     case SteeringRemoteInputVoiceInput:
       // Siri (Globe + S)
-      hid->pressConsumerInput(HIDConsumerInputGlobe);
-      hid->performKeyboardInput(HIDKeyboardModifierKeyNone, HIDKeyboardKeyS);
-      hid->releaseConsumerInput();
+      hid->send(MessageTypePressConsumerInput, HIDConsumerInputGlobe);
+      hid->send(MessageTypePerformKeyboardInput, HIDKeyboardModifierKeyNone << 8 | HIDKeyboardKeyS);
+      hid->send(MessageTypeReleaseConsumerInput);
       break;
     default:
       break;
   }
 }
 
-static void keepiPadAwake() {
-  unsigned long currentMillis = millis();
-
-  if (currentMillis > lastiPadSleepPreventionMillis + kiPadSleepPreventionIntervalMillis) {
-    ESP_LOGI(TAG, "Sending Help key code to keep the iPad awake");
-    hid->performConsumerInput(HIDConsumerInputHelp);
-    lastiPadSleepPreventionMillis = currentMillis;
-  }
+// Invoked in the timer service task
+static void requestKeepingiPadAwake(TimerHandle_t timer) {
+  iPad->send(MessageTypeKeepAwake);
 }
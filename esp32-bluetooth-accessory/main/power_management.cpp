@@ -0,0 +1,174 @@
+#include "log_config.h"
+#include "power_management.h"
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_freertos_hooks.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+
+static const char* TAG = "PowerManagement";
+
+static const int kMaxCPUFrequencyMHz = 240;
+static const int kMinCPUFrequencyMHz = 80;
+// The minimum is 3; the bytes during these edges are lost.
+static const int kSerialWakeupThreshold = 3;
+static const int kSerialActivityHoldMillis = 1000;
+
+// Ticks are suppressed only while in light sleep, so a longer gap between ticks means the chip slept
+static const int64_t kLightSleepDetectionMicros = 2 * portTICK_PERIOD_MS * 1000;
+// ESP32 datasheet: light sleep, and modem sleep with the CPU at 80 MHz
+static const uint32_t kLightSleepMicroAmps = 800;
+static const uint32_t kIdleActiveMicroAmps = 20000;
+
+static PowerStatistics statistics;
+static int64_t lastTickMicros = 0;
+static int64_t lastWakeupMicros = 0;
+static int64_t idleStartMicros = 0;
+static portMUX_TYPE statisticsMux = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_PM_ENABLE
+// Invoked in the tick interrupt of the PRO CPU
+static void IRAM_ATTR detectLightSleep() {
+  int64_t currentMicros = esp_timer_get_time();
+
+  portENTER_CRITICAL_ISR(&statisticsMux);
+
+  if (lastTickMicros != 0 && currentMicros - lastTickMicros >= kLightSleepDetectionMicros) {
+    statistics.lightSleepCount++;
+    statistics.lightSleepMicros += currentMicros - lastTickMicros;
+    lastWakeupMicros = currentMicros;
+  }
+  lastTickMicros = currentMicros;
+
+  portEXIT_CRITICAL_ISR(&statisticsMux);
+}
+
+static esp_pm_lock_handle_t cpuFrequencyLock;
+static esp_pm_lock_handle_t connectionLightSleepLock;
+static esp_pm_lock_handle_t serialLightSleepLock;
+static TimerHandle_t serialActivityTimer;
+static bool isHoldingSerialLightSleepLock = false;
+static portMUX_TYPE serialLightSleepLockMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void releaseSerialLightSleepLock(TimerHandle_t timer) {
+  portENTER_CRITICAL(&serialLightSleepLockMux);
+  bool wasHolding = isHoldingSerialLightSleepLock;
+  isHoldingSerialLightSleepLock = false;
+  portEXIT_CRITICAL(&serialLightSleepLockMux);
+
+  if (wasHolding) {
+    esp_pm_lock_release(serialLightSleepLock);
+  }
+}
+#endif
+
+void configurePowerManagement(uart_port_t wakeupSerialPort) {
+#if CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t config;
+  memset(&config, 0, sizeof(config));
+  config.max_freq_mhz = kMaxCPUFrequencyMHz;
+  config.min_freq_mhz = kMinCPUFrequencyMHz;
+  config.light_sleep_enable = true;
+  ESP_ERROR_CHECK(esp_pm_configure(&config));
+
+  ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "connection", &cpuFrequencyLock));
+  ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "connection", &connectionLightSleepLock));
+  ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "serial", &serialLightSleepLock));
+
+  serialActivityTimer = xTimerCreate("SerialActivity", pdMS_TO_TICKS(kSerialActivityHoldMillis), pdFALSE, nullptr, releaseSerialLightSleepLock);
+
+  ESP_ERROR_CHECK(uart_set_wakeup(wakeupSerialPort, kSerialWakeupThreshold));
+  ESP_ERROR_CHECK(esp_sleep_enable_uart_wakeup(wakeupSerialPort));
+
+  memset(&statistics, 0, sizeof(statistics));
+  idleStartMicros = esp_timer_get_time();
+  ESP_ERROR_CHECK(esp_register_freertos_tick_hook_for_cpu(detectLightSleep, PRO_CPU_NUM));
+
+  ESP_LOGI(TAG, "Automatic light sleep enabled");
+#else
+  ESP_LOGW(TAG, "CONFIG_PM_ENABLE is disabled");
+#endif
+}
+
+void enterFullSpeedMode() {
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(cpuFrequencyLock);
+  esp_pm_lock_acquire(connectionLightSleepLock);
+
+  int64_t currentMicros = esp_timer_get_time();
+  portENTER_CRITICAL(&statisticsMux);
+  statistics.idleMicros += currentMicros - idleStartMicros;
+  idleStartMicros = 0;
+  portEXIT_CRITICAL(&statisticsMux);
+#endif
+}
+
+void exitFullSpeedMode() {
+#if CONFIG_PM_ENABLE
+  int64_t currentMicros = esp_timer_get_time();
+  portENTER_CRITICAL(&statisticsMux);
+  idleStartMicros = currentMicros;
+  portEXIT_CRITICAL(&statisticsMux);
+
+  esp_pm_lock_release(connectionLightSleepLock);
+  esp_pm_lock_release(cpuFrequencyLock);
+#endif
+}
+
+void notifySerialActivity() {
+#if CONFIG_PM_ENABLE
+  portENTER_CRITICAL(&serialLightSleepLockMux);
+  bool wasHolding = isHoldingSerialLightSleepLock;
+  isHoldingSerialLightSleepLock = true;
+  portEXIT_CRITICAL(&serialLightSleepLockMux);
+
+  if (!wasHolding) {
+    esp_pm_lock_acquire(serialLightSleepLock);
+  }
+
+  xTimerReset(serialActivityTimer, 0);
+#endif
+}
+
+int64_t getLastWakeupMicros() {
+  portENTER_CRITICAL(&statisticsMux);
+  int64_t wakeupMicros = lastWakeupMicros;
+  portEXIT_CRITICAL(&statisticsMux);
+  return wakeupMicros;
+}
+
+PowerStatistics getPowerStatistics() {
+  int64_t currentMicros = esp_timer_get_time();
+
+  portENTER_CRITICAL(&statisticsMux);
+  PowerStatistics currentStatistics = statistics;
+  if (idleStartMicros != 0) {
+    currentStatistics.idleMicros += currentMicros - idleStartMicros;
+  }
+  portEXIT_CRITICAL(&statisticsMux);
+
+  return currentStatistics;
+}
+
+void logPowerStatistics() {
+  PowerStatistics currentStatistics = getPowerStatistics();
+
+  if (currentStatistics.idleMicros == 0) {
+    return;
+  }
+
+  uint32_t residencyPermille = (uint32_t)(currentStatistics.lightSleepMicros * 1000 / currentStatistics.idleMicros);
+  uint32_t estimatedMicroAmps = (kLightSleepMicroAmps * residencyPermille + kIdleActiveMicroAmps * (1000 - residencyPermille)) / 1000;
+
+  ESP_LOGI(
+    TAG,
+    "light sleep %u times, %u.%u%% of %u s idle, estimated idle current %u uA",
+    currentStatistics.lightSleepCount,
+    residencyPermille / 10,
+    residencyPermille % 10,
+    (uint32_t)(currentStatistics.idleMicros / 1000000),
+    estimatedMicroAmps
+  );
+}
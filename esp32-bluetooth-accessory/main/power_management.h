@@ -0,0 +1,32 @@
+#ifndef IPAD_CAR_INTEGRATION_POWER_MANAGEMENT_H_
+#define IPAD_CAR_INTEGRATION_POWER_MANAGEMENT_H_
+
+#include <driver/uart.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t lightSleepCount;
+  uint64_t lightSleepMicros;
+  uint64_t idleMicros; // Time out of the full speed mode, where light sleep is allowed
+} PowerStatistics;
+
+// Lets the chip scale down the CPU frequency and enter automatic light sleep while idle.
+// The serial port needs to be one of UART0 and UART1 since only they can wake up the chip.
+void configurePowerManagement(uart_port_t wakeupSerialPort);
+
+// Keeps the CPU at the max frequency without light sleep while a central is connected.
+void enterFullSpeedMode();
+void exitFullSpeedMode();
+
+// Prevents light sleep for a while so that the following bytes are not lost.
+void notifySerialActivity();
+
+// When the chip last woke up from light sleep, within a tick; 0 if it has never slept.
+int64_t getLastWakeupMicros();
+
+PowerStatistics getPowerStatistics();
+// The idle current is estimated from the light sleep residency and the datasheet values
+// since it cannot be measured by the chip itself.
+void logPowerStatistics();
+
+#endif
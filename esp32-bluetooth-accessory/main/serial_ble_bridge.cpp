@@ -1,34 +1,87 @@
 #include "log_config.h"
 #include "serial_ble_bridge.h"
+#include "power_management.h"
+#include "Arduino.h"
+#include <deferred_log.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
 
 static const char* TAG = "SerialBLEBridge";
 static const size_t serialReadBufferSize = 256;
+static const int serialEventQueueSize = 16;
+static const int64_t kSerialBurstSilenceMicros = 1000 * 1000;
 
-static void transmitDataFromSerialToBLE(void* pvParameters) {
-  SerialBLEBridge* bridge = (SerialBLEBridge*)pvParameters;
+// Packs up to 4 bytes from the offset into a word so that "%08x" shows them in order
+static uint32_t getBigEndianWord(const uint8_t* bytes, size_t size, size_t offset) {
+  uint32_t word = 0;
 
-  uint8_t serialReadBuffer[serialReadBufferSize];
-  size_t readableByteSize;
-  size_t actualReadByteSize;
+  for (size_t i = offset; i < offset + 4; i++) {
+    word = (word << 8) | (i < size ? bytes[i] : 0);
+  }
 
-  while (true) {
-    if (!bridge->isBLEConnected()) {
-      continue;
-    }
+  return word;
+}
 
-    readableByteSize = bridge->serial->available();
+// Logging on every chunk is on the hot path, so we record only the size and the first 8 bytes
+// and defer the formatting.
+static void logData(const char* format, const uint8_t* data, size_t size) {
+  DEFERRED_LOGD(TAG, format, size, getBigEndianWord(data, size, 0), getBigEndianWord(data, size, 4));
+}
 
-    if (readableByteSize == 0) {
+// Blocks on the UART driver events and just tells the bridge that data is available,
+// so that the actual transmission is done in the dispatcher task.
+static void observeSerialEvents(void* pvParameters) {
+  SerialBLEBridge* bridge = (SerialBLEBridge*)pvParameters;
+  uart_event_t event;
+
+  while (true) {
+    if (xQueueReceive(bridge->serialEventQueue, &event, portMAX_DELAY) != pdTRUE) {
       continue;
     }
 
-    actualReadByteSize = bridge->serial->readBytes(serialReadBuffer, min(readableByteSize, serialReadBufferSize));
-
-    ESP_LOGD(TAG, "Receiving data from serial:");
-    ESP_LOG_BUFFER_HEX_LEVEL(TAG, serialReadBuffer, actualReadByteSize, ESP_LOG_DEBUG);
-
-    bridge->uart->transmit(serialReadBuffer, actualReadByteSize);
-    delay(3);
+    switch (event.type) {
+      case UART_DATA: {
+        notifySerialActivity();
+
+        int64_t currentMicros = esp_timer_get_time();
+        bool isFirstDataOfBurst = currentMicros - bridge->lastSerialEventMicros >= kSerialBurstSilenceMicros;
+        bridge->lastSerialEventMicros = currentMicros;
+
+        if (isFirstDataOfBurst && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UART) {
+          SerialStatistics* statistics = &bridge->serialStatistics;
+          int64_t wakeupMicros = getLastWakeupMicros();
+
+          // The wakeup is detected at the next tick, which can be after the driver event.
+          // The cause is kept while the chip stays awake, so an older wakeup is not by this burst.
+          if (wakeupMicros != 0 && wakeupMicros <= currentMicros && currentMicros - wakeupMicros < kSerialBurstSilenceMicros) {
+            uint32_t wakeupToDataMicros = currentMicros - wakeupMicros;
+            statistics->serialWakeupCount++;
+            statistics->totalWakeupToDataMicros += wakeupToDataMicros;
+            if (wakeupToDataMicros > statistics->maxWakeupToDataMicros) {
+              statistics->maxWakeupToDataMicros = wakeupToDataMicros;
+            }
+          }
+        }
+
+        // Pass the receive time only for the first data of a burst (never 0) to measure the latency
+        bridge->send(MessageTypeSerialDataReceive, isFirstDataOfBurst ? ((int32_t)currentMicros | 1) : 0);
+        break;
+      }
+      case UART_FIFO_OVF:
+      case UART_BUFFER_FULL:
+        bridge->serialStatistics.errorEventCount++;
+        ESP_LOGW(TAG, "Serial buffer overflowed");
+        uart_flush_input(bridge->serialPort);
+        xQueueReset(bridge->serialEventQueue);
+        break;
+      case UART_FRAME_ERR:
+      case UART_PARITY_ERR:
+        // This happens when the chip wakes up in the middle of a byte
+        bridge->serialStatistics.errorEventCount++;
+        break;
+      default:
+        break;
+    }
   }
 }
 
@@ -45,15 +98,18 @@ public:
       return;
     }
 
-    ESP_LOGD(TAG, "Receiving data from BLE:");
-    ESP_LOG_BUFFER_HEX_LEVEL(TAG, data.data(), data.length(), ESP_LOG_DEBUG);
+    logData("Receiving %u bytes from BLE: %08x %08x ...", (const uint8_t*)data.data(), data.length());
 
-    bridge->serial->write((uint8_t*)data.data(), data.length());
+    // uart_write_bytes() is thread-safe, so we can write directly from the BLE task.
+    uart_write_bytes(bridge->serialPort, data.data(), data.length());
   }
 };
 
-SerialBLEBridge::SerialBLEBridge(HardwareSerial* serial, BLEServer* server) {
-  this->serial = serial;
+SerialBLEBridge::SerialBLEBridge(uart_port_t serialPort, BLEServer* server) : Actor(TAG) {
+  this->serialPort = serialPort;
+  this->serialEventQueue = nullptr;
+  this->lastSerialEventMicros = 0;
+  memset(&this->serialStatistics, 0, sizeof(SerialStatistics));
   this->server = server;
 
   uart = new BLEUART(server);
@@ -66,5 +122,69 @@ bool SerialBLEBridge::isBLEConnected() {
 
 void SerialBLEBridge::start() {
   uart->startService();
-  xTaskCreatePinnedToCore(transmitDataFromSerialToBLE, "SerialBLEBridge::transmitDataFromSerialToBLE", 4096, this, 1, nullptr, CONFIG_ARDUINO_RUNNING_CORE);
+  ESP_ERROR_CHECK(uart_driver_install(serialPort, serialReadBufferSize * 2, 0, serialEventQueueSize, &serialEventQueue, 0));
+  xTaskCreatePinnedToCore(observeSerialEvents, "SerialBLEBridge", 2048, this, 2, nullptr, CONFIG_ARDUINO_RUNNING_CORE);
+}
+
+void SerialBLEBridge::handleMessage(Message message) {
+  switch (message.type) {
+    case MessageTypeSerialDataReceive:
+      if (message.argument != 0) {
+        uint32_t latencyMicros = (uint32_t)esp_timer_get_time() - (uint32_t)message.argument;
+        serialStatistics.burstCount++;
+        serialStatistics.totalDispatchLatencyMicros += latencyMicros;
+        if (latencyMicros > serialStatistics.maxDispatchLatencyMicros) {
+          serialStatistics.maxDispatchLatencyMicros = latencyMicros;
+        }
+      }
+
+      transmitDataFromSerialToBLE();
+      break;
+    default:
+      break;
+  }
+}
+
+void SerialBLEBridge::transmitDataFromSerialToBLE() {
+  // Keep the data in the driver buffer until a central connects as we did with polling.
+  if (!isBLEConnected()) {
+    return;
+  }
+
+  uint8_t serialReadBuffer[serialReadBufferSize];
+  size_t readableByteSize;
+
+  while (uart_get_buffered_data_len(serialPort, &readableByteSize) == ESP_OK && readableByteSize > 0) {
+    int actualReadByteSize = uart_read_bytes(serialPort, serialReadBuffer, min(readableByteSize, serialReadBufferSize), 0);
+
+    if (actualReadByteSize <= 0) {
+      break;
+    }
+
+    logData("Receiving %u bytes from serial: %08x %08x ...", serialReadBuffer, actualReadByteSize);
+
+    uart->transmit(serialReadBuffer, actualReadByteSize);
+    delay(3);
+  }
+}
+
+void SerialBLEBridge::logSerialStatistics() {
+  uint32_t averageWakeupToDataMicros = serialStatistics.serialWakeupCount == 0 ? 0 : serialStatistics.totalWakeupToDataMicros / serialStatistics.serialWakeupCount;
+  uint32_t averageDispatchMicros = serialStatistics.burstCount == 0 ? 0 : serialStatistics.totalDispatchLatencyMicros / serialStatistics.burstCount;
+
+  ESP_LOGI(
+    TAG,
+    "bursts %u, dispatch latency average %u us, max %u us, errors %u",
+    serialStatistics.burstCount,
+    averageDispatchMicros,
+    serialStatistics.maxDispatchLatencyMicros,
+    serialStatistics.errorEventCount
+  );
+  ESP_LOGI(
+    TAG,
+    "woken by serial %u, wakeup to first data average %u us, max %u us",
+    serialStatistics.serialWakeupCount,
+    averageWakeupToDataMicros,
+    serialStatistics.maxWakeupToDataMicros
+  );
 }
@@ -2,18 +2,40 @@
 #define IPAD_CAR_INTEGRATION_SERIAL_BLE_BRIDGE_H_
 
 #include "ble_uart.h"
-#include "Arduino.h"
+#include "dispatcher.h"
 #include <BLEServer.h>
+#include <driver/uart.h>
 
-class SerialBLEBridge {
+typedef struct {
+  uint32_t burstCount; // Data after a silence, when the chip may have been in light sleep
+  uint32_t serialWakeupCount;
+  // From the light sleep wakeup by the serial edge until the driver delivers the first data
+  uint64_t totalWakeupToDataMicros;
+  uint32_t maxWakeupToDataMicros;
+  // From the driver event until the dispatcher handles it
+  uint64_t totalDispatchLatencyMicros;
+  uint32_t maxDispatchLatencyMicros;
+  uint32_t errorEventCount; // Framing/parity errors and overflows, which mean lost bytes
+} SerialStatistics;
+
+class SerialBLEBridge : public Actor {
 public:
-  HardwareSerial* serial;
+  uart_port_t serialPort;
+  QueueHandle_t serialEventQueue;
   BLEServer* server;
   BLEUART* uart;
+  SerialStatistics serialStatistics;
+  int64_t lastSerialEventMicros;
 
-  SerialBLEBridge(HardwareSerial* serial, BLEServer* server);
+  // The serial port needs to be configured with uart_param_config() and uart_set_pin() beforehand.
+  SerialBLEBridge(uart_port_t serialPort, BLEServer* server);
   bool isBLEConnected();
   void start();
+  void handleMessage(Message message);
+  void logSerialStatistics();
+
+private:
+  void transmitDataFromSerialToBLE();
 };
 
 #endif
@@ -10,6 +10,7 @@ static const int kInputValueStep3 = 1130;
 static const int kInputValueStep4 = 2065;
 static const int kInputValueStep5 = 2734;
 static const int kAnalogInputMaxValue = 4095;
+static const int kSamplingIntervalMillis = 20;
 
 static bool nearlyEqual(int actualValue, int referenceValue) {
   return (referenceValue * 0.9) <= actualValue && actualValue <= (referenceValue * 1.1);
@@ -29,37 +30,18 @@ static void logCurrentInput(SteeringRemote* steeringRemote) {
   );
 }
 
-static void observeInput(void* pvParameters) {
-  SteeringRemote* steeringRemote = (SteeringRemote*)pvParameters;
-  SteeringRemoteInput previousInput = SteeringRemoteInputNone;
-
-  #if LOG_LOCAL_LEVEL >= ESP_LOG_VERBOSE
-  unsigned long lastLogMillis = millis();
-  #endif
-
-  while (true) {
-    SteeringRemoteInput currentInput = steeringRemote->getDebouncedCurrentInput();
-
-    #if LOG_LOCAL_LEVEL >= ESP_LOG_VERBOSE
-    unsigned long currentMillis = millis();
-    if (currentMillis > lastLogMillis + 500) {
-      logCurrentInput(steeringRemote);
-      lastLogMillis = currentMillis;
-    }
-    #endif
-
-    if (currentInput != previousInput && steeringRemote->callbacks != nullptr) {
-      steeringRemote->callbacks->onInputChange(steeringRemote, currentInput);
-    }
-
-    previousInput = currentInput;
-  }
+static void requestInputSampling(TimerHandle_t timer) {
+  SteeringRemote* steeringRemote = (SteeringRemote*)pvTimerGetTimerID(timer);
+  steeringRemote->send(MessageTypeSampleSteeringRemoteInput);
 }
 
-SteeringRemote::SteeringRemote(int inputPinA, int inputPinB) {
+SteeringRemote::SteeringRemote(int inputPinA, int inputPinB) : Actor(TAG) {
   this->inputPinA = inputPinA;
   this->inputPinB = inputPinB;
+  this->callbacks = nullptr;
   this->isReadyToDetectNewInput = true;
+  this->previousInput = SteeringRemoteInputNone;
+  this->samplingTimer = xTimerCreate("SteeringRemote", pdMS_TO_TICKS(kSamplingIntervalMillis), pdTRUE, this, requestInputSampling);
 }
 
 void SteeringRemote::setCallbacks(SteeringRemoteCallbacks* callbacks) {
@@ -67,7 +49,40 @@ void SteeringRemote::setCallbacks(SteeringRemoteCallbacks* callbacks) {
 }
 
 void SteeringRemote::startInputObservation() {
-  xTaskCreatePinnedToCore(observeInput, "SteeringRemote::observeInput", 4096, this, 1, nullptr, CONFIG_ARDUINO_RUNNING_CORE);
+  xTimerStart(samplingTimer, 0);
+}
+
+void SteeringRemote::stopInputObservation() {
+  xTimerStop(samplingTimer, 0);
+}
+
+void SteeringRemote::handleMessage(Message message) {
+  switch (message.type) {
+    case MessageTypeSampleSteeringRemoteInput:
+      observeInput();
+      break;
+    default:
+      break;
+  }
+}
+
+void SteeringRemote::observeInput() {
+  SteeringRemoteInput currentInput = getDebouncedCurrentInput();
+
+  #if LOG_LOCAL_LEVEL >= ESP_LOG_VERBOSE
+  static unsigned long lastLogMillis = 0;
+  unsigned long currentMillis = millis();
+  if (currentMillis > lastLogMillis + 500) {
+    logCurrentInput(this);
+    lastLogMillis = currentMillis;
+  }
+  #endif
+
+  if (currentInput != previousInput && callbacks != nullptr) {
+    callbacks->onInputChange(this, currentInput);
+  }
+
+  previousInput = currentInput;
 }
 
 SteeringRemoteInput SteeringRemote::getDebouncedCurrentInput() {
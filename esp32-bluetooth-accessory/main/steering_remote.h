@@ -1,6 +1,9 @@
 #ifndef IPAD_CAR_INTEGRATION_STEERING_REMOTE_H_
 #define IPAD_CAR_INTEGRATION_STEERING_REMOTE_H_
 
+#include "dispatcher.h"
+#include <freertos/timers.h>
+
 typedef enum {
   SteeringRemoteInputUnknown = -1, // Used only internally
   SteeringRemoteInputNone = 0,
@@ -17,20 +20,29 @@ typedef enum {
 
 class SteeringRemoteCallbacks;
 
-class SteeringRemote {
+// Input values are sampled periodically and handled in the dispatcher task,
+// so the state below is never touched concurrently.
+class SteeringRemote : public Actor {
 public:
   int inputPinA; // The brown-yellow wire in the car
   int inputPinB; // The brown-white wire in the car
   SteeringRemoteCallbacks* callbacks;
   bool isReadyToDetectNewInput;
+  SteeringRemoteInput previousInput;
+  TimerHandle_t samplingTimer;
 
   SteeringRemote(int inputPinA, int inputPinB);
   void setCallbacks(SteeringRemoteCallbacks* callbacks);
   void startInputObservation();
+  void stopInputObservation();
+  void handleMessage(Message message);
   SteeringRemoteInput getDebouncedCurrentInput();
   SteeringRemoteInput getCurrentInput();
   uint16_t getRawInputA();
   uint16_t getRawInputB();
+
+private:
+  void observeInput();
 };
 
 class SteeringRemoteCallbacks {
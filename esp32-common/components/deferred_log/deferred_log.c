@@ -0,0 +1,133 @@
+#include "deferred_log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+
+#ifndef CONFIG_DEFERRED_LOG_RING_CAPACITY
+#define CONFIG_DEFERRED_LOG_RING_CAPACITY 64
+#endif
+
+#ifndef CONFIG_DEFERRED_LOG_DRAIN_INTERVAL_MS
+#define CONFIG_DEFERRED_LOG_DRAIN_INTERVAL_MS 100
+#endif
+
+_Static_assert((CONFIG_DEFERRED_LOG_RING_CAPACITY & (CONFIG_DEFERRED_LOG_RING_CAPACITY - 1)) == 0, "CONFIG_DEFERRED_LOG_RING_CAPACITY must be a power of 2");
+
+static const uint32_t kRingCapacity = CONFIG_DEFERRED_LOG_RING_CAPACITY;
+static const char kLevelLetters[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+// Each ring has multiple producers (all the tasks and ISRs on the core),
+// which are serialized by masking interrupts on the core,
+// and a single consumer (the drain task on any core).
+typedef struct {
+  DeferredLogRecord records[CONFIG_DEFERRED_LOG_RING_CAPACITY];
+  uint32_t head; // Written only by the producers on the core
+  uint32_t tail; // Written only by the drain task
+  uint32_t droppedRecordCount;
+} DeferredLogRing;
+
+volatile esp_log_level_t deferredLogLevel = (esp_log_level_t)CONFIG_LOG_DEFAULT_LEVEL;
+
+static DeferredLogRing rings[portNUM_PROCESSORS];
+
+void writeDeferredLog(esp_log_level_t level, const char* tag, const char* format, int argCount, ...) {
+  uint32_t timestamp = esp_log_timestamp();
+
+  uint32_t interruptState = portSET_INTERRUPT_MASK_FROM_ISR();
+
+  DeferredLogRing* ring = &rings[xPortGetCoreID()];
+  uint32_t head = ring->head;
+
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= kRingCapacity) {
+    ring->droppedRecordCount++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(interruptState);
+    return;
+  }
+
+  DeferredLogRecord* record = &ring->records[head & (kRingCapacity - 1)];
+  record->timestamp = timestamp;
+  record->tag = tag;
+  record->format = format;
+  record->level = level;
+  record->argCount = argCount;
+
+  va_list args;
+  va_start(args, argCount);
+  for (int i = 0; i < argCount && i < DEFERRED_LOG_MAX_ARG_COUNT; i++) {
+    record->args[i] = va_arg(args, uint32_t);
+  }
+  va_end(args);
+
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(interruptState);
+}
+
+void setDeferredLogLevel(esp_log_level_t level) {
+  deferredLogLevel = level;
+}
+
+uint32_t getDeferredLogDroppedRecordCount() {
+  uint32_t count = 0;
+
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    count += rings[i].droppedRecordCount;
+  }
+
+  return count;
+}
+
+static void outputRecord(const DeferredLogRecord* record) {
+#ifdef CONFIG_DEFERRED_LOG_BINARY_OUTPUT
+  const uint8_t* bytes = (const uint8_t*)record;
+  char line[sizeof(DeferredLogRecord) * 2 + 1];
+
+  for (size_t i = 0; i < sizeof(DeferredLogRecord); i++) {
+    sprintf(&line[i * 2], "%02x", bytes[i]);
+  }
+
+  printf("DLOG %s\n", line);
+#else
+  char levelLetter = record->level < sizeof(kLevelLetters) ? kLevelLetters[record->level] : '?';
+  printf("%c (%u) %s: ", levelLetter, record->timestamp, record->tag);
+  // All the arguments are 32-bit words, so passing them as is works for any integer or pointer specifiers.
+  printf(record->format, record->args[0], record->args[1], record->args[2], record->args[3]);
+  printf("\n");
+#endif
+}
+
+static void drainRecords(void* arg) {
+  uint32_t lastDroppedRecordCount = 0;
+
+  while (true) {
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+      DeferredLogRing* ring = &rings[i];
+      uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+      uint32_t tail = ring->tail;
+
+      while (tail != head) {
+        DeferredLogRecord record = ring->records[tail & (kRingCapacity - 1)];
+        tail++;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        outputRecord(&record);
+      }
+    }
+
+    uint32_t droppedRecordCount = getDeferredLogDroppedRecordCount();
+    if (droppedRecordCount != lastDroppedRecordCount) {
+      printf("W (%u) DeferredLog: %u records dropped\n", esp_log_timestamp(), droppedRecordCount - lastDroppedRecordCount);
+      lastDroppedRecordCount = droppedRecordCount;
+    }
+
+    vTaskDelay(CONFIG_DEFERRED_LOG_DRAIN_INTERVAL_MS / portTICK_PERIOD_MS);
+  }
+}
+
+void startDeferredLogging() {
+  memset(rings, 0, sizeof(rings));
+  xTaskCreate(drainRecords, "DeferredLog", 3 * 1024, NULL, tskIDLE_PRIORITY + 1, NULL);
+}
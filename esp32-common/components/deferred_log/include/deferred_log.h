@@ -0,0 +1,55 @@
+#pragma once
+
+// Logging that only records the format string pointer and raw arguments on the caller's side
+// and defers the formatting to a background task (or to the host with tools/decode_deferred_log.py).
+//
+// Limitations:
+// * Up to 4 arguments
+// * Arguments must be 32-bit or smaller integers or pointers (no float/double)
+// * %s arguments must point to strings that live forever (e.g. string literals)
+
+#include <stdint.h>
+#include <esp_log.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEFERRED_LOG_MAX_ARG_COUNT 4
+
+typedef struct {
+  uint32_t timestamp; // In milliseconds, same as esp_log_timestamp()
+  const char* tag;
+  const char* format;
+  uint8_t level;
+  uint8_t argCount;
+  uint16_t reserved;
+  uint32_t args[DEFERRED_LOG_MAX_ARG_COUNT];
+} DeferredLogRecord;
+
+extern volatile esp_log_level_t deferredLogLevel;
+
+void startDeferredLogging();
+void setDeferredLogLevel(esp_log_level_t level);
+uint32_t getDeferredLogDroppedRecordCount();
+void writeDeferredLog(esp_log_level_t level, const char* tag, const char* format, int argCount, ...);
+
+#define DEFERRED_LOG_ARG_COUNT(...) _DEFERRED_LOG_ARG_COUNT(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define _DEFERRED_LOG_ARG_COUNT(_0, _1, _2, _3, _4, N, ...) N
+
+// The level check is a single load and compare, so disabled logs cost almost nothing.
+#define DEFERRED_LOG_LEVEL(level, tag, format, ...) do { \
+    if ((level) <= deferredLogLevel) { \
+      writeDeferredLog(level, tag, format, DEFERRED_LOG_ARG_COUNT(__VA_ARGS__), ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define DEFERRED_LOGE(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_ERROR,   tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGW(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_WARN,    tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGI(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_INFO,    tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGD(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_DEBUG,   tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGV(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
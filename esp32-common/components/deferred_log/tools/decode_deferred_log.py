@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""
+Decode binary records output by the deferred_log component (CONFIG_DEFERRED_LOG_BINARY_OUTPUT)
+back into text, using the format strings and tags in the firmware ELF file.
+
+    python3 decode_deferred_log.py build/esp32-wifi-accessory.elf < monitor.log
+    idf.py monitor | python3 decode_deferred_log.py build/esp32-wifi-accessory.elf
+
+Lines other than "DLOG ..." are passed through as is.
+
+Requires pyelftools (pip install pyelftools).
+"""
+
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+RECORD_FORMAT = '<IIIBBH4I'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+LEVEL_LETTERS = 'NEWIDV'
+
+# %[flags][width][.precision][length]specifier
+FORMAT_SPECIFIER_PATTERN = re.compile(r'%([-+ #0]*)(\d*)(\.\d+)?(hh|h|ll|l|z|j|t)?([diouxXcsp%])')
+
+
+class StringTable:
+    def __init__(self, elf_path):
+        self.sections = []
+
+        with open(elf_path, 'rb') as file:
+            elf = ELFFile(file)
+            for section in elf.iter_sections():
+                if section['sh_addr'] == 0 or section['sh_type'] != 'SHT_PROGBITS':
+                    continue
+                self.sections.append((section['sh_addr'], section.data()))
+
+    def string_at(self, address):
+        for start, data in self.sections:
+            if start <= address < start + len(data):
+                offset = address - start
+                end = data.index(b'\0', offset)
+                return data[offset:end].decode('utf-8', errors='replace')
+        return None
+
+
+def to_signed(value):
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def format_message(strings, format, args):
+    arg_iterator = iter(args)
+
+    def replace(match):
+        flags, width, precision, _length, specifier = match.groups()
+
+        if specifier == '%':
+            return '%'
+
+        value = next(arg_iterator, 0)
+        spec = '%' + flags + width + (precision or '')
+
+        if specifier in 'di':
+            return (spec + 'd') % to_signed(value)
+        elif specifier == 'u':
+            return (spec + 'd') % value
+        elif specifier == 'c':
+            return (spec + 'c') % chr(value & 0xFF)
+        elif specifier == 's':
+            string = strings.string_at(value)
+            return (spec + 's') % (string if string is not None else '<0x%08x>' % value)
+        elif specifier == 'p':
+            return '0x%08x' % value
+        else:
+            return (spec + specifier) % value
+
+    return FORMAT_SPECIFIER_PATTERN.sub(replace, format)
+
+
+def decode_line(strings, line):
+    hex_record = line[len('DLOG '):].strip()
+    timestamp, tag_address, format_address, level, arg_count, _, *args = struct.unpack(RECORD_FORMAT, bytes.fromhex(hex_record))
+
+    tag = strings.string_at(tag_address) or '<0x%08x>' % tag_address
+    format = strings.string_at(format_address)
+
+    if format is None:
+        message = '<unknown format 0x%08x> %s' % (format_address, ' '.join('0x%08x' % arg for arg in args[:arg_count]))
+    else:
+        message = format_message(strings, format, args[:arg_count])
+
+    level_letter = LEVEL_LETTERS[level] if level < len(LEVEL_LETTERS) else '?'
+    return '%s (%d) %s: %s' % (level_letter, timestamp, tag, message)
+
+
+def main():
+    if len(sys.argv) != 2:
+        print('Usage: %s ELF_FILE < LOG' % sys.argv[0], file=sys.stderr)
+        sys.exit(1)
+
+    strings = StringTable(sys.argv[1])
+
+    for line in sys.stdin:
+        if line.startswith('DLOG ') and len(line.strip()) == len('DLOG ') + RECORD_SIZE * 2:
+            print(decode_line(strings, line))
+        else:
+            sys.stdout.write(line)
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
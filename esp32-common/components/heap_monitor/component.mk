@@ -0,0 +1,4 @@
+#
+# Component Makefile for ESP-IDF v3.x (GNU Make based build system)
+#
+COMPONENT_ADD_INCLUDEDIRS := include
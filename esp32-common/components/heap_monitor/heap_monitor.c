@@ -0,0 +1,140 @@
+#include "heap_monitor.h"
+
+#include <string.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <sdkconfig.h>
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+#include <esp_heap_trace.h>
+#endif
+
+static const char* TAG = "HeapMonitor";
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+
+typedef struct {
+  void* caller;
+  uint32_t count;
+  size_t bytes;
+} HeapCallSite;
+
+static heap_trace_record_t records[CONFIG_HEAP_MONITOR_TRACE_RECORD_COUNT];
+// Every record may come from a distinct caller. Kept off the stack of the logging task.
+static HeapCallSite sites[CONFIG_HEAP_MONITOR_TRACE_RECORD_COUNT];
+
+#endif
+
+void startHeapMonitor() {
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+  ESP_ERROR_CHECK(heap_trace_init_standalone(records, CONFIG_HEAP_MONITOR_TRACE_RECORD_COUNT));
+  // Only the allocations not freed yet are kept
+  ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_LEAKS));
+#endif
+}
+
+HeapStatistics getHeapStatistics() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+
+  HeapStatistics statistics = {
+    .freeBytes = info.total_free_bytes,
+    .minimumFreeBytes = info.minimum_free_bytes,
+    .largestFreeBlock = info.largest_free_block,
+    .allocatedBytes = info.total_allocated_bytes,
+    .allocatedBlocks = info.allocated_blocks,
+    .fragmentationPercent = 0,
+  };
+
+  if (info.total_free_bytes > 0) {
+    statistics.fragmentationPercent = 100 - (uint8_t)((uint64_t)info.largest_free_block * 100 / info.total_free_bytes);
+  }
+
+  return statistics;
+}
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+
+// Aggregates all the live records by the immediate caller of malloc()
+// and logs the call sites with the most live bytes
+static void logCallSites() {
+  size_t siteCount = 0;
+  size_t recordCount = heap_trace_get_count();
+
+  for (size_t i = 0; i < recordCount; i++) {
+    heap_trace_record_t record;
+    if (heap_trace_get(i, &record) != ESP_OK || record.size == 0) {
+      continue;
+    }
+
+    void* caller = record.alloced_by[0];
+    size_t index;
+    for (index = 0; index < siteCount; index++) {
+      if (sites[index].caller == caller) {
+        break;
+      }
+    }
+
+    if (index == siteCount) {
+      sites[siteCount].caller = caller;
+      sites[siteCount].count = 0;
+      sites[siteCount].bytes = 0;
+      siteCount++;
+    }
+
+    sites[index].count++;
+    sites[index].bytes += record.size;
+  }
+
+  // Partial selection sort since only the top few are logged
+  size_t topCount = siteCount < CONFIG_HEAP_MONITOR_TOP_SITE_COUNT ? siteCount : CONFIG_HEAP_MONITOR_TOP_SITE_COUNT;
+
+  for (size_t i = 0; i < topCount; i++) {
+    size_t largestIndex = i;
+    for (size_t j = i + 1; j < siteCount; j++) {
+      if (sites[j].bytes > sites[largestIndex].bytes) {
+        largestIndex = j;
+      }
+    }
+
+    HeapCallSite site = sites[largestIndex];
+    sites[largestIndex] = sites[i];
+    sites[i] = site;
+
+    ESP_LOGI(TAG, "  %p: %u bytes in %u blocks", site.caller, site.bytes, site.count);
+  }
+
+  size_t otherBytes = 0;
+  for (size_t i = topCount; i < siteCount; i++) {
+    otherBytes += sites[i].bytes;
+  }
+
+  if (otherBytes > 0) {
+    ESP_LOGI(TAG, "  others: %u bytes at %u call sites", otherBytes, siteCount - topCount);
+  }
+
+  if (recordCount >= CONFIG_HEAP_MONITOR_TRACE_RECORD_COUNT) {
+    ESP_LOGW(TAG, "All the trace records are in use; increase CONFIG_HEAP_MONITOR_TRACE_RECORD_COUNT");
+  }
+}
+
+#endif
+
+void logHeapStatistics() {
+  HeapStatistics statistics = getHeapStatistics();
+
+  ESP_LOGI(
+    TAG,
+    "free: %u bytes (min %u, largest block %u, fragmentation %u%%), allocated: %u bytes in %u blocks",
+    statistics.freeBytes,
+    statistics.minimumFreeBytes,
+    statistics.largestFreeBlock,
+    statistics.fragmentationPercent,
+    statistics.allocatedBytes,
+    statistics.allocatedBlocks
+  );
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+  logCallSites();
+#endif
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Reports the heap usage and fragmentation,
+// and the live allocations by call site when heap tracing is enabled.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  size_t freeBytes;
+  size_t minimumFreeBytes; // Low watermark since boot
+  size_t largestFreeBlock;
+  size_t allocatedBytes;
+  size_t allocatedBlocks;
+  // 0 when all the free memory is a single block, close to 100 when it is scattered in small blocks
+  uint8_t fragmentationPercent;
+} HeapStatistics;
+
+// Starts recording the live allocations if CONFIG_HEAP_TRACING_STANDALONE is enabled.
+// Call as early as possible so that the allocations at the boot time are covered.
+void startHeapMonitor();
+
+// Of the 8-bit accessible internal heap
+HeapStatistics getHeapStatistics();
+
+// Also logs the call sites with the most live bytes if heap tracing is enabled.
+// The addresses can be resolved with addr2line of the ELF file.
+void logHeapStatistics();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,80 @@
+#include <esp_timer.h>
+
+#include <stdbool.h>
+
+struct FakeTimer {
+  esp_timer_cb_t callback;
+  void* arg;
+  bool isRunning;
+  int64_t expiryMicros;
+  uint64_t periodMicros; // 0 for one-shot
+};
+
+static struct FakeTimer timer;
+static int64_t nowMicros = 0;
+
+int64_t esp_timer_get_time(void) {
+  return nowMicros;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+  timer.callback = args->callback;
+  timer.arg = args->arg;
+  timer.isRunning = false;
+  *handle = &timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t handle, uint64_t timeoutMicros) {
+  if (handle->isRunning) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  handle->isRunning = true;
+  handle->expiryMicros = nowMicros + timeoutMicros;
+  handle->periodMicros = 0;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t handle, uint64_t periodMicros) {
+  if (handle->isRunning) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  handle->isRunning = true;
+  handle->expiryMicros = nowMicros + periodMicros;
+  handle->periodMicros = periodMicros;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t handle) {
+  if (!handle->isRunning) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  handle->isRunning = false;
+  return ESP_OK;
+}
+
+void fakeTimerAdvance(int64_t micros) {
+  int64_t targetMicros = nowMicros + micros;
+
+  while (timer.isRunning && timer.expiryMicros <= targetMicros) {
+    nowMicros = timer.expiryMicros;
+
+    if (timer.periodMicros > 0) {
+      timer.expiryMicros += timer.periodMicros;
+    } else {
+      timer.isRunning = false;
+    }
+
+    timer.callback(timer.arg);
+  }
+
+  nowMicros = targetMicros;
+}
+
+void fakeTimerReset(void) {
+  timer.isRunning = false;
+  nowMicros = 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// A fake esp_timer driven by a manually advanced clock; see fake_esp_timer.c
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct FakeTimer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum {
+  ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutMicros);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t periodMicros);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+
+// Advances the clock, invoking the timer callback at each expiry on the way
+void fakeTimerAdvance(int64_t micros);
+void fakeTimerReset(void);
@@ -0,0 +1,11 @@
+#pragma once
+
+// Single threaded on the host, so the critical sections are no-ops
+
+typedef struct {
+  int count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((mux)->count++)
+#define portEXIT_CRITICAL(mux) ((mux)->count--)
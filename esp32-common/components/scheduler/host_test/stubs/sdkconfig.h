@@ -0,0 +1,2 @@
+#pragma once
+// The defaults in scheduler.c are used
@@ -0,0 +1,245 @@
+#include <scheduler.h>
+#include <esp_timer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TICK_MICROS (10 * 1000)
+
+static int failureCount = 0;
+
+#define CHECK(condition) do { \
+  if (!(condition)) { \
+    fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+    failureCount++; \
+  } \
+} while (0)
+
+typedef struct {
+  int invocationCount;
+  int64_t lastInvokedMicros;
+} Counter;
+
+static void count(void* arg) {
+  Counter* counter = (Counter*)arg;
+  counter->invocationCount++;
+  counter->lastInvokedMicros = esp_timer_get_time();
+}
+
+static void setUp(void) {
+  fakeTimerReset();
+  startScheduler();
+}
+
+// Delays are rounded up to ticks counted from the start of the current one,
+// so a callback fires within one tick of the requested delay.
+static void testOneShotFiresOnTime(void) {
+  setUp();
+  fakeTimerAdvance(3 * 1000);
+
+  Counter counter = {0};
+  int64_t scheduledMicros = esp_timer_get_time();
+  CHECK(scheduleCallback(100, count, &counter) != 0);
+
+  fakeTimerAdvance(80 * 1000);
+  CHECK(counter.invocationCount == 0);
+
+  fakeTimerAdvance(30 * 1000);
+  CHECK(counter.invocationCount == 1);
+  CHECK(counter.lastInvokedMicros - scheduledMicros > 100 * 1000 - TICK_MICROS);
+  CHECK(counter.lastInvokedMicros - scheduledMicros <= 100 * 1000);
+
+  // Nothing is left, so the timer has stopped
+  SchedulerStatistics statistics = getSchedulerStatistics();
+  CHECK(statistics.wakeupCount == 1);
+  CHECK(statistics.activeCount == 0);
+}
+
+static void testCancel(void) {
+  setUp();
+
+  Counter counter = {0};
+  ScheduledCallbackHandle handle = scheduleCallback(50, count, &counter);
+  CHECK(cancelScheduledCallback(handle));
+  CHECK(!cancelScheduledCallback(handle));
+
+  fakeTimerAdvance(1000 * 1000);
+  CHECK(counter.invocationCount == 0);
+
+  // A stale handle must not cancel the entry reusing the same slot
+  handle = scheduleCallback(50, count, &counter);
+  fakeTimerAdvance(100 * 1000);
+  CHECK(counter.invocationCount == 1);
+  ScheduledCallbackHandle newHandle = scheduleCallback(50, count, &counter);
+  CHECK(!cancelScheduledCallback(handle));
+  fakeTimerAdvance(100 * 1000);
+  CHECK(counter.invocationCount == 2);
+  CHECK(!cancelScheduledCallback(newHandle));
+  CHECK(!cancelScheduledCallback(0));
+}
+
+// A long repeating callback must not keep the timer firing every tick
+static void testLongRepeatingCallbackWakesUpOncePerPeriod(void) {
+  setUp();
+
+  Counter counter = {0};
+  ScheduledCallbackHandle handle = scheduleRepeatingCallback(10 * 60 * 1000, count, &counter);
+  CHECK(handle != 0);
+
+  fakeTimerAdvance(60LL * 60 * 1000 * 1000 + 1);
+  CHECK(counter.invocationCount == 6);
+  CHECK(getSchedulerStatistics().wakeupCount == 6);
+
+  // Short callbacks in between are still on time
+  Counter shortCounter = {0};
+  fakeTimerAdvance(123 * 1000);
+  int64_t scheduledMicros = esp_timer_get_time();
+  scheduleCallback(1000, count, &shortCounter);
+  fakeTimerAdvance(1000 * 1000);
+  CHECK(shortCounter.invocationCount == 1);
+  CHECK(shortCounter.lastInvokedMicros - scheduledMicros > 1000 * 1000 - TICK_MICROS);
+
+  // The period is kept without drifting
+  fakeTimerAdvance(10LL * 60 * 1000 * 1000);
+  CHECK(counter.invocationCount == 7);
+  CHECK(counter.lastInvokedMicros == 7 * 10LL * 60 * 1000 * 1000);
+
+  CHECK(cancelScheduledCallback(handle));
+  uint32_t wakeupCount = getSchedulerStatistics().wakeupCount;
+  fakeTimerAdvance(60LL * 60 * 1000 * 1000);
+  CHECK(getSchedulerStatistics().wakeupCount <= wakeupCount + 1);
+}
+
+// Delays in the level 1 and 2 slots are cascaded down at the right ticks
+static void testLongDelays(void) {
+  static const uint32_t kDelayMillis[] = {3 * 1000, 5 * 60 * 1000, 2 * 60 * 60 * 1000, 20, 2560, 163840};
+  static const size_t kCount = sizeof(kDelayMillis) / sizeof(kDelayMillis[0]);
+
+  setUp();
+  fakeTimerAdvance(7 * 1000);
+
+  Counter counters[kCount];
+  memset(counters, 0, sizeof(counters));
+  int64_t scheduledMicros = esp_timer_get_time();
+
+  for (size_t i = 0; i < kCount; i++) {
+    CHECK(scheduleCallback(kDelayMillis[i], count, &counters[i]) != 0);
+  }
+
+  fakeTimerAdvance(3LL * 60 * 60 * 1000 * 1000);
+
+  for (size_t i = 0; i < kCount; i++) {
+    int64_t elapsedMicros = counters[i].lastInvokedMicros - scheduledMicros;
+    CHECK(counters[i].invocationCount == 1);
+    CHECK(elapsedMicros > kDelayMillis[i] * 1000LL - TICK_MICROS);
+    CHECK(elapsedMicros <= kDelayMillis[i] * 1000LL);
+  }
+
+  CHECK(getSchedulerStatistics().wakeupCount == kCount);
+}
+
+typedef struct {
+  int remainingCount;
+  Counter counter;
+} Chain;
+
+static void reschedule(void* arg) {
+  Chain* chain = (Chain*)arg;
+  count(&chain->counter);
+
+  if (--chain->remainingCount > 0) {
+    scheduleCallback(20, reschedule, chain);
+  }
+}
+
+static void testSchedulingFromCallback(void) {
+  setUp();
+
+  Chain chain = {5, {0}};
+  scheduleCallback(20, reschedule, &chain);
+  fakeTimerAdvance(1000 * 1000);
+  CHECK(chain.counter.invocationCount == 5);
+  CHECK(chain.counter.lastInvokedMicros == 100 * 1000);
+}
+
+static void testPoolExhaustion(void) {
+  setUp();
+
+  Counter counter = {0};
+  int scheduledCount = 0;
+
+  while (scheduleCallback(100, count, &counter) != 0) {
+    scheduledCount++;
+  }
+
+  CHECK(scheduledCount == 32);
+  CHECK(getSchedulerStatistics().failedCount == 1);
+
+  fakeTimerAdvance(200 * 1000);
+  CHECK(counter.invocationCount == 32);
+  CHECK(scheduleCallback(100, count, &counter) != 0);
+}
+
+static int64_t getHostNanos(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Keeps half of the pool in use so that the slots have neighbors to unlink from
+static void benchmarkScheduleAndCancel(void) {
+  static const int kOperationCount = 10000;
+  static const int kResidentCount = 16;
+
+  setUp();
+
+  Counter counter = {0};
+  for (int i = 0; i < kResidentCount; i++) {
+    scheduleCallback(1000 + i * 7919, count, &counter);
+  }
+
+  uint32_t* delays = malloc(kOperationCount * sizeof(uint32_t));
+  srand(1);
+  for (int i = 0; i < kOperationCount; i++) {
+    delays[i] = 10 + rand() % (60 * 60 * 1000);
+  }
+
+  int64_t startNanos = getHostNanos();
+
+  for (int i = 0; i < kOperationCount; i++) {
+    ScheduledCallbackHandle handle = scheduleCallback(delays[i], count, &counter);
+    if (!cancelScheduledCallback(handle)) {
+      failureCount++;
+    }
+  }
+
+  int64_t elapsedNanos = getHostNanos() - startNanos;
+  free(delays);
+
+  printf(
+    "%d schedule/cancel pairs: %.1f us total, %.1f ns per pair\n",
+    kOperationCount,
+    elapsedNanos / 1000.0,
+    (double)elapsedNanos / kOperationCount
+  );
+}
+
+int main(void) {
+  testOneShotFiresOnTime();
+  testCancel();
+  testLongRepeatingCallbackWakesUpOncePerPeriod();
+  testLongDelays();
+  testSchedulingFromCallback();
+  testPoolExhaustion();
+  benchmarkScheduleAndCancel();
+
+  if (failureCount > 0) {
+    fprintf(stderr, "%d checks failed\n", failureCount);
+    return 1;
+  }
+
+  printf("All checks passed\n");
+  return 0;
+}
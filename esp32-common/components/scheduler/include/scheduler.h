@@ -0,0 +1,46 @@
+#pragma once
+
+// Runs callbacks later on a timer wheel driven by a single esp_timer,
+// so that accessories don't need to create their own esp_timers.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 0 is never a valid handle
+typedef uint32_t ScheduledCallbackHandle;
+
+typedef void (*ScheduledCallback)(void* arg);
+
+typedef struct {
+  uint32_t scheduledCount;
+  uint32_t cancelledCount;
+  uint32_t invokedCount;
+  uint32_t failedCount; // Scheduling failed since all the entries were in use
+  uint32_t activeCount;
+  uint32_t maxActiveCount;
+  uint32_t wakeupCount; // The timer fires only at the ticks anything expires at
+} SchedulerStatistics;
+
+// This must be called before scheduling anything.
+void startScheduler();
+
+// Returns 0 if no entry is available.
+// Callbacks are invoked in the esp_timer task.
+ScheduledCallbackHandle scheduleCallback(uint32_t delayMillis, ScheduledCallback callback, void* arg);
+ScheduledCallbackHandle scheduleRepeatingCallback(uint32_t periodMillis, ScheduledCallback callback, void* arg);
+
+// Returns false if the callback has already been invoked (for one-shot ones) or cancelled.
+// Once this returns, the callback won't be invoked anymore
+// unless it's being invoked right now in the esp_timer task.
+bool cancelScheduledCallback(ScheduledCallbackHandle handle);
+
+SchedulerStatistics getSchedulerStatistics();
+void logSchedulerStatistics();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,464 @@
+#include "scheduler.h"
+
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <sdkconfig.h>
+
+#ifndef CONFIG_SCHEDULER_CAPACITY
+#define CONFIG_SCHEDULER_CAPACITY 32
+#endif
+
+#ifndef CONFIG_SCHEDULER_TICK_MS
+#define CONFIG_SCHEDULER_TICK_MS 10
+#endif
+
+_Static_assert(CONFIG_SCHEDULER_CAPACITY < INT16_MAX, "CONFIG_SCHEDULER_CAPACITY is too large");
+
+static const char* TAG = "Scheduler";
+
+// Level 0 has 1 tick slots, level 1 has 256 tick slots and level 2 has 16384 tick slots.
+// Entries in a higher level are moved to lower levels (cascaded) when the lower level wraps around.
+#define LEVEL0_BITS 8
+#define LEVEL1_BITS 6
+#define LEVEL2_BITS 6
+#define LEVEL0_SIZE (1 << LEVEL0_BITS)
+#define LEVEL1_SIZE (1 << LEVEL1_BITS)
+#define LEVEL2_SIZE (1 << LEVEL2_BITS)
+#define LEVEL1_OFFSET LEVEL0_SIZE
+#define LEVEL2_OFFSET (LEVEL0_SIZE + LEVEL1_SIZE)
+#define SLOT_COUNT (LEVEL0_SIZE + LEVEL1_SIZE + LEVEL2_SIZE)
+#define MAX_DELAY_TICKS ((1 << (LEVEL0_BITS + LEVEL1_BITS + LEVEL2_BITS)) - 1)
+
+#define NIL (-1)
+
+typedef enum {
+  EntryStateFree = 0,
+  EntryStateScheduled, // Linked in a slot
+  EntryStateExpired,   // Detached from the slot and waiting for the invocation in the current tick
+  EntryStateInvoking,
+  EntryStateCancelled, // Cancelled while expired or invoking; freed by the tick handler
+} EntryState;
+
+typedef struct {
+  int16_t previous;
+  int16_t next;
+  int16_t slot;
+  uint16_t generation;
+  uint8_t state;
+  uint32_t expiryTick;
+  uint32_t periodTicks; // 0 for one-shot callbacks
+  ScheduledCallback callback;
+  void* arg;
+} SchedulerEntry;
+
+#define TICK_MICROS (CONFIG_SCHEDULER_TICK_MS * 1000LL)
+
+static SchedulerEntry entries[CONFIG_SCHEDULER_CAPACITY];
+static int16_t slots[SLOT_COUNT];
+static int16_t freeEntryHead = NIL;
+// The last tick whose slot has been processed, and when it was due on the esp_timer clock
+static uint32_t currentTick = 0;
+static int64_t currentTickMicros = 0;
+static esp_timer_handle_t timer = NULL;
+static bool isTimerRunning = false;
+static uint32_t armedTick = 0; // The timer fires at this tick while running
+static bool isTicking = false;
+static SchedulerStatistics statistics;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void tick(void* arg);
+
+void startScheduler() {
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    slots[i] = NIL;
+  }
+
+  memset(entries, 0, sizeof(entries));
+  for (int i = 0; i < CONFIG_SCHEDULER_CAPACITY; i++) {
+    entries[i].next = (i + 1 < CONFIG_SCHEDULER_CAPACITY) ? i + 1 : NIL;
+    entries[i].slot = NIL;
+  }
+  freeEntryHead = 0;
+
+  memset(&statistics, 0, sizeof(statistics));
+
+  currentTick = 0;
+  currentTickMicros = esp_timer_get_time();
+
+  esp_timer_create_args_t config = {
+    .callback = tick,
+    .arg = NULL,
+    .dispatch_method = ESP_TIMER_TASK,
+    .name = "Scheduler",
+  };
+
+  ESP_ERROR_CHECK(esp_timer_create(&config, &timer));
+}
+
+static ScheduledCallbackHandle makeHandle(int16_t index) {
+  return ((uint32_t)entries[index].generation << 16) | (uint32_t)(index + 1);
+}
+
+static int16_t findEntry(ScheduledCallbackHandle handle) {
+  int32_t index = (int32_t)(handle & 0xFFFF) - 1;
+
+  if (index < 0 || index >= CONFIG_SCHEDULER_CAPACITY) {
+    return NIL;
+  }
+
+  if (entries[index].generation != (uint16_t)(handle >> 16)) {
+    return NIL;
+  }
+
+  return index;
+}
+
+static void linkEntry(int16_t index) {
+  SchedulerEntry* entry = &entries[index];
+  uint32_t delta = entry->expiryTick - currentTick;
+  int16_t slot;
+
+  if (delta < LEVEL0_SIZE) {
+    slot = entry->expiryTick & (LEVEL0_SIZE - 1);
+  } else if (delta < (1 << (LEVEL0_BITS + LEVEL1_BITS))) {
+    slot = LEVEL1_OFFSET + ((entry->expiryTick >> LEVEL0_BITS) & (LEVEL1_SIZE - 1));
+  } else {
+    slot = LEVEL2_OFFSET + ((entry->expiryTick >> (LEVEL0_BITS + LEVEL1_BITS)) & (LEVEL2_SIZE - 1));
+  }
+
+  entry->slot = slot;
+  entry->previous = NIL;
+  entry->next = slots[slot];
+  if (slots[slot] != NIL) {
+    entries[slots[slot]].previous = index;
+  }
+  slots[slot] = index;
+}
+
+static void unlinkEntry(int16_t index) {
+  SchedulerEntry* entry = &entries[index];
+
+  if (entry->previous != NIL) {
+    entries[entry->previous].next = entry->next;
+  } else {
+    slots[entry->slot] = entry->next;
+  }
+
+  if (entry->next != NIL) {
+    entries[entry->next].previous = entry->previous;
+  }
+
+  entry->slot = NIL;
+  entry->previous = NIL;
+  entry->next = NIL;
+}
+
+static void freeEntry(int16_t index) {
+  SchedulerEntry* entry = &entries[index];
+  entry->state = EntryStateFree;
+  entry->generation++; // Invalidate the handles
+  entry->callback = NULL;
+  entry->arg = NULL;
+  entry->next = freeEntryHead;
+  freeEntryHead = index;
+  statistics.activeCount--;
+}
+
+static void cascade(int16_t slot) {
+  int16_t index = slots[slot];
+  slots[slot] = NIL;
+
+  while (index != NIL) {
+    int16_t next = entries[index].next;
+    linkEntry(index);
+    index = next;
+  }
+}
+
+// Ticks compare in modular arithmetic so that they can wrap around
+static bool isTickBefore(uint32_t tick, uint32_t otherTick) {
+  return (int32_t)(tick - otherTick) < 0;
+}
+
+static uint32_t getNowTick() {
+  return currentTick + (uint32_t)((esp_timer_get_time() - currentTickMicros) / TICK_MICROS);
+}
+
+static void setCurrentTick(uint32_t tick) {
+  currentTickMicros += (int64_t)(tick - currentTick) * TICK_MICROS;
+  currentTick = tick;
+}
+
+static bool findEarliestExpiryTick(uint32_t* tick) {
+  bool isFound = false;
+
+  for (int i = 0; i < CONFIG_SCHEDULER_CAPACITY; i++) {
+    if (entries[i].state == EntryStateScheduled && (!isFound || isTickBefore(entries[i].expiryTick, *tick))) {
+      *tick = entries[i].expiryTick;
+      isFound = true;
+    }
+  }
+
+  return isFound;
+}
+
+// Nothing expires up to the tick, so the ticks in between don't need to be processed one by one.
+// The entries only need to be linked again relative to the new current tick.
+static void skipToTick(uint32_t tick) {
+  setCurrentTick(tick);
+
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    slots[i] = NIL;
+  }
+
+  for (int16_t i = 0; i < CONFIG_SCHEDULER_CAPACITY; i++) {
+    if (entries[i].state == EntryStateScheduled) {
+      linkEntry(i);
+    }
+  }
+}
+
+// The timer fires only at the ticks something expires at, not every tick,
+// so that long delays (e.g. periodic statistics) don't keep waking up the CPU.
+static void armTimer(uint32_t tick) {
+  int64_t delayMicros = currentTickMicros + (int64_t)(int32_t)(tick - currentTick) * TICK_MICROS - esp_timer_get_time();
+
+  if (isTimerRunning) {
+    esp_timer_stop(timer);
+  }
+
+  esp_timer_start_once(timer, delayMicros > 0 ? delayMicros : 0);
+  isTimerRunning = true;
+  armedTick = tick;
+}
+
+static ScheduledCallbackHandle schedule(uint32_t delayMillis, uint32_t periodMillis, ScheduledCallback callback, void* arg) {
+  // Round up, and at least 1 tick since the slot of the current tick has been already processed
+  uint32_t delayTicks = (delayMillis + CONFIG_SCHEDULER_TICK_MS - 1) / CONFIG_SCHEDULER_TICK_MS;
+  if (delayTicks == 0) {
+    delayTicks = 1;
+  } else if (delayTicks > MAX_DELAY_TICKS) {
+    ESP_LOGW(TAG, "Delay %u ms is too long; clamped", delayMillis);
+    delayTicks = MAX_DELAY_TICKS;
+  }
+
+  uint32_t periodTicks = (periodMillis + CONFIG_SCHEDULER_TICK_MS - 1) / CONFIG_SCHEDULER_TICK_MS;
+  if (periodTicks > MAX_DELAY_TICKS) {
+    periodTicks = MAX_DELAY_TICKS;
+  }
+
+  portENTER_CRITICAL(&mux);
+
+  int16_t index = freeEntryHead;
+
+  if (index == NIL) {
+    statistics.failedCount++;
+    portEXIT_CRITICAL(&mux);
+    ESP_LOGE(TAG, "No entry is available; increase CONFIG_SCHEDULER_CAPACITY");
+    return 0;
+  }
+
+  SchedulerEntry* entry = &entries[index];
+  freeEntryHead = entry->next;
+
+  uint32_t nowTick = getNowTick();
+  if (statistics.activeCount == 0) {
+    // The wheel is empty, so it can catch up with the time for free
+    setCurrentTick(nowTick);
+  }
+
+  // The wheel lags behind the time until the next expiry; keep the delay within its range
+  uint32_t expiryTick = nowTick + delayTicks;
+  if (expiryTick - currentTick > MAX_DELAY_TICKS) {
+    expiryTick = currentTick + MAX_DELAY_TICKS;
+  }
+
+  entry->state = EntryStateScheduled;
+  entry->expiryTick = expiryTick;
+  entry->periodTicks = periodTicks;
+  entry->callback = callback;
+  entry->arg = arg;
+  linkEntry(index);
+
+  statistics.scheduledCount++;
+  statistics.activeCount++;
+  if (statistics.activeCount > statistics.maxActiveCount) {
+    statistics.maxActiveCount = statistics.activeCount;
+  }
+
+  // This is done in the critical section so that it never races with the rearm in tick(),
+  // which rearms the timer by itself after the callbacks
+  if (!isTicking && (!isTimerRunning || isTickBefore(expiryTick, armedTick))) {
+    armTimer(expiryTick);
+  }
+
+  ScheduledCallbackHandle handle = makeHandle(index);
+
+  portEXIT_CRITICAL(&mux);
+
+  return handle;
+}
+
+ScheduledCallbackHandle scheduleCallback(uint32_t delayMillis, ScheduledCallback callback, void* arg) {
+  return schedule(delayMillis, 0, callback, arg);
+}
+
+ScheduledCallbackHandle scheduleRepeatingCallback(uint32_t periodMillis, ScheduledCallback callback, void* arg) {
+  if (periodMillis < CONFIG_SCHEDULER_TICK_MS) {
+    periodMillis = CONFIG_SCHEDULER_TICK_MS;
+  }
+
+  return schedule(periodMillis, periodMillis, callback, arg);
+}
+
+bool cancelScheduledCallback(ScheduledCallbackHandle handle) {
+  bool isCancelled = false;
+
+  portENTER_CRITICAL(&mux);
+
+  int16_t index = findEntry(handle);
+
+  if (index != NIL) {
+    SchedulerEntry* entry = &entries[index];
+
+    switch (entry->state) {
+    case EntryStateScheduled:
+      unlinkEntry(index);
+      freeEntry(index);
+      isCancelled = true;
+      break;
+    case EntryStateExpired:
+      entry->state = EntryStateCancelled;
+      isCancelled = true;
+      break;
+    case EntryStateInvoking:
+      // Stop repeating; a one-shot callback cannot be cancelled while being invoked
+      entry->state = EntryStateCancelled;
+      isCancelled = entry->periodTicks > 0;
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (isCancelled) {
+    statistics.cancelledCount++;
+  }
+
+  portEXIT_CRITICAL(&mux);
+
+  return isCancelled;
+}
+
+SchedulerStatistics getSchedulerStatistics() {
+  portENTER_CRITICAL(&mux);
+  SchedulerStatistics snapshot = statistics;
+  portEXIT_CRITICAL(&mux);
+  return snapshot;
+}
+
+void logSchedulerStatistics() {
+  SchedulerStatistics snapshot = getSchedulerStatistics();
+
+  ESP_LOGI(
+    TAG,
+    "scheduled %u, cancelled %u, invoked %u, failed %u, active %u (max %u), wakeups %u",
+    snapshot.scheduledCount,
+    snapshot.cancelledCount,
+    snapshot.invokedCount,
+    snapshot.failedCount,
+    snapshot.activeCount,
+    snapshot.maxActiveCount,
+    snapshot.wakeupCount
+  );
+}
+
+// Must be called in the critical section, which is released while invoking the callbacks
+static void processNextTick() {
+  currentTick++;
+  currentTickMicros += TICK_MICROS;
+
+  uint32_t level0Index = currentTick & (LEVEL0_SIZE - 1);
+
+  if (level0Index == 0) {
+    uint32_t level1Index = (currentTick >> LEVEL0_BITS) & (LEVEL1_SIZE - 1);
+
+    if (level1Index == 0) {
+      cascade(LEVEL2_OFFSET + ((currentTick >> (LEVEL0_BITS + LEVEL1_BITS)) & (LEVEL2_SIZE - 1)));
+    }
+
+    cascade(LEVEL1_OFFSET + level1Index);
+  }
+
+  // Detach the whole slot so that callbacks can schedule new ones into the same slot safely
+  int16_t index = slots[level0Index];
+  slots[level0Index] = NIL;
+
+  for (int16_t i = index; i != NIL; i = entries[i].next) {
+    entries[i].state = EntryStateExpired;
+    entries[i].slot = NIL;
+  }
+
+  while (index != NIL) {
+    SchedulerEntry* entry = &entries[index];
+    int16_t next = entry->next;
+
+    if (entry->state == EntryStateExpired) {
+      ScheduledCallback callback = entry->callback;
+      void* callbackArg = entry->arg;
+      entry->state = EntryStateInvoking;
+      statistics.invokedCount++;
+
+      portEXIT_CRITICAL(&mux);
+      callback(callbackArg);
+      portENTER_CRITICAL(&mux);
+    }
+
+    if (entry->state == EntryStateInvoking && entry->periodTicks > 0) {
+      entry->state = EntryStateScheduled;
+      entry->expiryTick = currentTick + entry->periodTicks;
+      linkEntry(index);
+    } else {
+      freeEntry(index);
+    }
+
+    index = next;
+  }
+}
+
+// Invoked in the esp_timer task when the earliest entry expires
+static void tick(void* arg) {
+  portENTER_CRITICAL(&mux);
+
+  statistics.wakeupCount++;
+  isTicking = true;
+
+  uint32_t nowTick = getNowTick();
+  uint32_t earliestTick = 0;
+
+  while (isTickBefore(currentTick, nowTick)) {
+    if (!findEarliestExpiryTick(&earliestTick)) {
+      setCurrentTick(nowTick);
+      break;
+    }
+
+    if (isTickBefore(currentTick + 1, earliestTick)) {
+      skipToTick(isTickBefore(earliestTick - 1, nowTick) ? earliestTick - 1 : nowTick);
+    } else {
+      processNextTick();
+    }
+  }
+
+  isTicking = false;
+
+  if (findEarliestExpiryTick(&earliestTick)) {
+    armTimer(earliestTick);
+  } else if (isTimerRunning) {
+    esp_timer_stop(timer);
+    isTimerRunning = false;
+  }
+
+  portEXIT_CRITICAL(&mux);
+}
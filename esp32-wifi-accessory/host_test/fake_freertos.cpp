@@ -0,0 +1,198 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+// A subset of FreeRTOS on threads, so that the tasks of the firmware really run concurrently.
+// Ticks are milliseconds.
+
+typedef std::unique_lock<std::mutex> Lock;
+
+// Waits until the predicate holds; false on timeout
+template <typename Predicate>
+static bool waitFor(std::condition_variable& condition, Lock& lock, TickType_t ticks, Predicate predicate) {
+  if (ticks == portMAX_DELAY) {
+    condition.wait(lock, predicate);
+    return true;
+  }
+
+  return condition.wait_for(lock, std::chrono::milliseconds(ticks), predicate);
+}
+
+struct FakeSemaphore {
+  std::mutex mutex;
+  std::condition_variable condition;
+  uint32_t count;
+  uint32_t maxCount;
+  bool isStatic;
+};
+
+static_assert(sizeof(FakeSemaphore) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t is too small");
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  FakeSemaphore* semaphore = new FakeSemaphore();
+  semaphore->count = 1;
+  semaphore->maxCount = 1;
+  semaphore->isStatic = false;
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer) {
+  FakeSemaphore* semaphore = new (buffer) FakeSemaphore();
+  semaphore->count = 0;
+  semaphore->maxCount = 1;
+  semaphore->isStatic = true;
+  return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t handle) {
+  FakeSemaphore* semaphore = (FakeSemaphore*)handle;
+
+  if (semaphore->isStatic) {
+    semaphore->~FakeSemaphore();
+    // Catches a give after the deletion
+    memset((void*)semaphore, 0xA5, sizeof(FakeSemaphore));
+  } else {
+    delete semaphore;
+  }
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks) {
+  FakeSemaphore* semaphore = (FakeSemaphore*)handle;
+  Lock lock(semaphore->mutex);
+
+  if (!waitFor(semaphore->condition, lock, ticks, [semaphore] { return semaphore->count > 0; })) {
+    return pdFALSE;
+  }
+
+  semaphore->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+  FakeSemaphore* semaphore = (FakeSemaphore*)handle;
+  Lock lock(semaphore->mutex);
+
+  if (semaphore->count >= semaphore->maxCount) {
+    return pdFALSE;
+  }
+
+  semaphore->count++;
+  semaphore->condition.notify_all();
+  return pdTRUE;
+}
+
+struct FakeQueue {
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t length;
+  size_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  FakeQueue* queue = new FakeQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t ticks) {
+  FakeQueue* queue = (FakeQueue*)handle;
+  Lock lock(queue->mutex);
+
+  if (!waitFor(queue->condition, lock, ticks, [queue] { return queue->items.size() < queue->length; })) {
+    return pdFALSE;
+  }
+
+  const uint8_t* bytes = (const uint8_t*)item;
+  queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->itemSize));
+  queue->condition.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* buffer, TickType_t ticks) {
+  FakeQueue* queue = (FakeQueue*)handle;
+  Lock lock(queue->mutex);
+
+  if (!waitFor(queue->condition, lock, ticks, [queue] { return !queue->items.empty(); })) {
+    return pdFALSE;
+  }
+
+  memcpy(buffer, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  queue->condition.notify_all();
+  return pdTRUE;
+}
+
+struct FakeTask {
+  std::mutex mutex;
+  std::condition_variable condition;
+  uint32_t notificationCount;
+};
+
+// The main thread gets its task on the first use
+static thread_local FakeTask* currentTask = NULL;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* arg, UBaseType_t priority, TaskHandle_t* handle) {
+  FakeTask* task = new FakeTask();
+  task->notificationCount = 0;
+
+  if (handle != NULL) {
+    *handle = task;
+  }
+
+  // Tasks never return in the firmware, so the threads are left running until the process exits
+  std::thread([function, arg, task] {
+    currentTask = task;
+    function(arg);
+  }).detach();
+
+  return pdTRUE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  if (currentTask == NULL) {
+    currentTask = new FakeTask();
+    currentTask->notificationCount = 0;
+  }
+
+  return currentTask;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+  FakeTask* task = (FakeTask*)handle;
+  Lock lock(task->mutex);
+  task->notificationCount++;
+  task->condition.notify_all();
+  return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks) {
+  FakeTask* task = (FakeTask*)xTaskGetCurrentTaskHandle();
+  Lock lock(task->mutex);
+
+  if (!waitFor(task->condition, lock, ticks, [task] { return task->notificationCount > 0; })) {
+    return 0;
+  }
+
+  uint32_t count = task->notificationCount;
+  task->notificationCount = clearCountOnExit ? 0 : count - 1;
+  return count;
+}
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
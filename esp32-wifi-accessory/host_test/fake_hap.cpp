@@ -0,0 +1,92 @@
+#include <hap.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t kMaxCharacteristicCount = 8;
+
+struct hap_char {
+  char uuid[40]; // Copied as the SDK does, so it never shares the pointer with the handler tables
+  bool isString;
+  hap_val_t val;
+  void* priv;
+};
+
+struct hap_serv {
+  hap_char_t* chars[kMaxCharacteristicCount];
+  size_t count;
+  hap_serv_read_t read;
+  hap_serv_write_t write;
+  void* priv;
+};
+
+hap_serv_t* fakeServiceCreate() {
+  return (hap_serv_t*)calloc(1, sizeof(hap_serv_t));
+}
+
+hap_char_t* fakeCharacteristicCreate(const char* uuid, bool isString) {
+  hap_char_t* hc = (hap_char_t*)calloc(1, sizeof(hap_char_t));
+  strncpy(hc->uuid, uuid, sizeof(hc->uuid) - 1);
+  hc->isString = isString;
+  return hc;
+}
+
+int fakeServiceRead(hap_serv_t* hs, hap_char_t* hc, hap_status_t* status) {
+  return hs->read(hc, status, hs->priv, NULL);
+}
+
+int fakeServiceWrite(hap_serv_t* hs, hap_write_data_t writeData[], int count) {
+  return hs->write(writeData, count, hs->priv, NULL);
+}
+
+hap_char_t* hap_serv_get_char_by_uuid(hap_serv_t* hs, const char* type_uuid) {
+  for (size_t i = 0; i < hs->count; i++) {
+    if (strcmp(hs->chars[i]->uuid, type_uuid) == 0) {
+      return hs->chars[i];
+    }
+  }
+
+  return NULL;
+}
+
+void hap_serv_add_char(hap_serv_t* hs, hap_char_t* hc) {
+  if (hs->count < kMaxCharacteristicCount) {
+    hs->chars[hs->count++] = hc;
+  }
+}
+
+void hap_serv_set_read_cb(hap_serv_t* hs, hap_serv_read_t read) {
+  hs->read = read;
+}
+
+void hap_serv_set_write_cb(hap_serv_t* hs, hap_serv_write_t write) {
+  hs->write = write;
+}
+
+void hap_serv_set_priv(hap_serv_t* hs, void* priv) {
+  hs->priv = priv;
+}
+
+const char* hap_char_get_type_uuid(hap_char_t* hc) {
+  return hc->uuid;
+}
+
+void hap_char_set_priv(hap_char_t* hc, void* priv) {
+  hc->priv = priv;
+}
+
+void* hap_char_get_priv(hap_char_t* hc) {
+  return hc->priv;
+}
+
+const hap_val_t* hap_char_get_val(hap_char_t* hc) {
+  return &hc->val;
+}
+
+int hap_char_update_val(hap_char_t* hc, hap_val_t* val) {
+  if (hc->isString && hc->val.s != val->s) {
+    free(hc->val.s);
+  }
+
+  hc->val = *val;
+  return HAP_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include "pulse_waveform.h"
+
+// Plays waveforms on a simulated clock instead of the RMT peripheral.
+// The segments go through the same encoding as RMTPulseOutput,
+// so the levels over time are what the pin would output.
+class MockPulseOutput : public PulseOutput {
+public:
+  static const size_t kMaxItemCount = 64;
+
+  uint32_t tickMicros;
+  uint64_t nowMicros;
+  uint64_t startMicros;
+  std::vector<PulseItem> items;
+  uint32_t writeCount;
+
+  MockPulseOutput(uint32_t tickMicros) {
+    this->tickMicros = tickMicros;
+    this->nowMicros = 0;
+    this->startMicros = 0;
+    this->writeCount = 0;
+  }
+
+  bool write(const PulseSegment* segments, size_t segmentCount) {
+    if (this->isBusy()) {
+      return false;
+    }
+
+    PulseItem encodedItems[kMaxItemCount];
+    size_t itemCount = encodePulseSegments(segments, segmentCount, this->tickMicros, encodedItems, kMaxItemCount);
+    if (itemCount == 0) {
+      return false;
+    }
+
+    this->items.assign(encodedItems, encodedItems + itemCount);
+    this->startMicros = this->nowMicros;
+    this->writeCount++;
+    return true;
+  }
+
+  bool isBusy() {
+    return this->nowMicros < this->startMicros + this->getDurationMicros();
+  }
+
+  void advance(uint64_t micros) {
+    this->nowMicros += micros;
+  }
+
+  // Until the end marker
+  uint64_t getDurationMicros() {
+    uint64_t ticks = 0;
+
+    for (size_t i = 0; i < this->items.size(); i++) {
+      if (this->items[i].duration0 == 0) {
+        break;
+      }
+      ticks += this->items[i].duration0;
+
+      if (this->items[i].duration1 == 0) {
+        break;
+      }
+      ticks += this->items[i].duration1;
+    }
+
+    return ticks * this->tickMicros;
+  }
+
+  // The output is low when idle, same as the RMT channel
+  uint8_t getLevel(uint64_t micros) {
+    if (micros < this->startMicros) {
+      return 0;
+    }
+
+    uint64_t elapsedTicks = (micros - this->startMicros) / this->tickMicros;
+
+    for (size_t i = 0; i < this->items.size(); i++) {
+      if (this->items[i].duration0 == 0) {
+        return 0;
+      }
+      if (elapsedTicks < this->items[i].duration0) {
+        return this->items[i].level0;
+      }
+      elapsedTicks -= this->items[i].duration0;
+
+      if (this->items[i].duration1 == 0) {
+        return 0;
+      }
+      if (elapsedTicks < this->items[i].duration1) {
+        return this->items[i].level1;
+      }
+      elapsedTicks -= this->items[i].duration1;
+    }
+
+    return 0;
+  }
+};
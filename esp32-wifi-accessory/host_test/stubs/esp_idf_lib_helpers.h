@@ -0,0 +1,5 @@
+#pragma once
+
+#define HELPER_TARGET_IS_ESP32 1
+#define HELPER_TARGET_IS_ESP8266 0
+#define HELPER_TARGET_VERSION 1
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Microseconds since the start of the process, from fake_freertos.cpp
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
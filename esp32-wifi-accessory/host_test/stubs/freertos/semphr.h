@@ -0,0 +1,26 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Backed by threads in fake_freertos.cpp
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Large enough for the semaphore of fake_freertos.cpp
+typedef union {
+  void* pointer;
+  long double alignment;
+  uint8_t storage[256];
+} StaticSemaphore_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#ifdef __cplusplus
+}
+#endif
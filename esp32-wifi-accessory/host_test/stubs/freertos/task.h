@@ -0,0 +1,25 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Tasks run on threads in fake_freertos.cpp without priorities
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* arg);
+
+#define tskIDLE_PRIORITY 0
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* arg, UBaseType_t priority, TaskHandle_t* handle);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define vTaskDelay(ticks) ((void)(ticks))
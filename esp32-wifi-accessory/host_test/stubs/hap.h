@@ -0,0 +1,65 @@
+#pragma once
+
+// Subset of the esp-homekit-sdk API served by fake_hap.cpp.
+// Characteristics and services are plain structs, and reads and writes are driven by the tests.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HAP_SUCCESS 0
+#define HAP_FAIL -1
+
+typedef enum {
+  HAP_STATUS_SUCCESS = 0,
+  HAP_STATUS_RES_BUSY = -70403,
+  HAP_STATUS_RES_ABSENT = -70409,
+  HAP_STATUS_VAL_INVALID = -70410,
+} hap_status_t;
+
+typedef union {
+  bool b;
+  uint32_t u;
+  float f;
+  char* s;
+} hap_val_t;
+
+typedef struct hap_char hap_char_t;
+typedef struct hap_serv hap_serv_t;
+
+typedef struct {
+  hap_char_t* hc;
+  hap_val_t val;
+  hap_status_t* status;
+} hap_write_data_t;
+
+typedef int (*hap_serv_read_t)(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv);
+typedef int (*hap_serv_write_t)(hap_write_data_t write_data[], int count, void* serv_priv, void* write_priv);
+
+hap_char_t* hap_serv_get_char_by_uuid(hap_serv_t* hs, const char* type_uuid);
+void hap_serv_add_char(hap_serv_t* hs, hap_char_t* hc);
+void hap_serv_set_read_cb(hap_serv_t* hs, hap_serv_read_t read);
+void hap_serv_set_write_cb(hap_serv_t* hs, hap_serv_write_t write);
+void hap_serv_set_priv(hap_serv_t* hs, void* priv);
+
+const char* hap_char_get_type_uuid(hap_char_t* hc);
+void hap_char_set_priv(hap_char_t* hc, void* priv);
+void* hap_char_get_priv(hap_char_t* hc);
+const hap_val_t* hap_char_get_val(hap_char_t* hc);
+// Takes the ownership of string values and frees the previous one as the SDK does
+int hap_char_update_val(hap_char_t* hc, hap_val_t* val);
+
+#ifdef __cplusplus
+}
+#endif
+
+// Test helpers
+hap_serv_t* fakeServiceCreate();
+hap_char_t* fakeCharacteristicCreate(const char* uuid, bool isString);
+// Invokes the callbacks as the HAP core does on requests from controllers
+int fakeServiceRead(hap_serv_t* hs, hap_char_t* hc, hap_status_t* status);
+int fakeServiceWrite(hap_serv_t* hs, hap_write_data_t writeData[], int count);
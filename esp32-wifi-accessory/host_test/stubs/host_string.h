@@ -0,0 +1,7 @@
+#pragma once
+
+// glibc declares strdup() as noexcept, which conflicts with the declaration in util.h,
+// so its declaration is renamed; the tests define strdup() themselves to count allocations.
+#define strdup glibcStrdup
+#include <string.h>
+#undef strdup
@@ -0,0 +1,124 @@
+#include <bmp280.h>
+#include <math.h>
+#include <string.h>
+#include "test_helpers.h"
+
+// Compensation example in the BMP280 datasheet by Bosch Sensortec
+static const uint16_t kCalibration[] = {
+  27504, 26435, (uint16_t)-1000, // dig_T1..3
+  36477, (uint16_t)-10685, 3024, 2855, 140, (uint16_t)-7, 15500, (uint16_t)-14600, 6000, // dig_P1..9
+};
+static const int32_t kRawTemperature = 519888;
+static const int32_t kRawPressure = 415148;
+static const int32_t kTemperature = 2508; // 25.08 degrees Celsius
+static const float kPressurePascals = 100653.27f;
+
+static const uint8_t kChipIDRegister = 0xD0;
+static const uint8_t kCalibrationRegister = 0x88;
+static const uint8_t kDataRegister = 0xF7;
+static const uint8_t kBMP280ChipID = 0x58;
+
+static void setUpRegisters(void) {
+  memset(fakeI2CRegisters, 0, sizeof(fakeI2CRegisters));
+  fakeI2CRegisters[kChipIDRegister] = kBMP280ChipID;
+
+  for (size_t i = 0; i < sizeof(kCalibration) / sizeof(kCalibration[0]); i++) {
+    fakeI2CRegisters[kCalibrationRegister + i * 2] = kCalibration[i] & 0xFF;
+    fakeI2CRegisters[kCalibrationRegister + i * 2 + 1] = kCalibration[i] >> 8;
+  }
+
+  // 20-bit values in MSB, LSB and the upper half of XLSB
+  uint8_t* data = &fakeI2CRegisters[kDataRegister];
+  data[0] = (kRawPressure >> 12) & 0xFF;
+  data[1] = (kRawPressure >> 4) & 0xFF;
+  data[2] = (kRawPressure << 4) & 0xFF;
+  data[3] = (kRawTemperature >> 12) & 0xFF;
+  data[4] = (kRawTemperature >> 4) & 0xFF;
+  data[5] = (kRawTemperature << 4) & 0xFF;
+}
+
+// Same parameters as WeatherSensor
+static void initBMP280(bmp280_t* bmp280) {
+  setUpRegisters();
+  memset(bmp280, 0, sizeof(bmp280_t));
+
+  bmp280_params_t params = {
+    .mode = BMP280_MODE_FORCED,
+    .filter = BMP280_FILTER_OFF,
+    .oversampling_pressure = BMP280_HIGH_RES,
+    .oversampling_temperature = BMP280_HIGH_RES,
+    .oversampling_humidity = BMP280_HIGH_RES,
+    .standby = BMP280_STANDBY_250
+  };
+
+  CHECK_EQUAL(ESP_OK, bmp280_init_desc(bmp280, BMP280_I2C_ADDRESS_0, 0, 21, 22));
+  CHECK_EQUAL(ESP_OK, bmp280_init(bmp280, &params));
+}
+
+static void testFixedPointReferenceVector(void) {
+  bmp280_t bmp280;
+  initBMP280(&bmp280);
+
+  int32_t temperature = 0;
+  uint32_t pressure = 0;
+  fakeI2CReadCount = 0;
+  CHECK_EQUAL(ESP_OK, bmp280_read_fixed(&bmp280, &temperature, &pressure, NULL));
+
+  // All the data registers in a single burst
+  CHECK_EQUAL(1, fakeI2CReadCount);
+  CHECK_EQUAL(kTemperature, temperature);
+  // The 64-bit integer formula differs from the double one in the datasheet by the Q24.8 rounding
+  CHECK(fabsf(pressure / 256.0f - kPressurePascals) < 0.05f);
+}
+
+static void testFloatReferenceVector(void) {
+  bmp280_t bmp280;
+  initBMP280(&bmp280);
+
+  float temperature = 0;
+  float pressure = 0;
+  CHECK_EQUAL(ESP_OK, bmp280_read_float(&bmp280, &temperature, &pressure, NULL));
+
+  CHECK(fabsf(temperature - kTemperature / 100.0f) < 0.005f);
+  CHECK(fabsf(pressure - kPressurePascals) < 0.05f);
+}
+
+// Host timings only show the relative cost of the two paths, not cycles on the ESP32.
+// bmp280_read_float() runs the integer compensation and divides the results.
+static void benchmarkFixedAndFloatPaths(void) {
+  static const int kReadCount = 100000;
+
+  bmp280_t bmp280;
+  initBMP280(&bmp280);
+
+  int32_t fixedTemperature;
+  uint32_t fixedPressure;
+  int64_t startNanos = getHostNanos();
+  for (int i = 0; i < kReadCount; i++) {
+    bmp280_read_fixed(&bmp280, &fixedTemperature, &fixedPressure, NULL);
+  }
+  int64_t fixedNanos = getHostNanos() - startNanos;
+
+  float floatTemperature;
+  float floatPressure;
+  startNanos = getHostNanos();
+  for (int i = 0; i < kReadCount; i++) {
+    bmp280_read_float(&bmp280, &floatTemperature, &floatPressure, NULL);
+  }
+  int64_t floatNanos = getHostNanos() - startNanos;
+
+  printf(
+    "%d reads with the fake I2C: fixed %.1f ns, float %.1f ns per read\n",
+    kReadCount,
+    (double)fixedNanos / kReadCount,
+    (double)floatNanos / kReadCount
+  );
+}
+
+int main(void) {
+  testFixedPointReferenceVector();
+  testFloatReferenceVector();
+  benchmarkFixedAndFloatPaths();
+
+  return finishTests();
+}
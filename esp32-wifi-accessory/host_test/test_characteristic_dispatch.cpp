@@ -0,0 +1,252 @@
+#include <malloc.h>
+#include <stdlib.h>
+#include <hap.h>
+#include "characteristic_dispatch.h"
+#include "test_helpers.h"
+
+static uint32_t strdupCount = 0;
+
+// util.c is not built on the host; counts the allocations instead
+extern "C" char* strdup(const char* string) {
+  strdupCount++;
+  size_t length = strlen(string) + 1;
+  return (char*)memcpy(malloc(length), string, length);
+}
+
+#define UUID_CURRENT_DOOR_STATE "0000000E-0000-1000-8000-0026BB765291"
+#define UUID_TARGET_DOOR_STATE "00000032-0000-1000-8000-0026BB765291"
+#define UUID_OBSTRUCTION_DETECTED "00000024-0000-1000-8000-0026BB765291"
+#define UUID_NAME "00000023-0000-1000-8000-0026BB765291"
+#define UUID_ON "00000025-0000-1000-8000-0026BB765291"
+
+typedef struct {
+  uint32_t currentState;
+  uint32_t targetState;
+  uint32_t readCount;
+  uint32_t writeCount;
+} Door;
+
+static const char kServiceName[] = "Garage";
+
+static hap_status_t readCurrentState(hap_char_t* hc, void* owner) {
+  Door* door = (Door*)owner;
+  door->readCount++;
+  hap_val_t value;
+  value.u = door->currentState;
+  hap_char_update_val(hc, &value);
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t readTargetState(hap_char_t* hc, void* owner) {
+  Door* door = (Door*)owner;
+  door->readCount++;
+  hap_val_t value;
+  value.u = door->targetState;
+  hap_char_update_val(hc, &value);
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t readObstructionDetected(hap_char_t* hc, void* owner) {
+  hap_val_t value;
+  value.b = false;
+  hap_char_update_val(hc, &value);
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t writeTargetState(hap_write_data_t* data, void* owner) {
+  Door* door = (Door*)owner;
+  if (data->val.u > 1) {
+    return HAP_STATUS_VAL_INVALID;
+  }
+
+  door->writeCount++;
+  door->targetState = data->val.u;
+  return HAP_STATUS_SUCCESS;
+}
+
+// Same layout as GarageRemote
+static const CharacteristicHandler kHandlers[] = {
+  { .uuid = UUID_TARGET_DOOR_STATE, .read = readTargetState, .write = writeTargetState, .constantString = NULL },
+  { .uuid = UUID_CURRENT_DOOR_STATE, .read = readCurrentState, .write = NULL, .constantString = NULL },
+  { .uuid = UUID_OBSTRUCTION_DETECTED, .read = readObstructionDetected, .write = NULL, .constantString = NULL },
+  { .uuid = UUID_NAME, .read = NULL, .write = NULL, .constantString = kServiceName },
+};
+static const size_t kHandlerCount = sizeof(kHandlers) / sizeof(kHandlers[0]);
+
+typedef struct {
+  hap_serv_t* service;
+  hap_char_t* targetState;
+  hap_char_t* currentState;
+  hap_char_t* obstructionDetected;
+  hap_char_t* name;
+  hap_char_t* on; // Not in the handlers
+} GarageService;
+
+static GarageService createGarageService(Door* door) {
+  GarageService garage;
+  garage.service = fakeServiceCreate();
+  garage.targetState = fakeCharacteristicCreate(UUID_TARGET_DOOR_STATE, false);
+  garage.currentState = fakeCharacteristicCreate(UUID_CURRENT_DOOR_STATE, false);
+  garage.obstructionDetected = fakeCharacteristicCreate(UUID_OBSTRUCTION_DETECTED, false);
+  garage.name = fakeCharacteristicCreate(UUID_NAME, true);
+  garage.on = fakeCharacteristicCreate(UUID_ON, false);
+
+  hap_serv_add_char(garage.service, garage.targetState);
+  hap_serv_add_char(garage.service, garage.currentState);
+  hap_serv_add_char(garage.service, garage.obstructionDetected);
+  hap_serv_add_char(garage.service, garage.name);
+  hap_serv_add_char(garage.service, garage.on);
+
+  // The name is set when created as hap_char_name_create() does
+  hap_val_t name;
+  name.s = strdup(kServiceName);
+  hap_char_update_val(garage.name, &name);
+
+  setCharacteristicHandlers(garage.service, kHandlers, kHandlerCount, door);
+  return garage;
+}
+
+static void testReadsAreDispatchedToHandlers() {
+  Door door = {1, 0, 0, 0};
+  GarageService garage = createGarageService(&door);
+  hap_status_t status;
+
+  CHECK_EQUAL(HAP_SUCCESS, fakeServiceRead(garage.service, garage.currentState, &status));
+  CHECK_EQUAL(HAP_STATUS_SUCCESS, status);
+  CHECK_EQUAL(1, hap_char_get_val(garage.currentState)->u);
+
+  door.targetState = 1;
+  CHECK_EQUAL(HAP_SUCCESS, fakeServiceRead(garage.service, garage.targetState, &status));
+  CHECK_EQUAL(1, hap_char_get_val(garage.targetState)->u);
+  CHECK_EQUAL(2, door.readCount);
+
+  CHECK_EQUAL(HAP_SUCCESS, fakeServiceRead(garage.service, garage.name, &status));
+  CHECK_EQUAL(HAP_STATUS_SUCCESS, status);
+  CHECK(strcmp(hap_char_get_val(garage.name)->s, kServiceName) == 0);
+
+  CHECK_EQUAL(HAP_FAIL, fakeServiceRead(garage.service, garage.on, &status));
+  CHECK_EQUAL(HAP_STATUS_RES_ABSENT, status);
+}
+
+// A failure of any characteristic fails the whole request
+static void testWritesAreDispatchedToHandlers() {
+  Door door = {1, 1, 0, 0};
+  GarageService garage = createGarageService(&door);
+  hap_status_t statuses[2];
+  hap_write_data_t writeData[2];
+
+  writeData[0].hc = garage.targetState;
+  writeData[0].val.u = 0;
+  writeData[0].status = &statuses[0];
+  CHECK_EQUAL(HAP_SUCCESS, fakeServiceWrite(garage.service, writeData, 1));
+  CHECK_EQUAL(HAP_STATUS_SUCCESS, statuses[0]);
+  CHECK_EQUAL(0, door.targetState);
+
+  writeData[0].val.u = 5;
+  CHECK_EQUAL(HAP_FAIL, fakeServiceWrite(garage.service, writeData, 1));
+  CHECK_EQUAL(HAP_STATUS_VAL_INVALID, statuses[0]);
+  CHECK_EQUAL(0, door.targetState);
+
+  writeData[0].val.u = 1;
+  writeData[1].hc = garage.currentState;
+  writeData[1].val.u = 0;
+  writeData[1].status = &statuses[1];
+  CHECK_EQUAL(HAP_FAIL, fakeServiceWrite(garage.service, writeData, 2));
+  CHECK_EQUAL(HAP_STATUS_SUCCESS, statuses[0]);
+  CHECK_EQUAL(HAP_STATUS_RES_ABSENT, statuses[1]);
+  CHECK_EQUAL(1, door.targetState);
+  CHECK_EQUAL(2, door.writeCount);
+}
+
+// Name characteristics used to duplicate the string on every read
+static void soakNameReads() {
+  static const int kReadCount = 1000 * 1000;
+
+  Door door = {1, 0, 0, 0};
+  GarageService garage = createGarageService(&door);
+  hap_status_t status;
+
+  // Live heap bytes catch any allocation, not only the counted strdup() calls
+  size_t initialLiveBytes = mallinfo2().uordblks;
+  uint32_t initialStrdupCount = strdupCount;
+  for (int i = 0; i < kReadCount; i++) {
+    fakeServiceRead(garage.service, garage.name, &status);
+  }
+
+  uint32_t soakStrdupCount = strdupCount - initialStrdupCount;
+  long liveBytesGrowth = (long)mallinfo2().uordblks - (long)initialLiveBytes;
+  CHECK_EQUAL(0, soakStrdupCount);
+  CHECK_EQUAL(0, liveBytesGrowth);
+  CHECK(strcmp(hap_char_get_val(garage.name)->s, kServiceName) == 0);
+  printf("%d Name reads: %u allocations, %ld live heap bytes grown\n", kReadCount, soakStrdupCount, liveBytesGrowth);
+
+  // The value is restored once if something else replaced it
+  hap_val_t value;
+  value.s = strdup("Renamed");
+  hap_char_update_val(garage.name, &value);
+  initialStrdupCount = strdupCount;
+  fakeServiceRead(garage.service, garage.name, &status);
+  fakeServiceRead(garage.service, garage.name, &status);
+  CHECK_EQUAL(1, strdupCount - initialStrdupCount);
+  CHECK(strcmp(hap_char_get_val(garage.name)->s, kServiceName) == 0);
+}
+
+// The read callback before the handlers were resolved at registration
+static int readByComparingUUIDs(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv) {
+  const char* uuid = hap_char_get_type_uuid(hc);
+
+  if (strcmp(uuid, UUID_TARGET_DOOR_STATE) == 0) {
+    *status_code = readTargetState(hc, serv_priv);
+  } else if (strcmp(uuid, UUID_CURRENT_DOOR_STATE) == 0) {
+    *status_code = readCurrentState(hc, serv_priv);
+  } else if (strcmp(uuid, UUID_OBSTRUCTION_DETECTED) == 0) {
+    *status_code = readObstructionDetected(hc, serv_priv);
+  } else if (strcmp(uuid, UUID_NAME) == 0) {
+    *status_code = HAP_STATUS_SUCCESS;
+  } else {
+    *status_code = HAP_STATUS_RES_ABSENT;
+    return HAP_FAIL;
+  }
+
+  return HAP_SUCCESS;
+}
+
+// Reads the three state characteristics in turn, which are the ones controllers poll
+static void benchmarkReads() {
+  static const int kReadCount = 10 * 1000 * 1000;
+
+  Door door = {1, 0, 0, 0};
+  GarageService garage = createGarageService(&door);
+  hap_char_t* characteristics[] = {garage.targetState, garage.currentState, garage.obstructionDetected};
+  hap_status_t status;
+  int failureSum = 0;
+
+  int64_t startNanos = getHostNanos();
+  for (int i = 0; i < kReadCount; i++) {
+    failureSum += readByComparingUUIDs(characteristics[i % 3], &status, &door, NULL);
+  }
+  int64_t comparingNanos = getHostNanos() - startNanos;
+
+  startNanos = getHostNanos();
+  for (int i = 0; i < kReadCount; i++) {
+    failureSum += fakeServiceRead(garage.service, characteristics[i % 3], &status);
+  }
+  int64_t dispatchingNanos = getHostNanos() - startNanos;
+
+  CHECK_EQUAL(0, failureSum);
+  printf(
+    "%d reads: comparing UUIDs %.1f ns, resolved handlers %.1f ns per read\n",
+    kReadCount,
+    (double)comparingNanos / kReadCount,
+    (double)dispatchingNanos / kReadCount
+  );
+}
+
+int main() {
+  testReadsAreDispatchedToHandlers();
+  testWritesAreDispatchedToHandlers();
+  soakNameReads();
+  benchmarkReads();
+
+  return finishTests();
+}
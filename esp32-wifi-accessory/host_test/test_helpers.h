@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static int failureCount = 0;
+
+#define CHECK(condition) do { \
+  if (!(condition)) { \
+    fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+    failureCount++; \
+  } \
+} while (0)
+
+#define CHECK_EQUAL(expected, actual) do { \
+  long long expectedValue = (long long)(expected); \
+  long long actualValue = (long long)(actual); \
+  if (expectedValue != actualValue) { \
+    fprintf(stderr, "%s:%d: CHECK_EQUAL failed: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, actualValue, expectedValue); \
+    failureCount++; \
+  } \
+} while (0)
+
+static inline int64_t getHostNanos() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static inline int finishTests() {
+  if (failureCount > 0) {
+    fprintf(stderr, "%d checks failed\n", failureCount);
+    return 1;
+  }
+
+  printf("All checks passed\n");
+  return 0;
+}
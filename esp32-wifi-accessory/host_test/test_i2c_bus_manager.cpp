@@ -0,0 +1,250 @@
+#include <string.h>
+#include <unistd.h>
+#include <esp_timer.h>
+#include "i2c_bus_manager.h"
+#include "test_helpers.h"
+
+// The bus task runs on its own thread; the checks are made only on the main thread
+// after a completion, so that they see everything the bus task did before it.
+
+typedef struct {
+  SemaphoreHandle_t started;
+  SemaphoreHandle_t released;
+} Gate;
+
+// Occupies the bus task until released, so that the following transactions pile up in the queue
+static esp_err_t waitAtGate(void* context) {
+  Gate* gate = (Gate*)context;
+  xSemaphoreGive(gate->started);
+  xSemaphoreTake(gate->released, portMAX_DELAY);
+  return ESP_OK;
+}
+
+static int completionOrder[16];
+static int completionCount = 0;
+
+static void recordCompletion(I2CTransaction* transaction) {
+  completionOrder[completionCount++] = (int)(intptr_t)transaction->context;
+}
+
+// The bus task keeps running on the manager as in the firmware, so managers are never deleted
+static I2CBusManager* createBusManager() {
+  return new I2CBusManager(0);
+}
+
+static void initializeRead(I2CTransaction* transaction, int deviceIndex, uint8_t reg, void* buffer, size_t size) {
+  memset(transaction, 0, sizeof(I2CTransaction));
+  transaction->deviceIndex = deviceIndex;
+  transaction->type = I2CTransactionTypeRead;
+  transaction->reg = reg;
+  transaction->buffer = buffer;
+  transaction->size = size;
+}
+
+static void initializeCustom(I2CTransaction* transaction, int deviceIndex, I2CTransactionFunction function, void* context) {
+  memset(transaction, 0, sizeof(I2CTransaction));
+  transaction->deviceIndex = deviceIndex;
+  transaction->type = I2CTransactionTypeCustom;
+  transaction->perform = function;
+  transaction->context = context;
+}
+
+static void testSubmittedTransactionsRunInOrder() {
+  static const int kQueueLength = 8;
+
+  for (int i = 0; i < 256; i++) {
+    fakeI2CRegisters[i] = i;
+  }
+
+  I2CBusManager& busManager = *createBusManager();
+  i2c_dev_t device = {};
+  int deviceIndex = busManager.registerDevice(&device, "Device");
+  CHECK_EQUAL(0, deviceIndex);
+
+  StaticSemaphore_t startedBuffer, releasedBuffer;
+  Gate gate = {xSemaphoreCreateBinaryStatic(&startedBuffer), xSemaphoreCreateBinaryStatic(&releasedBuffer)};
+  I2CTransaction gateTransaction;
+  initializeCustom(&gateTransaction, deviceIndex, waitAtGate, &gate);
+  CHECK(busManager.submit(&gateTransaction));
+  xSemaphoreTake(gate.started, portMAX_DELAY);
+
+  // The gate has left the queue, so the whole queue is available
+  uint8_t buffers[kQueueLength][2];
+  I2CTransaction transactions[kQueueLength + 1];
+  completionCount = 0;
+
+  for (int i = 0; i <= kQueueLength; i++) {
+    initializeRead(&transactions[i], deviceIndex, i * 2, buffers[i % kQueueLength], 2);
+    transactions[i].context = (void*)(intptr_t)i;
+    transactions[i].callback = recordCompletion;
+  }
+
+  StaticSemaphore_t lastCompletionBuffer;
+  transactions[kQueueLength - 1].completion = xSemaphoreCreateBinaryStatic(&lastCompletionBuffer);
+
+  for (int i = 0; i < kQueueLength; i++) {
+    CHECK(busManager.submit(&transactions[i]));
+  }
+  CHECK(!busManager.submit(&transactions[kQueueLength]));
+
+  xSemaphoreGive(gate.released);
+  xSemaphoreTake(transactions[kQueueLength - 1].completion, portMAX_DELAY);
+
+  CHECK_EQUAL(kQueueLength, completionCount);
+  for (int i = 0; i < kQueueLength; i++) {
+    CHECK_EQUAL(i, completionOrder[i]);
+    CHECK_EQUAL(ESP_OK, transactions[i].result);
+    CHECK_EQUAL(i * 2, buffers[i][0]);
+    CHECK_EQUAL(i * 2 + 1, buffers[i][1]);
+  }
+
+  // Unknown devices are rejected without being queued
+  I2CTransaction invalidTransaction;
+  initializeRead(&invalidTransaction, 1, 0, buffers[0], 1);
+  CHECK(!busManager.submit(&invalidTransaction));
+
+  vSemaphoreDelete(transactions[kQueueLength - 1].completion);
+  vSemaphoreDelete(gate.started);
+  vSemaphoreDelete(gate.released);
+}
+
+static void testPerformSignalsCallbackAndCompletion() {
+  fakeI2CRegisters[0x10] = 0x42;
+
+  I2CBusManager& busManager = *createBusManager();
+  i2c_dev_t device = {};
+  int deviceIndex = busManager.registerDevice(&device, "Device");
+
+  uint8_t value = 0;
+  I2CTransaction transaction;
+  initializeRead(&transaction, deviceIndex, 0x10, &value, 1);
+  transaction.context = (void*)(intptr_t)7;
+  transaction.callback = recordCompletion;
+  completionCount = 0;
+
+  CHECK_EQUAL(ESP_OK, busManager.perform(&transaction));
+  CHECK_EQUAL(0x42, value);
+  // The callback runs before the completion is given
+  CHECK_EQUAL(1, completionCount);
+  CHECK_EQUAL(7, completionOrder[0]);
+}
+
+typedef struct {
+  TaskHandle_t callerTask;
+  volatile bool isFinished;
+} SlowTransaction;
+
+// Gives the caller's task notification in the middle of the transaction,
+// as requestFastSampling() does to the sampling task
+static esp_err_t notifyCallerAndFinishLater(void* context) {
+  SlowTransaction* slowTransaction = (SlowTransaction*)context;
+  xTaskNotifyGive(slowTransaction->callerTask);
+  usleep(20 * 1000);
+  slowTransaction->isFinished = true;
+  return ESP_ERR_TIMEOUT;
+}
+
+static void testNotificationDoesNotWakePerform() {
+  I2CBusManager& busManager = *createBusManager();
+  i2c_dev_t device = {};
+  int deviceIndex = busManager.registerDevice(&device, "Device");
+
+  SlowTransaction slowTransaction = {xTaskGetCurrentTaskHandle(), false};
+  I2CTransaction transaction;
+  initializeCustom(&transaction, deviceIndex, notifyCallerAndFinishLater, &slowTransaction);
+
+  CHECK_EQUAL(ESP_ERR_TIMEOUT, busManager.perform(&transaction));
+  CHECK(slowTransaction.isFinished);
+  // Still pending for whoever waits on it
+  CHECK_EQUAL(1, ulTaskNotifyTake(pdTRUE, 0));
+}
+
+static esp_err_t occupyBus(void* context) {
+  usleep((useconds_t)(intptr_t)context);
+  return ESP_OK;
+}
+
+static void testDeviceStatistics() {
+  static const int kBusyMicros = 10 * 1000;
+
+  I2CBusManager& busManager = *createBusManager();
+  i2c_dev_t firstDevice = {};
+  i2c_dev_t secondDevice = {};
+  int firstIndex = busManager.registerDevice(&firstDevice, "First");
+  int secondIndex = busManager.registerDevice(&secondDevice, "Second");
+  CHECK_EQUAL(1, secondIndex);
+
+  i2c_dev_t devices[I2CBusManager::kMaxDeviceCount];
+  for (size_t i = busManager.deviceCount; i < I2CBusManager::kMaxDeviceCount; i++) {
+    CHECK(busManager.registerDevice(&devices[i], "Extra") >= 0);
+  }
+  CHECK_EQUAL(-1, busManager.registerDevice(&devices[0], "Too many"));
+
+  int64_t startMicros = esp_timer_get_time();
+
+  uint8_t buffer[4];
+  I2CTransaction transaction;
+  initializeRead(&transaction, firstIndex, 0x10, buffer, sizeof(buffer));
+  CHECK_EQUAL(ESP_OK, busManager.perform(&transaction));
+
+  // Beyond the end of the register file
+  initializeRead(&transaction, firstIndex, 0xFE, buffer, sizeof(buffer));
+  CHECK_EQUAL(ESP_ERR_INVALID_SIZE, busManager.perform(&transaction));
+
+  initializeCustom(&transaction, secondIndex, occupyBus, (void*)(intptr_t)kBusyMicros);
+  CHECK_EQUAL(ESP_OK, busManager.perform(&transaction));
+
+  int64_t elapsedMicros = esp_timer_get_time() - startMicros;
+
+  I2CDeviceStatistics* first = &busManager.deviceStatistics[firstIndex];
+  CHECK_EQUAL(2, first->transactionCount);
+  CHECK_EQUAL(1, first->errorCount);
+  CHECK(first->maxLatencyMicros <= first->totalLatencyMicros);
+  CHECK(first->busyMicros <= first->totalLatencyMicros);
+
+  I2CDeviceStatistics* second = &busManager.deviceStatistics[secondIndex];
+  CHECK_EQUAL(1, second->transactionCount);
+  CHECK_EQUAL(0, second->errorCount);
+  CHECK(second->busyMicros >= (uint64_t)kBusyMicros);
+  CHECK(second->totalLatencyMicros >= second->busyMicros);
+  CHECK_EQUAL(second->totalLatencyMicros, second->maxLatencyMicros);
+
+  // The bus was occupied for most of the time, which logStatistics() shows as the utilization
+  uint64_t busyMicros = first->busyMicros + second->busyMicros;
+  CHECK(busyMicros <= (uint64_t)elapsedMicros);
+  CHECK(busyMicros * 2 > (uint64_t)elapsedMicros);
+  busManager.logStatistics();
+}
+
+// perform() round trips through the bus task, which is what the sampling task pays per sample
+static void benchmarkPerform() {
+  static const int kTransactionCount = 100 * 1000;
+
+  I2CBusManager& busManager = *createBusManager();
+  i2c_dev_t device = {};
+  int deviceIndex = busManager.registerDevice(&device, "Device");
+
+  uint8_t buffer[6];
+  I2CTransaction transaction;
+  int64_t startNanos = getHostNanos();
+
+  for (int i = 0; i < kTransactionCount; i++) {
+    initializeRead(&transaction, deviceIndex, 0xF7, buffer, sizeof(buffer));
+    busManager.perform(&transaction);
+  }
+
+  int64_t elapsedNanos = getHostNanos() - startNanos;
+  CHECK_EQUAL(kTransactionCount, busManager.deviceStatistics[deviceIndex].transactionCount);
+
+  printf("%d perform() calls: %.1f us per call\n", kTransactionCount, elapsedNanos / 1000.0 / kTransactionCount);
+}
+
+int main() {
+  testSubmittedTransactionsRunInOrder();
+  testPerformSignalsCallbackAndCompletion();
+  testNotificationDoesNotWakePerform();
+  testDeviceStatistics();
+  benchmarkPerform();
+
+  return finishTests();
+}
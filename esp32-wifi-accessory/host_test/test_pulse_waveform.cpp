@@ -0,0 +1,143 @@
+#include "mock_pulse_output.h"
+#include "test_helpers.h"
+
+// Same as the RMT channel: the 1 MHz REF_TICK divided by 100
+static const uint32_t kTickMicros = 100;
+
+// Same waveforms as GarageRemote
+static const PulseSegment kPowerButtonSegments[] = {
+  {1, 100},
+};
+
+static const PulseSegment kOpenButtonSegments[] = {
+  {0, 200},
+  {1, 3000},
+};
+
+static void testPowerButtonWaveform() {
+  MockPulseOutput output(kTickMicros);
+  CHECK(output.write(kPowerButtonSegments, PULSE_SEGMENT_COUNT(kPowerButtonSegments)));
+
+  CHECK_EQUAL(1, output.items.size());
+  CHECK_EQUAL(1, output.items[0].level0);
+  CHECK_EQUAL(1000, output.items[0].duration0);
+  CHECK_EQUAL(0, output.items[0].duration1);
+
+  CHECK_EQUAL(100 * 1000, output.getDurationMicros());
+  CHECK_EQUAL(1, output.getLevel(0));
+  CHECK_EQUAL(1, output.getLevel(100 * 1000 - 1));
+  CHECK_EQUAL(0, output.getLevel(100 * 1000));
+}
+
+static void testOpenButtonWaveform() {
+  MockPulseOutput output(kTickMicros);
+  output.advance(12345);
+  CHECK(output.write(kOpenButtonSegments, PULSE_SEGMENT_COUNT(kOpenButtonSegments)));
+
+  // Two halves fill one item, so the end marker is another item
+  CHECK_EQUAL(2, output.items.size());
+  CHECK_EQUAL(0, output.items[0].level0);
+  CHECK_EQUAL(2000, output.items[0].duration0);
+  CHECK_EQUAL(1, output.items[0].level1);
+  CHECK_EQUAL(30000, output.items[0].duration1);
+  CHECK_EQUAL(0, output.items[1].duration0);
+  CHECK_EQUAL(0, output.items[1].level0);
+  CHECK_EQUAL(0, output.items[1].duration1);
+  CHECK_EQUAL(0, output.items[1].level1);
+
+  uint64_t startMicros = 12345;
+  CHECK_EQUAL(0, output.getLevel(startMicros + 200 * 1000 - 1));
+  CHECK_EQUAL(1, output.getLevel(startMicros + 200 * 1000));
+  CHECK_EQUAL(1, output.getLevel(startMicros + 3200 * 1000 - 1));
+  CHECK_EQUAL(0, output.getLevel(startMicros + 3200 * 1000));
+}
+
+static void testBusyOutputRejectsWrites() {
+  MockPulseOutput output(kTickMicros);
+  CHECK(output.write(kOpenButtonSegments, PULSE_SEGMENT_COUNT(kOpenButtonSegments)));
+
+  output.advance(3200 * 1000 - 1);
+  CHECK(output.isBusy());
+  CHECK(!output.write(kPowerButtonSegments, PULSE_SEGMENT_COUNT(kPowerButtonSegments)));
+
+  output.advance(1);
+  CHECK(!output.isBusy());
+  CHECK(output.write(kPowerButtonSegments, PULSE_SEGMENT_COUNT(kPowerButtonSegments)));
+  CHECK_EQUAL(2, output.writeCount);
+}
+
+// 5 s is 50000 ticks, more than a half can hold
+static void testLongSegmentIsSplit() {
+  static const PulseSegment kSegments[] = {
+    {1, 5000},
+  };
+
+  PulseItem items[4];
+  size_t itemCount = encodePulseSegments(kSegments, PULSE_SEGMENT_COUNT(kSegments), kTickMicros, items, 4);
+
+  CHECK_EQUAL(2, itemCount);
+  CHECK_EQUAL(1, items[0].level0);
+  CHECK_EQUAL(kMaxPulseItemTicksPerHalf, items[0].duration0);
+  CHECK_EQUAL(1, items[0].level1);
+  CHECK_EQUAL(50000 - kMaxPulseItemTicksPerHalf, items[0].duration1);
+  CHECK_EQUAL(0, items[1].duration0);
+
+  MockPulseOutput output(kTickMicros);
+  CHECK(output.write(kSegments, PULSE_SEGMENT_COUNT(kSegments)));
+  CHECK_EQUAL(5000 * 1000, output.getDurationMicros());
+  CHECK_EQUAL(1, output.getLevel(kMaxPulseItemTicksPerHalf * kTickMicros));
+  CHECK_EQUAL(0, output.getLevel(5000 * 1000));
+}
+
+static void testZeroDurationSegmentsAreSkipped() {
+  static const PulseSegment kSegments[] = {
+    {1, 0},
+    {0, 10},
+    {1, 0},
+    {1, 20},
+  };
+
+  PulseItem items[4];
+  size_t itemCount = encodePulseSegments(kSegments, PULSE_SEGMENT_COUNT(kSegments), kTickMicros, items, 4);
+
+  CHECK_EQUAL(2, itemCount);
+  CHECK_EQUAL(0, items[0].level0);
+  CHECK_EQUAL(100, items[0].duration0);
+  CHECK_EQUAL(1, items[0].level1);
+  CHECK_EQUAL(200, items[0].duration1);
+  CHECK_EQUAL(0, items[1].duration0);
+}
+
+static void testTooLongWaveformIsRejected() {
+  static const PulseSegment kSegments[] = {
+    {1, 10},
+    {0, 10},
+    {1, 10},
+  };
+
+  PulseItem items[2];
+  // Three halves and the end marker fit in two items
+  CHECK_EQUAL(2, encodePulseSegments(kSegments, PULSE_SEGMENT_COUNT(kSegments), kTickMicros, items, 2));
+  // Two halves need a separate end marker
+  CHECK_EQUAL(0, encodePulseSegments(kSegments, 2, kTickMicros, items, 1));
+  CHECK_EQUAL(0, encodePulseSegments(kSegments, PULSE_SEGMENT_COUNT(kSegments), kTickMicros, items, 1));
+
+  // 64 items hold at most 127 halves of 3.2767 s
+  static const PulseSegment kLongSegments[] = {
+    {1, 64 * 2 * 3276},
+  };
+  MockPulseOutput output(kTickMicros);
+  CHECK(!output.write(kLongSegments, PULSE_SEGMENT_COUNT(kLongSegments)));
+  CHECK(!output.isBusy());
+}
+
+int main() {
+  testPowerButtonWaveform();
+  testOpenButtonWaveform();
+  testBusyOutputRejectsWrites();
+  testLongSegmentIsSplit();
+  testZeroDurationSegmentsAreSkipped();
+  testTooLongWaveformIsRejected();
+
+  return finishTests();
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include "weather_history.h"
+#include "test_helpers.h"
+
+// Random walk around typical indoor values in the sensor units
+static void generateSamples(WeatherHistorySample* samples, size_t count, uint32_t startTime) {
+  WeatherHistorySample sample;
+  sample.time = startTime;
+  sample.values[WeatherHistoryValueTemperature] = 2350;
+  sample.values[WeatherHistoryValueHumidity] = 45 * 1024;
+  sample.values[WeatherHistoryValuePressure] = 101325 * 256;
+
+  for (size_t i = 0; i < count; i++) {
+    // Occasionally delayed by the sensor being busy
+    sample.time += rand() % 20 == 0 ? 2 : 1;
+    sample.values[WeatherHistoryValueTemperature] += rand() % 5 - 2;
+    sample.values[WeatherHistoryValueHumidity] += rand() % 41 - 20;
+    sample.values[WeatherHistoryValuePressure] += rand() % 129 - 64;
+    samples[i] = sample;
+  }
+}
+
+static bool isEqualSample(const WeatherHistorySample* a, const WeatherHistorySample* b) {
+  return memcmp(a, b, sizeof(WeatherHistorySample)) == 0;
+}
+
+// Reads everything in the range in batches as the HTTP handler does
+static size_t queryAll(WeatherHistory* history, WeatherHistoryTier tier, uint32_t fromTime, uint32_t toTime, WeatherHistorySample* samples, size_t maxCount) {
+  size_t count = 0;
+
+  while (count < maxCount) {
+    size_t batchCount = history->query(tier, fromTime, toTime, &samples[count], maxCount - count < 32 ? maxCount - count : 32);
+    if (batchCount == 0) {
+      break;
+    }
+
+    count += batchCount;
+    fromTime = samples[count - 1].time + 1;
+  }
+
+  return count;
+}
+
+static void testSecondTierRoundTrip() {
+  static const size_t kSampleCount = 300;
+
+  WeatherHistory history;
+  WeatherHistorySample samples[kSampleCount];
+  generateSamples(samples, kSampleCount, 1000);
+
+  for (size_t i = 0; i < kSampleCount; i++) {
+    history.append(&samples[i]);
+  }
+
+  WeatherHistorySample queried[kSampleCount];
+  size_t count = queryAll(&history, WeatherHistoryTierSecond, 0, UINT32_MAX, queried, kSampleCount);
+
+  CHECK_EQUAL(kSampleCount, count);
+  for (size_t i = 0; i < count; i++) {
+    CHECK(isEqualSample(&samples[i], &queried[i]));
+  }
+
+  // A range in the middle
+  uint32_t fromTime = samples[100].time;
+  uint32_t toTime = samples[199].time;
+  count = queryAll(&history, WeatherHistoryTierSecond, fromTime, toTime, queried, kSampleCount);
+  CHECK_EQUAL(100, count);
+  CHECK(isEqualSample(&samples[100], &queried[0]));
+  CHECK(isEqualSample(&samples[199], &queried[99]));
+}
+
+static void testMinuteTierAverages() {
+  WeatherHistory history;
+
+  // 3 minutes of a value rising by 1 every second
+  for (uint32_t time = 0; time < 3 * 60; time++) {
+    WeatherHistorySample sample;
+    sample.time = time;
+    sample.values[WeatherHistoryValueTemperature] = time;
+    sample.values[WeatherHistoryValueHumidity] = 0;
+    sample.values[WeatherHistoryValuePressure] = -(int32_t)time;
+    history.append(&sample);
+  }
+
+  // The last minute is still being accumulated
+  WeatherHistorySample queried[4];
+  size_t count = history.query(WeatherHistoryTierMinute, 0, UINT32_MAX, queried, 4);
+  CHECK_EQUAL(2, count);
+  CHECK_EQUAL(0, queried[0].time);
+  CHECK_EQUAL(29, queried[0].values[WeatherHistoryValueTemperature]); // (0 + 59) / 2, truncated
+  CHECK_EQUAL(-29, queried[0].values[WeatherHistoryValuePressure]);
+  CHECK_EQUAL(60, queried[1].time);
+  CHECK_EQUAL(89, queried[1].values[WeatherHistoryValueTemperature]);
+}
+
+// Old blocks are evicted while the newest samples are kept exactly
+static void testEviction() {
+  static const size_t kSampleCount = 2000;
+
+  WeatherHistory history;
+  WeatherHistorySample* samples = new WeatherHistorySample[kSampleCount];
+  generateSamples(samples, kSampleCount, 0);
+
+  for (size_t i = 0; i < kSampleCount; i++) {
+    history.append(&samples[i]);
+  }
+
+  WeatherHistorySample* queried = new WeatherHistorySample[kSampleCount];
+  size_t count = queryAll(&history, WeatherHistoryTierSecond, 0, UINT32_MAX, queried, kSampleCount);
+
+  CHECK(count > 0);
+  CHECK(count < kSampleCount);
+  CHECK(isEqualSample(&samples[kSampleCount - 1], &queried[count - 1]));
+  for (size_t i = 0; i < count; i++) {
+    CHECK(isEqualSample(&samples[kSampleCount - count + i], &queried[i]));
+  }
+
+  delete[] samples;
+  delete[] queried;
+}
+
+static void benchmarkAppendAndQuery() {
+  static const size_t kSampleCount = 200000;
+
+  WeatherHistory history;
+  WeatherHistorySample* samples = new WeatherHistorySample[kSampleCount];
+  generateSamples(samples, kSampleCount, 0);
+
+  int64_t startNanos = getHostNanos();
+  for (size_t i = 0; i < kSampleCount; i++) {
+    history.append(&samples[i]);
+  }
+  int64_t appendNanos = getHostNanos() - startNanos;
+
+  WeatherHistorySample* queried = new WeatherHistorySample[kSampleCount];
+  startNanos = getHostNanos();
+  size_t count = queryAll(&history, WeatherHistoryTierSecond, 0, UINT32_MAX, queried, kSampleCount);
+  int64_t queryNanos = getHostNanos() - startNanos;
+
+  printf(
+    "%u appends: %.1f ns per sample; querying %u samples in batches of 32: %.1f ns per sample\n",
+    (uint32_t)kSampleCount,
+    (double)appendNanos / kSampleCount,
+    (uint32_t)count,
+    count > 0 ? (double)queryNanos / count : 0.0
+  );
+
+  // Bytes per sample for each tier
+  history.logStatistics();
+
+  delete[] samples;
+  delete[] queried;
+}
+
+int main() {
+  srand(1);
+
+  testSecondTierRoundTrip();
+  testMinuteTierAverages();
+  testEviction();
+  benchmarkAppendAndQuery();
+
+  return finishTests();
+}
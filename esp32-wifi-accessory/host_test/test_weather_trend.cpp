@@ -0,0 +1,87 @@
+#include <math.h>
+#include <stdlib.h>
+#include "streaming_estimators.h"
+#include "weather_trend.h"
+#include "test_helpers.h"
+
+// Compares the monotonic deques with scanning the window
+static void testSlidingMinMaxMatchesScan() {
+  static const size_t kCapacity = 16;
+  static const size_t kValueCount = 1000;
+
+  SlidingMinMax minMax(kCapacity);
+  float values[kValueCount];
+
+  for (size_t i = 0; i < kValueCount; i++) {
+    values[i] = rand() % 100;
+    minMax.add(values[i]);
+
+    float expectedMin = values[i];
+    float expectedMax = values[i];
+    for (size_t j = i + 1 > kCapacity ? i + 1 - kCapacity : 0; j <= i; j++) {
+      expectedMin = fminf(expectedMin, values[j]);
+      expectedMax = fmaxf(expectedMax, values[j]);
+    }
+
+    CHECK(minMax.getMin() == expectedMin);
+    CHECK(minMax.getMax() == expectedMax);
+  }
+}
+
+static void testSlidingLinearRegression() {
+  SlidingLinearRegression regression(10);
+  CHECK(regression.getSlope() == 0);
+
+  for (int x = 0; x < 100; x++) {
+    regression.add(x, 3 * x + 7);
+  }
+
+  CHECK_EQUAL(10, regression.getCount());
+  CHECK(fabsf(regression.getSlope() - 3) < 0.001f);
+}
+
+// A step smoothed over one minute with 1 s or 60 s samples ends up at the same value
+static void testExponentialMovingAverageFollowsTime() {
+  ExponentialMovingAverage fast(20);
+  ExponentialMovingAverage slow(20);
+  fast.add(0, 0);
+  slow.add(0, 0);
+
+  for (uint32_t time = 1000; time <= 60 * 1000; time += 1000) {
+    fast.add(1, time);
+  }
+  slow.add(1, 60 * 1000);
+
+  float expected = 1 - expf(-60.0f / 20);
+  CHECK(fabsf(fast.getValue() - expected) < 0.001f);
+  CHECK(fabsf(slow.getValue() - expected) < 0.001f);
+}
+
+// Pressure falling by 1 Pa per minute for 4 hours at 20 degrees Celsius and 50 %RH
+static void testWeatherTrend() {
+  WeatherTrend trend;
+
+  for (uint32_t time = 0; time < 4 * 60 * 60; time++) {
+    float pressure = 101325 - time / 60.0f;
+    trend.add(time * 1000, 2000, 50 * 1024, (uint32_t)(pressure * 256));
+  }
+
+  CHECK(fabsf(trend.getPressureTendency() + 180) < 1);
+  // Per-minute averages over the last 3 hours
+  CHECK(fabsf(trend.getPressureRange() - 179) < 1);
+  CHECK(fabsf(trend.getDewPoint() - 9.3f) < 0.1f);
+  // Rising by about 8 m per 1 hPa near the sea level
+  CHECK(trend.getAltitudeChange() > 15);
+  CHECK(trend.getAltitudeChange() < 25);
+}
+
+int main() {
+  srand(1);
+
+  testSlidingMinMaxMatchesScan();
+  testSlidingLinearRegression();
+  testExponentialMovingAverageFollowsTime();
+  testWeatherTrend();
+
+  return finishTests();
+}
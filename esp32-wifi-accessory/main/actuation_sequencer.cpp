@@ -0,0 +1,101 @@
+#include "log_config.h"
+#include "actuation_sequencer.h"
+
+static const char* TAG = "ActuationSequencer";
+
+static void _performNextStep(void* arg) {
+  ActuationSequencer* sequencer = (ActuationSequencer*)arg;
+  sequencer->performNextStep();
+}
+
+ActuationSequencer::ActuationSequencer(const gpio_num_t* pins, size_t pinCount) {
+  this->pins = pins;
+  this->pinCount = pinCount;
+  vPortCPUInitializeMutex(&this->mux);
+  this->running = false;
+  this->script = NULL;
+  this->nextStepIndex = 0;
+  this->callback = NULL;
+  this->context = NULL;
+}
+
+bool ActuationSequencer::run(const ActuationScript* script, ActuationCompletionCallback callback, void* context) {
+  portENTER_CRITICAL(&this->mux);
+  if (this->running) {
+    portEXIT_CRITICAL(&this->mux);
+    ESP_LOGW(TAG, "Cannot run %s since %s is running", script->name, this->script->name);
+    return false;
+  }
+  this->running = true;
+  portEXIT_CRITICAL(&this->mux);
+
+  ESP_LOGD(TAG, "run: %s", script->name);
+
+  this->script = script;
+  this->nextStepIndex = 0;
+  this->callback = callback;
+  this->context = context;
+
+  // Start from the esp_timer task as well so that all the steps are performed in the same context
+  if (scheduleCallback(0, _performNextStep, this) == 0) {
+    portENTER_CRITICAL(&this->mux);
+    this->running = false;
+    portEXIT_CRITICAL(&this->mux);
+    return false;
+  }
+
+  return true;
+}
+
+bool ActuationSequencer::isRunning() {
+  portENTER_CRITICAL(&this->mux);
+  bool running = this->running;
+  portEXIT_CRITICAL(&this->mux);
+  return running;
+}
+
+void ActuationSequencer::performNextStep() {
+  while (this->nextStepIndex < this->script->stepCount) {
+    const ActuationStep* step = &this->script->steps[this->nextStepIndex];
+    this->nextStepIndex++;
+
+    if (step->pinIndex < this->pinCount) {
+      ESP_LOGV(TAG, "%s: pin %d -> %d (%u ms)", this->script->name, this->pins[step->pinIndex], step->level, step->holdMillis);
+      gpio_set_level(this->pins[step->pinIndex], step->level);
+    }
+
+    if (step->holdMillis > 0) {
+      if (scheduleCallback(step->holdMillis, _performNextStep, this) == 0) {
+        // Otherwise the pin would be held at the active level forever
+        ESP_LOGE(TAG, "%s aborted at step %u; the scheduler is exhausted", this->script->name, this->nextStepIndex - 1);
+        this->releasePins();
+        this->complete(false);
+      }
+      return;
+    }
+  }
+
+  this->complete(true);
+}
+
+void ActuationSequencer::releasePins() {
+  for (size_t i = 0; i < this->pinCount; i++) {
+    gpio_set_level(this->pins[i], 0);
+  }
+}
+
+void ActuationSequencer::complete(bool isSucceeded) {
+  const ActuationScript* completedScript = this->script;
+  ActuationCompletionCallback callback = this->callback;
+  void* context = this->context;
+
+  portENTER_CRITICAL(&this->mux);
+  this->running = false;
+  portEXIT_CRITICAL(&this->mux);
+
+  ESP_LOGD(TAG, "%s: %s", isSucceeded ? "completed" : "aborted", completedScript->name);
+
+  if (callback != NULL) {
+    callback(completedScript, isSucceeded, context);
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <driver/gpio.h>
+#include <freertos/FreeRTOS.h>
+#include <scheduler.h>
+
+// A step sets the level of a pin and then waits for the hold duration before the next step.
+typedef struct {
+  uint8_t pinIndex; // Index in the pins passed to ActuationSequencer
+  uint8_t level;
+  uint32_t holdMillis;
+} ActuationStep;
+
+typedef struct {
+  const char* name;
+  const ActuationStep* steps;
+  size_t stepCount;
+} ActuationScript;
+
+#define ACTUATION_SCRIPT(name, steps) { name, steps, sizeof(steps) / sizeof(steps[0]) }
+
+// isSucceeded is false if the script was aborted since the next step could not be scheduled
+typedef void (*ActuationCompletionCallback)(const ActuationScript* script, bool isSucceeded, void* context);
+
+// Runs actuation scripts on a state machine driven by the scheduler
+// so that callers (e.g. HAP callbacks) never block for the durations.
+// The pins are active high; all of them are driven low when a script is aborted.
+class ActuationSequencer {
+public:
+  ActuationSequencer(const gpio_num_t* pins, size_t pinCount);
+
+  // Returns false if another script is running or the scheduler is exhausted.
+  // The callback is invoked in the esp_timer task.
+  bool run(const ActuationScript* script, ActuationCompletionCallback callback, void* context);
+  bool isRunning();
+  void performNextStep();
+
+private:
+  const gpio_num_t* pins;
+  size_t pinCount;
+  portMUX_TYPE mux;
+  bool running;
+  const ActuationScript* script;
+  size_t nextStepIndex;
+  ActuationCompletionCallback callback;
+  void* context;
+
+  void releasePins();
+  void complete(bool isSucceeded);
+};
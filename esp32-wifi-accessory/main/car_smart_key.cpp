@@ -3,31 +3,150 @@
 
 #include <hap_apple_servs.h>
 #include <hap_apple_chars.h>
-#include <hap_fw_upgrade.h>
+#include <esp_timer.h>
 #include <cstring>
+#include <deferred_log.h>
+#include "homekit_accessory.h"
 #include "util.h"
 
 static const char* TAG = "CarSmartKey";
 
-static const char* kSetupID = "SKEY"; // This must be unique
-
-static const char* kEngineServiceName = "Engine";
-static const char* kDoorLockServiceName = "Door Lock";
-
-static int identifyAccessory(hap_acc_t* ha);
-static int readEngineServiceCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv);
-static int writeEngineServiceCharacteristic(hap_write_data_t write_data[], int count, void* serv_priv, void* write_priv);
+static const char kEngineServiceName[] = "Engine";
+static const char kDoorLockServiceName[] = "Door Lock";
+
+static const AccessoryDefinition kAccessoryDefinition = {
+  .name = "Car Smart Key",
+  .protocolVersion = "1.0.0",
+  .category = HAP_CID_BRIDGE,
+  .setupID = "SKEY",
+};
+
+// It seems the smart key has some capacitors inside
+// and they need some time to be charged to generate radio waves
+// especially for long press of the lock button.
+// 500ms doesn't work.
+static const uint32_t kSmartKeyActivationMillis = 1000;
+
+static const uint32_t kDefaultSmartKeyPowerHoldMillis = 5000;
+
+static const char kTargetDoorLockStateKey[] = "lockTarget";
+
+static const ActuationStep kActivateSmartKeySteps[] = {
+  {SmartKeyPinPower, 1, kSmartKeyActivationMillis},
+};
+
+static const ActuationStep kStartEngineSteps[] = {
+  {SmartKeyPinLockButton, 1, 150},
+  {SmartKeyPinLockButton, 0, 400},
+  {SmartKeyPinLockButton, 1, 150},
+  {SmartKeyPinLockButton, 0, 400},
+  {SmartKeyPinLockButton, 1, 3000},
+  {SmartKeyPinLockButton, 0, 0},
+};
+
+static const ActuationStep kStopEngineSteps[] = {
+  {SmartKeyPinLockButton, 1, 2000},
+  {SmartKeyPinLockButton, 0, 0},
+};
+
+static const uint32_t kDefaultEngineResponseTimeoutMillis = 3000;
+
+static const uint32_t kDefaultEngineStateDebounceMillis = 50;
+
+static const EventBits_t kEngineRunningBit = BIT0;
+static const EventBits_t kEngineStoppedBit = BIT1;
+
+// For some reason pressing for 150ms does not work (maybe to avoid unintentional lock/unlock by mistake?)
+static const ActuationStep kLockDoorsSteps[] = {
+  {SmartKeyPinLockButton, 1, 600},
+  {SmartKeyPinLockButton, 0, 0},
+};
+
+static const ActuationStep kUnlockDoorsSteps[] = {
+  {SmartKeyPinUnlockButton, 1, 600},
+  {SmartKeyPinUnlockButton, 0, 0},
+};
+
+static const ActuationScript kActivateSmartKeyScript = ACTUATION_SCRIPT("activateSmartKey", kActivateSmartKeySteps);
+
+// Indexed by SmartKeyCommand
+static const ActuationScript kCommandScripts[SmartKeyCommandCount] = {
+  ACTUATION_SCRIPT("startEngine", kStartEngineSteps),
+  ACTUATION_SCRIPT("stopEngine", kStopEngineSteps),
+  ACTUATION_SCRIPT("lockDoors", kLockDoorsSteps),
+  ACTUATION_SCRIPT("unlockDoors", kUnlockDoorsSteps),
+};
+
+static hap_status_t readEngineState(CarSmartKey* smartKey, hap_char_t* hc);
+static hap_status_t writeEngineState(CarSmartKey* smartKey, hap_write_data_t* data);
 static void onEngineStateChange(void* arg);
-static int readDoorLockServiceCharacteristic(hap_char_t *hc, hap_status_t *status_code, void *serv_priv, void *read_priv);
-static int writeDoorLockServiceCharacteristic(hap_write_data_t write_data[], int count, void *serv_priv, void *write_priv);
-static void notifyLockStateUpdate(hap_acc_t* characteristic, LockMechanismState state);
-
-CarSmartKey::CarSmartKey(gpio_num_t powerOutputPin, gpio_num_t lockButtonOutputPin, gpio_num_t unlockButtonOutputPin, gpio_num_t engineStateInputPin) {
+static hap_status_t readCurrentDoorLockState(CarSmartKey* smartKey, hap_char_t* hc);
+static hap_status_t readTargetDoorLockState(CarSmartKey* smartKey, hap_char_t* hc);
+static hap_status_t writeTargetDoorLockState(CarSmartKey* smartKey, hap_write_data_t* data);
+
+static const CharacteristicHandler kEngineServiceHandlers[] = {
+  {
+    .uuid = HAP_CHAR_UUID_ON,
+    .read = readTrampoline<CarSmartKey, readEngineState>,
+    .write = writeTrampoline<CarSmartKey, writeEngineState>,
+    .constantString = NULL,
+  },
+  { .uuid = HAP_CHAR_UUID_NAME, .read = NULL, .write = NULL, .constantString = kEngineServiceName },
+};
+
+static const CharacteristicHandler kDoorLockServiceHandlers[] = {
+  {
+    .uuid = HAP_CHAR_UUID_LOCK_CURRENT_STATE,
+    .read = readTrampoline<CarSmartKey, readCurrentDoorLockState>,
+    .write = NULL,
+    .constantString = NULL,
+  },
+  {
+    .uuid = HAP_CHAR_UUID_LOCK_TARGET_STATE,
+    .read = readTrampoline<CarSmartKey, readTargetDoorLockState>,
+    .write = writeTrampoline<CarSmartKey, writeTargetDoorLockState>,
+    .constantString = NULL,
+  },
+  { .uuid = HAP_CHAR_UUID_NAME, .read = NULL, .write = NULL, .constantString = kDoorLockServiceName },
+};
+static void _onActuationComplete(const ActuationScript* script, bool isSucceeded, void* context);
+static void _onPowerHoldTimeout(void* arg);
+static void _confirmEngineStates(void* arg);
+static void _handleEngineStateChanges(void* arg);
+static SmartKeyCommand getContradictoryCommand(SmartKeyCommand command);
+
+CarSmartKey::CarSmartKey(PersistentStateStore* stateStore, gpio_num_t powerOutputPin, gpio_num_t lockButtonOutputPin, gpio_num_t unlockButtonOutputPin, gpio_num_t engineStateInputPin) {
   this->powerPin = powerOutputPin;
   this->lockButtonPin = lockButtonOutputPin;
   this->unlockButtonPin = unlockButtonOutputPin;
   this->engineStatePin = engineStateInputPin;
 
+  this->actuationPins[SmartKeyPinPower] = powerOutputPin;
+  this->actuationPins[SmartKeyPinLockButton] = lockButtonOutputPin;
+  this->actuationPins[SmartKeyPinUnlockButton] = unlockButtonOutputPin;
+  this->sequencer = new ActuationSequencer(this->actuationPins, SmartKeyPinCount);
+
+  this->powerHoldMillis = kDefaultSmartKeyPowerHoldMillis;
+  memset(this->commandStatistics, 0, sizeof(this->commandStatistics));
+  vPortCPUInitializeMutex(&this->commandMux);
+  this->pendingCommandCount = 0;
+  this->isProcessingCommand = false;
+  this->isSmartKeyPowered = false;
+  this->powerHoldHandle = 0;
+
+  this->engineResponseTimeoutMillis = kDefaultEngineResponseTimeoutMillis;
+  memset(this->engineResponseHistogram, 0, sizeof(this->engineResponseHistogram));
+  this->engineResponseTimeoutCount = 0;
+  vPortCPUInitializeMutex(&this->engineStateMux);
+  this->lastEngineStateChangeMicros = 0;
+  this->engineStateEventGroup = xEventGroupCreate();
+
+  this->engineStateDebounceMillis = kDefaultEngineStateDebounceMillis;
+  this->engineStateTask = NULL;
+  memset(this->engineStateTransitions, 0, sizeof(this->engineStateTransitions));
+  this->engineStateTransitionCount = 0;
+  xTaskCreate(_confirmEngineStates, "CarSmartKey::engine", 3 * 1024, this, tskIDLE_PRIORITY + 2, &this->engineConfirmationTask);
+
   gpio_set_direction(this->powerPin, GPIO_MODE_OUTPUT);
   gpio_set_direction(this->lockButtonPin, GPIO_MODE_OUTPUT);
   gpio_set_direction(this->unlockButtonPin, GPIO_MODE_OUTPUT);
@@ -36,219 +155,206 @@ CarSmartKey::CarSmartKey(gpio_num_t powerOutputPin, gpio_num_t lockButtonOutputP
   // Ensure the smart key power is off for security
   this->deactivateSmartKey();
 
-  this->lastTargetDoorLockState = LockMechanismStateUnknown;
+  // The doors are not sensed, so the last command is the best estimate after a reboot
+  this->stateStore = stateStore;
+  this->lastTargetDoorLockState = (LockMechanismState)stateStore->restoreUInt32(kTargetDoorLockStateKey, LockMechanismStateUnknown);
+  if (this->lastTargetDoorLockState != LockMechanismStateSecured && this->lastTargetDoorLockState != LockMechanismStateUnsecured) {
+    this->lastTargetDoorLockState = LockMechanismStateUnknown;
+  }
+  this->lastCurrentDoorLockState = this->lastTargetDoorLockState;
 }
 
 void CarSmartKey::registerBridgedHomeKitAccessory() {
   ESP_LOGI(TAG, "registerBridgedHomeKitAccessory");
 
-  this->createAccessory();
-  this->addEngineService();
-  this->addDoorLockService();
-  this->addFirmwareUpgradeService();
-  /* Add the Accessory to the HomeKit Database */
-  hap_add_bridged_accessory(this->accessory, hap_get_unique_aid(kSetupID));
-
-  this->startObservingEngineState();
-}
-
-void CarSmartKey::createAccessory() {
-  /* Initialise the mandatory parameters for Accessory which will be added as
-   * the mandatory services internally
-   */
-  hap_acc_cfg_t config = {
-    .name = (char*)"Car Smart Key",
-    .model = (char*)"Model",
-    .manufacturer = (char*)"Yuji Nakayama",
-    .serial_num = (char*)"Serial Number",
-    .fw_rev = (char*)"Firmware Version",
-    .hw_rev = NULL,
-    .pv = (char*)"1.0.0",
-    .cid = HAP_CID_BRIDGE,
-    .identify_routine = identifyAccessory,
+  static const ServiceDefinition<CarSmartKey> kServiceDefinitions[] = {
+    defineService(&CarSmartKey::createEngineService, kEngineServiceName, kEngineServiceHandlers),
+    defineService(&CarSmartKey::createDoorLockService, kDoorLockServiceName, kDoorLockServiceHandlers),
   };
 
-  /* Create accessory object */
-  this->accessory = hap_acc_create(&config);
+  this->accessory = createAccessory(this, kAccessoryDefinition, kServiceDefinitions);
+  addBridgedAccessory(this->accessory, kAccessoryDefinition);
 
-  /* Add a dummy Product Data */
-  uint8_t product_data[] = {'E','S','P','3','2','H','A','P'};
-  hap_acc_add_product_data(accessory, product_data, sizeof(product_data));
+  this->startObservingEngineState();
 }
 
-void CarSmartKey::addEngineService() {
-  /* Create the Switch Service. Include the "name" since this is a user visible service  */
+hap_serv_t* CarSmartKey::createEngineService() {
+  /* Create the Switch Service */
   hap_serv_t* service = hap_serv_switch_create(false);
+  this->engineOnCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_ON);
+  return service;
+}
 
-  hap_serv_add_char(service, hap_char_name_create(strdup(kEngineServiceName)));
-
-  /* Set the write callback for the service */
-  hap_serv_set_write_cb(service, writeEngineServiceCharacteristic);
+hap_serv_t* CarSmartKey::createDoorLockService() {
+  /* Create a Lock Mechanism service */
+  hap_serv_t* service = hap_serv_lock_mechanism_create(
+    this->lastCurrentDoorLockState,
+    this->lastTargetDoorLockState == LockMechanismStateUnknown ? LockMechanismStateUnsecured : this->lastTargetDoorLockState
+  );
+  this->currentDoorLockStateCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_LOCK_CURRENT_STATE);
+  this->targetDoorLockStateCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_LOCK_TARGET_STATE);
+  return service;
+}
 
-  /* Set the read callback for the service (optional) */
-  hap_serv_set_read_cb(service, readEngineServiceCharacteristic);
+void CarSmartKey::startObservingEngineState() {
+  gpio_config_t config;
+  config.pin_bit_mask = (1 << this->engineStatePin);
+  config.mode = GPIO_MODE_INPUT;
+  config.intr_type = GPIO_INTR_ANYEDGE;
+  ESP_ERROR_CHECK(gpio_config(&config));
 
-  // Allow access to CarSmartKey instance from the read/write callbals
-  hap_serv_set_priv(service, this);
+  this->lastEngineState = this->getEngineState(false);
 
-  /* Add the Switch Service to the Accessory Object */
-  hap_acc_add_serv(this->accessory, service);
+  // The task must exist before the ISR notifies it
+  xTaskCreate(_handleEngineStateChanges, "CarSmartKey::engineState", 3 * 1024, this, tskIDLE_PRIORITY + 3, &this->engineStateTask);
 
-  this->engineOnCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_ON);
+  gpio_isr_handler_add(this->engineStatePin, onEngineStateChange, this);
 }
 
-void CarSmartKey::addDoorLockService() {
-  /* Create a Lock Mechanism service. Include the "name" since this is a user visible service  */
-  hap_serv_t* service = hap_serv_lock_mechanism_create(LockMechanismStateUnknown, LockMechanismStateUnsecured);
-
-  hap_serv_add_char(service, hap_char_name_create(strdup(kDoorLockServiceName)));
-
-  /* Set the write callback for the service */
-  hap_serv_set_write_cb(service, writeDoorLockServiceCharacteristic);
+// The ISR only notifies the low 32 bits of the edge timestamp,
+// and the rest is done here so that HomeKit is updated once per stable transition.
+void CarSmartKey::handleEngineStateChanges() {
+  while (true) {
+    uint32_t edgeMicrosLow;
+    xTaskNotifyWait(0, 0, &edgeMicrosLow, portMAX_DELAY);
+
+    // Restore the 64-bit timestamp assuming the edge occurred within the last 71 minutes
+    int64_t now = esp_timer_get_time();
+    int64_t firstEdgeMicros = now - (uint32_t)((uint32_t)now - edgeMicrosLow);
+    uint16_t edgeCount = 1;
+
+    // Wait until no more edges arrive within the debounce duration
+    while (xTaskNotifyWait(0, 0, &edgeMicrosLow, pdMS_TO_TICKS(this->engineStateDebounceMillis)) == pdTRUE) {
+      if (edgeCount < UINT16_MAX) {
+        edgeCount++;
+      }
+    }
 
-  /* Set the read callback for the service (optional) */
-  hap_serv_set_read_cb(service, readDoorLockServiceCharacteristic);
+    bool state = this->getEngineState(false);
 
-  // Allow access to CarSmartKey instance from the read/write callbals
-  hap_serv_set_priv(service, this);
+    portENTER_CRITICAL(&this->engineStateMux);
+    bool isChanged = state != this->lastEngineState;
+    if (isChanged) {
+      this->lastEngineState = state;
+      this->lastEngineStateChangeMicros = firstEdgeMicros;
+    }
+    portEXIT_CRITICAL(&this->engineStateMux);
 
-  /* Add the Lock Mechanism service to the accessory object */
-  hap_acc_add_serv(this->accessory, service);
+    if (!isChanged) {
+      DEFERRED_LOGD(TAG, "Ignored %u engine state glitch edges", edgeCount);
+      continue;
+    }
 
-  this->currentDoorLockStateCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_LOCK_CURRENT_STATE);
-  this->targetDoorLockStateCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_LOCK_TARGET_STATE);
-}
+    this->recordEngineStateTransition(state, firstEdgeMicros, edgeCount);
 
-/* Create the Firmware Upgrade HomeKit Custom Service.
- * Please refer the FW Upgrade documentation under components/homekit/extras/include/hap_fw_upgrade.h
- * and the top level README for more information.
- */
-void CarSmartKey::addFirmwareUpgradeService() {
-  /*  Required for server verification during OTA, PEM format as string  */
-  char server_cert[] = {};
+    ESP_LOGI(TAG, "Engine state changed to %i (%u edges)", state, edgeCount);
 
-  hap_fw_upgrade_config_t ota_config = {
-      .server_cert_pem = server_cert,
-  };
+    notifyCharacteristicValue(this->engineOnCharacteristic, state);
 
-  hap_serv_t* service = hap_serv_fw_upgrade_create(&ota_config);
+    xEventGroupSetBits(this->engineStateEventGroup, state ? kEngineRunningBit : kEngineStoppedBit);
+  }
+}
 
-  /* Add the service to the Accessory Object */
-  hap_acc_add_serv(accessory, service);
+void CarSmartKey::recordEngineStateTransition(bool state, int64_t timestampMicros, uint16_t edgeCount) {
+  EngineStateTransition* transition = &this->engineStateTransitions[this->engineStateTransitionCount % kEngineStateTransitionHistoryCount];
+  transition->timestampMicros = timestampMicros;
+  transition->state = state;
+  transition->edgeCount = edgeCount;
+  this->engineStateTransitionCount++;
 }
 
-void CarSmartKey::startObservingEngineState() {
-  gpio_config_t config;
-  config.pin_bit_mask = (1 << this->engineStatePin);
-  config.mode = GPIO_MODE_INPUT;
-  config.intr_type = GPIO_INTR_ANYEDGE;
-  ESP_ERROR_CHECK(gpio_config(&config));
+void CarSmartKey::logEngineStateTransitions() {
+  uint32_t count = this->engineStateTransitionCount;
+  uint32_t firstIndex = count > kEngineStateTransitionHistoryCount ? count - kEngineStateTransitionHistoryCount : 0;
 
-  gpio_isr_handler_add(this->engineStatePin, onEngineStateChange, this);
+  ESP_LOGI(TAG, "Recent engine state transitions (%u in total):", count);
+
+  for (uint32_t i = firstIndex; i < count; i++) {
+    EngineStateTransition* transition = &this->engineStateTransitions[i % kEngineStateTransitionHistoryCount];
+    ESP_LOGI(TAG, "  %lld ms: %i (%u edges)", transition->timestampMicros / 1000, transition->state, transition->edgeCount);
+  }
 }
 
 bool CarSmartKey::getEngineState(bool loggingEnabled) {
   bool state = gpio_get_level(this->engineStatePin) == 1;
 
   if (loggingEnabled) {
-    ESP_LOGD(TAG, "getEngineState: %i", state);
+    DEFERRED_LOGD(TAG, "getEngineState: %i", state);
   }
 
   return state;
 }
 
-void CarSmartKey::setEngineState(bool newState) {
+bool CarSmartKey::setEngineState(bool newState) {
   ESP_LOGD(TAG, "setEngineState: %i", newState);
 
   if (newState && !this->getEngineState()) {
-    this->startEngine();
+    return this->startEngine();
   } else if (!newState && this->getEngineState()) {
-    this->stopEngine();
+    return this->stopEngine();
   }
+
+  // Already in the state; drop the pending command changing it
+  this->cancelPendingCommand(newState ? SmartKeyCommandStopEngine : SmartKeyCommandStartEngine);
+  return true;
 }
 
 
 LockMechanismState CarSmartKey::getCurrentDoorLockState() {
   // TODO: Fetch real current state from the vehicle
-  return this->lastTargetDoorLockState;
+  return this->lastCurrentDoorLockState;
 }
 
 LockMechanismState CarSmartKey::getTargetDoorLockState() {
   return this->lastTargetDoorLockState;
 }
 
-void CarSmartKey::setDoorLockState(LockMechanismState newTargetState) {
-  if (newTargetState != LockMechanismStateUnsecured && newTargetState != LockMechanismStateSecured) {
-    ESP_LOGE(TAG, "unsupported target lock mechanism state %i", newTargetState);
-    return;
-  }
-
-  this->lastTargetDoorLockState = newTargetState;
-
+bool CarSmartKey::setDoorLockState(LockMechanismState newTargetState) {
   switch (newTargetState) {
   case LockMechanismStateSecured:
-    this->lockDoors();
-    break;
+    return this->lockDoors();
   case LockMechanismStateUnsecured:
-    this->unlockDoors();
-    break;
+    return this->unlockDoors();
   default:
-    break;
+    ESP_LOGE(TAG, "unsupported target lock mechanism state %i", newTargetState);
+    return false;
   }
 }
 
-void CarSmartKey::startEngine() {
+bool CarSmartKey::startEngine() {
   ESP_LOGD(TAG, "startEngine");
-
-  this->activateSmartKey();
-
-  this->pressSmartKeyLockButton(150);
-  delay(400);
-  this->pressSmartKeyLockButton(150);
-  delay(400);
-  this->pressSmartKeyLockButton(3000);
-
-  this->deactivateSmartKey();
-
-  delay(1000); // Wait for the engine to actually start
+  return this->enqueueCommand(SmartKeyCommandStartEngine);
 }
 
-void CarSmartKey::stopEngine() {
+bool CarSmartKey::stopEngine() {
   ESP_LOGD(TAG, "stopEngine");
-
-  this->activateSmartKey();
-  this->pressSmartKeyLockButton(2000);
-  this->deactivateSmartKey();
-
-  delay(500); // Wait for the engine to actually stop
+  return this->enqueueCommand(SmartKeyCommandStopEngine);
 }
 
-void CarSmartKey::lockDoors() {
+bool CarSmartKey::lockDoors() {
   ESP_LOGD(TAG, "lockDoors");
 
-  this->activateSmartKey();
-  // For some reason pressing for 150ms does not work (maybe to avoid unintentional lock by mistake?)
-  this->pressSmartKeyLockButton(600);
-  this->deactivateSmartKey();
+  if (!this->enqueueCommand(SmartKeyCommandLockDoors)) {
+    return false;
+  }
+
+  this->lastTargetDoorLockState = LockMechanismStateSecured;
+  this->stateStore->setUInt32(kTargetDoorLockStateKey, LockMechanismStateSecured);
+  notifyCharacteristicValueImmediately(this->targetDoorLockStateCharacteristic, (uint32_t)LockMechanismStateSecured);
+  return true;
 }
 
-void CarSmartKey::unlockDoors() {
+bool CarSmartKey::unlockDoors() {
   ESP_LOGD(TAG, "unlockDoors");
 
-  this->activateSmartKey();
-  // For some reason pressing for 150ms does not work (maybe to avoid unintentional unlock by mistake?)
-  this->pressSmartKeyUnlockButton(600);
-  this->deactivateSmartKey();
-}
+  if (!this->enqueueCommand(SmartKeyCommandUnlockDoors)) {
+    return false;
+  }
 
-void CarSmartKey::activateSmartKey() {
-  ESP_LOGV(TAG, "activateSmartKey");
-  gpio_set_level(this->powerPin, 1);
-  // It seems the smart key has some capacitors inside
-  // and they need some time to be charged to generate radio waves
-  // especially for long press of the lock button.
-  // 500ms doesn't work.
-  delay(1000);
+  this->lastTargetDoorLockState = LockMechanismStateUnsecured;
+  this->stateStore->setUInt32(kTargetDoorLockStateKey, LockMechanismStateUnsecured);
+  notifyCharacteristicValueImmediately(this->targetDoorLockStateCharacteristic, (uint32_t)LockMechanismStateUnsecured);
+  return true;
 }
 
 void CarSmartKey::deactivateSmartKey() {
@@ -256,174 +362,388 @@ void CarSmartKey::deactivateSmartKey() {
   gpio_set_level(this->powerPin, 0);
 }
 
-void CarSmartKey::pressSmartKeyLockButton(uint32_t durationInMilliseconds) {
-  ESP_LOGV(TAG, "pressSmartKeyLockButton on");
+// Commands from the HAP thread and the HTTP server are serialized here.
+// A command that is already pending is not queued again,
+// and a pending command contradicting the new one (e.g. lock vs unlock) is replaced with the new one.
+bool CarSmartKey::enqueueCommand(SmartKeyCommand command) {
+  SmartKeyCommand contradictoryCommand = getContradictoryCommand(command);
+  bool isAccepted = true;
+  bool shouldStartProcessing = false;
+
+  portENTER_CRITICAL(&this->commandMux);
+
+  PendingSmartKeyCommand* existingCommand = NULL;
+  for (size_t i = 0; i < this->pendingCommandCount; i++) {
+    if (this->pendingCommands[i].command == command || this->pendingCommands[i].command == contradictoryCommand) {
+      existingCommand = &this->pendingCommands[i];
+      break;
+    }
+  }
 
-  notifyLockStateUpdate(this->targetDoorLockStateCharacteristic, LockMechanismStateSecured);
+  if (existingCommand != NULL) {
+    if (existingCommand->command != command) {
+      existingCommand->command = command;
+      existingCommand->enqueuedMicros = esp_timer_get_time();
+    }
+  } else if (this->pendingCommandCount < kMaxPendingCommandCount) {
+    PendingSmartKeyCommand* newCommand = &this->pendingCommands[this->pendingCommandCount++];
+    newCommand->command = command;
+    newCommand->enqueuedMicros = esp_timer_get_time();
+  } else {
+    isAccepted = false;
+  }
+
+  if (isAccepted && !this->isProcessingCommand) {
+    this->isProcessingCommand = true;
+    shouldStartProcessing = true;
+  }
 
-  gpio_set_level(this->lockButtonPin, 1);
+  portEXIT_CRITICAL(&this->commandMux);
+
+  if (!isAccepted) {
+    ESP_LOGW(TAG, "Command queue is full; %s is rejected", kCommandScripts[command].name);
+    return false;
+  }
 
-  delay(durationInMilliseconds);
+  if (existingCommand != NULL) {
+    ESP_LOGD(TAG, "%s is coalesced with the pending command", kCommandScripts[command].name);
+  }
 
-  ESP_LOGV(TAG, "pressSmartKeyLockButton off");
-  gpio_set_level(this->lockButtonPin, 0);
+  if (shouldStartProcessing) {
+    this->processNextCommand();
+  }
 
-  notifyLockStateUpdate(this->currentDoorLockStateCharacteristic, LockMechanismStateSecured);
+  return true;
 }
 
-void CarSmartKey::pressSmartKeyUnlockButton(uint32_t durationInMilliseconds) {
-  ESP_LOGV(TAG, "pressSmartKeyUnlockButton on");
+void CarSmartKey::cancelPendingCommand(SmartKeyCommand command) {
+  portENTER_CRITICAL(&this->commandMux);
 
-  notifyLockStateUpdate(this->targetDoorLockStateCharacteristic, LockMechanismStateUnsecured);
+  for (size_t i = 0; i < this->pendingCommandCount; i++) {
+    if (this->pendingCommands[i].command == command) {
+      memmove(&this->pendingCommands[i], &this->pendingCommands[i + 1], (this->pendingCommandCount - i - 1) * sizeof(PendingSmartKeyCommand));
+      this->pendingCommandCount--;
+      break;
+    }
+  }
 
-  gpio_set_level(this->unlockButtonPin, 1);
+  portEXIT_CRITICAL(&this->commandMux);
+}
 
-  delay(durationInMilliseconds);
+// This must be called only by whoever set isProcessingCommand to true
+void CarSmartKey::processNextCommand() {
+  portENTER_CRITICAL(&this->commandMux);
 
-  ESP_LOGV(TAG, "pressSmartKeyUnlockButton off");
-  gpio_set_level(this->unlockButtonPin, 0);
+  if (this->pendingCommandCount == 0) {
+    this->isProcessingCommand = false;
+    bool isPowered = this->isSmartKeyPowered;
+    portEXIT_CRITICAL(&this->commandMux);
 
-  notifyLockStateUpdate(this->currentDoorLockStateCharacteristic, LockMechanismStateUnsecured);
-}
+    if (isPowered) {
+      this->restartPowerHoldTimer();
+    }
+
+    return;
+  }
+
+  this->currentCommand = this->pendingCommands[0];
+  this->pendingCommandCount--;
+  memmove(&this->pendingCommands[0], &this->pendingCommands[1], this->pendingCommandCount * sizeof(PendingSmartKeyCommand));
+  bool isPowered = this->isSmartKeyPowered;
 
-/* Mandatory identify routine for the accessory.
- * In a real accessory, something like LED blink should be implemented
- * got visual identification
- */
-static int identifyAccessory(hap_acc_t* ha) {
-  ESP_LOGI(TAG, "Accessory identified");
-  return HAP_SUCCESS;
+  portEXIT_CRITICAL(&this->commandMux);
+
+  cancelScheduledCallback(this->powerHoldHandle);
+
+  if (isPowered) {
+    this->runCommandScript();
+  } else if (!this->sequencer->run(&kActivateSmartKeyScript, _onActuationComplete, this)) {
+    this->failCurrentCommand();
+  }
 }
 
-static int readEngineServiceCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv) {
-  const char* characteristicUUID = hap_char_get_type_uuid(hc);
-  ESP_LOGD(TAG, "readEngineServiceCharacteristic: %s", characteristicUUID);
+// Invoked in the esp_timer task
+void CarSmartKey::onActuationComplete(const ActuationScript* script, bool isSucceeded) {
+  if (!isSucceeded) {
+    this->failCurrentCommand();
+    return;
+  }
 
-  int entireResult = HAP_SUCCESS;
+  if (script == &kActivateSmartKeyScript) {
+    portENTER_CRITICAL(&this->commandMux);
+    this->isSmartKeyPowered = true;
+    portEXIT_CRITICAL(&this->commandMux);
 
-  CarSmartKey* smartKey = (CarSmartKey*)serv_priv;
-  hap_val_t value;
+    this->runCommandScript();
+    return;
+  }
 
-  if (strcmp(characteristicUUID, HAP_CHAR_UUID_ON) == 0) {
-    value.b = smartKey->getEngineState();
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_NAME) == 0) {
-    value.s = strdup(kEngineServiceName);
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else {
-    ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-    *status_code = HAP_STATUS_RES_ABSENT;
-    entireResult = HAP_FAIL;
+  switch (this->currentCommand.command) {
+  case SmartKeyCommandStartEngine:
+  case SmartKeyCommandStopEngine:
+    // Completed in confirmEngineStates() once the engine responds
+    xTaskNotifyGive(this->engineConfirmationTask);
+    break;
+  default:
+    this->completeCurrentCommand();
+    this->processNextCommand();
+    break;
   }
+}
 
-  return entireResult;
+void CarSmartKey::runCommandScript() {
+  SmartKeyCommand command = this->currentCommand.command;
+
+  if (command == SmartKeyCommandStartEngine || command == SmartKeyCommandStopEngine) {
+    // Forget edges before this command so that only the response to this press is waited for
+    xEventGroupClearBits(this->engineStateEventGroup, kEngineRunningBit | kEngineStoppedBit);
+    this->engineCommandStartMicros = esp_timer_get_time();
+  }
+
+  if (!this->sequencer->run(&kCommandScripts[command], _onActuationComplete, this)) {
+    this->failCurrentCommand();
+  }
 }
 
-static int writeEngineServiceCharacteristic(hap_write_data_t write_data[], int count, void* serv_priv, void* write_priv) {
-  int entireResult = HAP_SUCCESS;
-  CarSmartKey *smartKey = (CarSmartKey *)serv_priv;
+// Runs in its own task since waiting for the engine blocks
+void CarSmartKey::confirmEngineStates() {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-  for (int i = 0; i < count; i++) {
-    hap_write_data_t* data = &write_data[i];
-    const char *characteristicUUID = hap_char_get_type_uuid(data->hc);
+    bool expectedState = this->currentCommand.command == SmartKeyCommandStartEngine;
+    int64_t changedMicros = 0;
+    bool isConfirmed = this->waitForEngineState(expectedState, &changedMicros);
+    this->recordEngineResponse(isConfirmed, changedMicros);
 
-    if (strcmp(characteristicUUID, HAP_CHAR_UUID_ON) == 0) {
-      bool newState = data->val.b;
-      smartKey->setEngineState(newState);
+    if (!isConfirmed) {
+      ESP_LOGW(TAG, "Engine did not %s within %u ms", expectedState ? "start" : "stop", this->engineResponseTimeoutMillis);
+      this->logEngineStateTransitions();
+    }
 
-      if (smartKey->getEngineState() == newState) {
-        *(data->status) = HAP_STATUS_SUCCESS;
-      } else {
-        *(data->status) = HAP_STATUS_COMM_ERR;
-        entireResult = HAP_FAIL;
-      }
-    } else {
-      ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-      *(data->status) = HAP_STATUS_RES_ABSENT;
-      entireResult = HAP_FAIL;
+    // The actual engine state is notified here, so HomeKit sees the failure on timeout
+    this->completeCurrentCommand();
+    this->processNextCommand();
+  }
+}
+
+// Only the debounced state counts, so glitches and edges still being debounced are not confirmations
+bool CarSmartKey::waitForEngineState(bool expectedState, int64_t* changedMicros) {
+  EventBits_t expectedBit = expectedState ? kEngineRunningBit : kEngineStoppedBit;
+  TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(this->engineResponseTimeoutMillis);
+
+  while (true) {
+    portENTER_CRITICAL(&this->engineStateMux);
+    bool state = this->lastEngineState;
+    *changedMicros = this->lastEngineStateChangeMicros;
+    portEXIT_CRITICAL(&this->engineStateMux);
+
+    if (state == expectedState) {
+      return true;
     }
+
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(deadline - now) <= 0) {
+      return false;
+    }
+
+    xEventGroupWaitBits(this->engineStateEventGroup, expectedBit, pdTRUE, pdFALSE, deadline - now);
   }
+}
 
-  return entireResult;
+void CarSmartKey::recordEngineResponse(bool isConfirmed, int64_t changedMicros) {
+  if (!isConfirmed) {
+    this->engineResponseTimeoutCount++;
+    this->logEngineResponseHistogram();
+    return;
+  }
+
+  // The engine may have been already in the state when this command started
+  uint32_t responseMillis = changedMicros > this->engineCommandStartMicros ? (changedMicros - this->engineCommandStartMicros) / 1000 : 0;
+  size_t bucketIndex = responseMillis / kEngineResponseHistogramBucketMillis;
+  if (bucketIndex >= kEngineResponseHistogramBucketCount) {
+    bucketIndex = kEngineResponseHistogramBucketCount - 1;
+  }
+  this->engineResponseHistogram[bucketIndex]++;
+
+  ESP_LOGI(TAG, "Engine responded in %u ms", responseMillis);
+  this->logEngineResponseHistogram();
 }
 
-static void onEngineStateChange(void* arg) {
-  // We cannot use log functions in this interrupt handler.
-  // > This function or these macros should not be used from an interrupt.
-  // https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-reference/system/log.html#_CPPv413esp_log_write15esp_log_level_tPKcPKcz
-  // https://esp32.com/viewtopic.php?f=13&t=3748&p=17131
-  CarSmartKey* smartKey = (CarSmartKey*)arg;
-  bool state = smartKey->getEngineState(false);
+// Engine commands are rare, so this is logged on every response
+void CarSmartKey::logEngineResponseHistogram() {
+  if (LOG_LOCAL_LEVEL < ESP_LOG_INFO) {
+    return;
+  }
 
-  ets_printf("onEngineStateChange %d\n", state);
+  char histogram[kEngineResponseHistogramBucketCount * 6 + 1];
+  size_t length = 0;
+  for (size_t i = 0; i < kEngineResponseHistogramBucketCount && length < sizeof(histogram); i++) {
+    length += snprintf(histogram + length, sizeof(histogram) - length, " %u", this->engineResponseHistogram[i]);
+  }
 
-  hap_val_t value;
-  value.b = state;
-  hap_char_update_val(smartKey->engineOnCharacteristic, &value);
+  ESP_LOGI(TAG, "Engine response histogram (%u ms buckets):%s, timeouts: %u", kEngineResponseHistogramBucketMillis, histogram, this->engineResponseTimeoutCount);
 }
 
-static int readDoorLockServiceCharacteristic(hap_char_t *hc, hap_status_t *status_code, void *serv_priv, void *read_priv) {
-  const char* characteristicUUID = hap_char_get_type_uuid(hc);
-  ESP_LOGD(TAG, "readDoorLockServiceCharacteristic: %s", characteristicUUID);
+void CarSmartKey::completeCurrentCommand(bool isSucceeded) {
+  SmartKeyCommand command = this->currentCommand.command;
+  uint32_t latencyMicros = esp_timer_get_time() - this->currentCommand.enqueuedMicros;
 
-  int entireResult = HAP_SUCCESS;
-  CarSmartKey* smartKey = (CarSmartKey*)serv_priv;
+  SmartKeyCommandStatistics* statistics = &this->commandStatistics[command];
+  statistics->count++;
+  if (!isSucceeded) {
+    statistics->failureCount++;
+  }
+  statistics->totalLatencyMicros += latencyMicros;
+  if (latencyMicros > statistics->maxLatencyMicros) {
+    statistics->maxLatencyMicros = latencyMicros;
+  }
 
-  hap_val_t value;
+  ESP_LOGI(
+    TAG,
+    "%s %s in %u ms (average %u ms, max %u ms, %u failures)",
+    kCommandScripts[command].name,
+    isSucceeded ? "completed" : "failed",
+    latencyMicros / 1000,
+    (uint32_t)(statistics->totalLatencyMicros / statistics->count / 1000),
+    statistics->maxLatencyMicros / 1000,
+    statistics->failureCount
+  );
+
+  switch (command) {
+  case SmartKeyCommandStartEngine:
+  case SmartKeyCommandStopEngine:
+    notifyCharacteristicValue(this->engineOnCharacteristic, this->getEngineState());
+    break;
+  case SmartKeyCommandLockDoors:
+    this->lastCurrentDoorLockState = isSucceeded ? LockMechanismStateSecured : LockMechanismStateUnknown;
+    notifyCharacteristicValueImmediately(this->currentDoorLockStateCharacteristic, (uint32_t)this->lastCurrentDoorLockState);
+    break;
+  case SmartKeyCommandUnlockDoors:
+    this->lastCurrentDoorLockState = isSucceeded ? LockMechanismStateUnsecured : LockMechanismStateUnknown;
+    notifyCharacteristicValueImmediately(this->currentDoorLockStateCharacteristic, (uint32_t)this->lastCurrentDoorLockState);
+    break;
+  default:
+    break;
+  }
+}
 
-  if (strcmp(characteristicUUID, HAP_CHAR_UUID_LOCK_CURRENT_STATE) == 0) {
-    value.u = smartKey->getCurrentDoorLockState();
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_LOCK_TARGET_STATE) == 0) {
-    value.u = smartKey->getTargetDoorLockState();
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_NAME) == 0) {
-    value.s = strdup(kDoorLockServiceName);
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else {
-    ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-    *status_code = HAP_STATUS_RES_ABSENT;
-    entireResult = HAP_FAIL;
+// The sequencer has released the pins or never driven them, so the smart key is off.
+// Moving on to the next command keeps the queue from getting stuck.
+void CarSmartKey::failCurrentCommand() {
+  ESP_LOGE(TAG, "%s could not be actuated", kCommandScripts[this->currentCommand.command].name);
+
+  this->deactivateSmartKey();
+  portENTER_CRITICAL(&this->commandMux);
+  this->isSmartKeyPowered = false;
+  portEXIT_CRITICAL(&this->commandMux);
+
+  this->completeCurrentCommand(false);
+  this->processNextCommand();
+}
+
+void CarSmartKey::restartPowerHoldTimer() {
+  cancelScheduledCallback(this->powerHoldHandle);
+  this->powerHoldHandle = scheduleCallback(this->powerHoldMillis, _onPowerHoldTimeout, this);
+
+  if (this->powerHoldHandle == 0) {
+    // Never leave the smart key powered without the timer turning it off
+    this->onPowerHoldTimeout();
+  }
+}
+
+// Invoked in the esp_timer task by the scheduler
+void CarSmartKey::onPowerHoldTimeout() {
+  portENTER_CRITICAL(&this->commandMux);
+
+  // A new command has arrived; it will restart the timer when done
+  if (this->isProcessingCommand) {
+    portEXIT_CRITICAL(&this->commandMux);
+    return;
   }
 
-  return entireResult;
+  this->isSmartKeyPowered = false;
+
+  portEXIT_CRITICAL(&this->commandMux);
+
+  this->deactivateSmartKey();
 }
 
-static int writeDoorLockServiceCharacteristic(hap_write_data_t write_data[], int count, void *serv_priv, void *write_priv) {
-  int entireResult = HAP_SUCCESS;
-  CarSmartKey* smartKey = (CarSmartKey*)serv_priv;
+static void _onActuationComplete(const ActuationScript* script, bool isSucceeded, void* context) {
+  CarSmartKey* smartKey = (CarSmartKey*)context;
+  smartKey->onActuationComplete(script, isSucceeded);
+}
 
-  for (int i = 0; i < count; i++) {
-    hap_write_data_t* data = &write_data[i];
-    const char* characteristicUUID = hap_char_get_type_uuid(data->hc);
+static void _onPowerHoldTimeout(void* arg) {
+  CarSmartKey* smartKey = (CarSmartKey*)arg;
+  smartKey->onPowerHoldTimeout();
+}
 
-    if (strcmp(characteristicUUID, HAP_CHAR_UUID_LOCK_TARGET_STATE) == 0) {
-      LockMechanismState newState = (LockMechanismState)data->val.u;
+static void _confirmEngineStates(void* arg) {
+  CarSmartKey* smartKey = (CarSmartKey*)arg;
+  smartKey->confirmEngineStates();
+}
 
-      if (newState == LockMechanismStateUnsecured || newState == LockMechanismStateSecured) {
-        smartKey->setDoorLockState(newState);
-        *(data->status) = HAP_STATUS_SUCCESS;
-      } else {
-        ESP_LOGE(TAG, "unsupported target lock mechanism state %i", newState);
-        *(data->status) = HAP_STATUS_VAL_INVALID;
-      }
-    } else {
-      ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-      *(data->status) = HAP_STATUS_RES_ABSENT;
-      entireResult = HAP_FAIL;
-    }
+static void _handleEngineStateChanges(void* arg) {
+  CarSmartKey* smartKey = (CarSmartKey*)arg;
+  smartKey->handleEngineStateChanges();
+}
+
+static SmartKeyCommand getContradictoryCommand(SmartKeyCommand command) {
+  switch (command) {
+  case SmartKeyCommandStartEngine:
+    return SmartKeyCommandStopEngine;
+  case SmartKeyCommandStopEngine:
+    return SmartKeyCommandStartEngine;
+  case SmartKeyCommandLockDoors:
+    return SmartKeyCommandUnlockDoors;
+  case SmartKeyCommandUnlockDoors:
+    return SmartKeyCommandLockDoors;
+  default:
+    return command;
+  }
+}
+
+static hap_status_t readEngineState(CarSmartKey* smartKey, hap_char_t* hc) {
+  updateCharacteristicValue(hc, smartKey->getEngineState());
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t writeEngineState(CarSmartKey* smartKey, hap_write_data_t* data) {
+  bool newState = data->val.b;
+
+  // The actual engine state is notified when the actuation completes
+  return smartKey->setEngineState(newState) ? HAP_STATUS_SUCCESS : HAP_STATUS_RES_BUSY;
+}
+
+static void IRAM_ATTR onEngineStateChange(void* arg) {
+  // Nothing but notifying is done here since logging or HAP functions cannot be used in interrupts.
+  // https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-reference/system/log.html#_CPPv413esp_log_write15esp_log_level_tPKcPKcz
+  CarSmartKey* smartKey = (CarSmartKey*)arg;
+
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  xTaskNotifyFromISR(smartKey->engineStateTask, (uint32_t)esp_timer_get_time(), eSetValueWithOverwrite, &higherPriorityTaskWoken);
+  if (higherPriorityTaskWoken) {
+    portYIELD_FROM_ISR();
   }
+}
 
-  return entireResult;
+static hap_status_t readCurrentDoorLockState(CarSmartKey* smartKey, hap_char_t* hc) {
+  updateCharacteristicValue(hc, (uint32_t)smartKey->getCurrentDoorLockState());
+  return HAP_STATUS_SUCCESS;
 }
 
-static void notifyLockStateUpdate(hap_acc_t* characteristic, LockMechanismState state) {
-  hap_val_t value;
-  value.u = state;
-  hap_char_update_val(characteristic, &value);
+static hap_status_t readTargetDoorLockState(CarSmartKey* smartKey, hap_char_t* hc) {
+  updateCharacteristicValue(hc, (uint32_t)smartKey->getTargetDoorLockState());
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t writeTargetDoorLockState(CarSmartKey* smartKey, hap_write_data_t* data) {
+  LockMechanismState newState = (LockMechanismState)data->val.u;
+
+  if (newState != LockMechanismStateUnsecured && newState != LockMechanismStateSecured) {
+    ESP_LOGE(TAG, "unsupported target lock mechanism state %i", newState);
+    return HAP_STATUS_VAL_INVALID;
+  }
+
+  return smartKey->setDoorLockState(newState) ? HAP_STATUS_SUCCESS : HAP_STATUS_RES_BUSY;
 }
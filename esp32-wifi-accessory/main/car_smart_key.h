@@ -2,6 +2,12 @@
 
 #include <hap.h>
 #include <driver/gpio.h>
+#include <scheduler.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include "actuation_sequencer.h"
+#include "persistent_state.h"
 
 // https://developer.apple.com/documentation/homekit/hmcharacteristicvaluelockmechanismstate
 typedef enum {
@@ -11,42 +17,136 @@ typedef enum {
   LockMechanismStateUnknown = 3,
 } LockMechanismState;
 
+typedef enum {
+  SmartKeyPinPower = 0,
+  SmartKeyPinLockButton,
+  SmartKeyPinUnlockButton,
+  SmartKeyPinCount
+} SmartKeyPin;
+
+typedef enum {
+  SmartKeyCommandStartEngine = 0,
+  SmartKeyCommandStopEngine,
+  SmartKeyCommandLockDoors,
+  SmartKeyCommandUnlockDoors,
+  SmartKeyCommandCount
+} SmartKeyCommand;
+
+typedef struct {
+  SmartKeyCommand command;
+  int64_t enqueuedMicros;
+} PendingSmartKeyCommand;
+
+// End-to-end latency from enqueue to completion
+typedef struct {
+  uint32_t count;
+  uint32_t failureCount; // Aborted since the actuation could not be scheduled
+  uint64_t totalLatencyMicros;
+  uint32_t maxLatencyMicros;
+} SmartKeyCommandStatistics;
+
+typedef struct {
+  int64_t timestampMicros; // When the first edge of the transition occurred
+  bool state;
+  uint16_t edgeCount; // Edges including bounces until the level got stable
+} EngineStateTransition;
+
 class CarSmartKey {
 public:
   gpio_num_t powerPin;
   gpio_num_t lockButtonPin;
   gpio_num_t unlockButtonPin;
   gpio_num_t engineStatePin;
+  gpio_num_t actuationPins[SmartKeyPinCount];
+  ActuationSequencer* sequencer;
+  PersistentStateStore* stateStore;
+
+  // How long the smart key is kept powered after the last command
+  // so that following commands don't need to wait for the capacitor charge again
+  uint32_t powerHoldMillis;
+  SmartKeyCommandStatistics commandStatistics[SmartKeyCommandCount];
+
+  static const size_t kEngineResponseHistogramBucketCount = 16;
+  static const uint32_t kEngineResponseHistogramBucketMillis = 500;
+
+  // How long to wait for the engine state change after the button is released
+  uint32_t engineResponseTimeoutMillis;
+  // Time from the first button press to the engine state change; the last bucket includes longer ones
+  uint32_t engineResponseHistogram[kEngineResponseHistogramBucketCount];
+  uint32_t engineResponseTimeoutCount;
+  EventGroupHandle_t engineStateEventGroup;
+
+  static const size_t kEngineStateTransitionHistoryCount = 8;
+
+  // Edges are ignored until the level stays unchanged for this duration
+  uint32_t engineStateDebounceMillis;
+  TaskHandle_t engineStateTask;
+  // Ring buffer of recent transitions for diagnostics
+  EngineStateTransition engineStateTransitions[kEngineStateTransitionHistoryCount];
+  uint32_t engineStateTransitionCount;
 
   hap_acc_t* accessory;
   hap_char_t* engineOnCharacteristic;
   hap_char_t* currentDoorLockStateCharacteristic;
   hap_char_t* targetDoorLockStateCharacteristic;
   LockMechanismState lastTargetDoorLockState;
+  LockMechanismState lastCurrentDoorLockState;
 
-  CarSmartKey(gpio_num_t powerOutputPin, gpio_num_t lockButtonOutputPin, gpio_num_t unlockButtonOutputPin, gpio_num_t engineStateInputPin);
+  CarSmartKey(PersistentStateStore* stateStore, gpio_num_t powerOutputPin, gpio_num_t lockButtonOutputPin, gpio_num_t unlockButtonOutputPin, gpio_num_t engineStateInputPin);
   void registerBridgedHomeKitAccessory();
 
+  // The setters below enqueue commands and return immediately.
+  // They return false only when the command queue is full.
+  // The results are notified through the characteristics when the commands complete.
+
   bool getEngineState(bool loggingEnabled = true);
-  void setEngineState(bool state);
+  bool setEngineState(bool state);
 
   LockMechanismState getCurrentDoorLockState();
   LockMechanismState getTargetDoorLockState();
-  void setDoorLockState(LockMechanismState newState);
+  bool setDoorLockState(LockMechanismState newState);
+
+  bool lockDoors();
+  bool unlockDoors();
 
-  void lockDoors();
-  void unlockDoors();
+  void onActuationComplete(const ActuationScript* script, bool isSucceeded);
+  void onPowerHoldTimeout();
+  void confirmEngineStates();
+  void handleEngineStateChanges();
+  void logEngineStateTransitions();
+  void logEngineResponseHistogram();
 
 private:
-  void createAccessory();
-  void addEngineService();
-  void addDoorLockService();
-  void addFirmwareUpgradeService();
+  static const size_t kMaxPendingCommandCount = 4;
+
+  portMUX_TYPE commandMux;
+  PendingSmartKeyCommand pendingCommands[kMaxPendingCommandCount];
+  size_t pendingCommandCount;
+  PendingSmartKeyCommand currentCommand;
+  bool isProcessingCommand;
+  bool isSmartKeyPowered;
+  ScheduledCallbackHandle powerHoldHandle;
+  TaskHandle_t engineConfirmationTask;
+  int64_t engineCommandStartMicros;
+  // The debounced state and the first edge of the transition to it
+  portMUX_TYPE engineStateMux;
+  bool lastEngineState;
+  int64_t lastEngineStateChangeMicros;
+
+  hap_serv_t* createEngineService();
+  hap_serv_t* createDoorLockService();
   void startObservingEngineState();
-  void startEngine();
-  void stopEngine();
-  void activateSmartKey();
+  bool startEngine();
+  bool stopEngine();
   void deactivateSmartKey();
-  void pressSmartKeyLockButton(uint32_t durationInMilliseconds);
-  void pressSmartKeyUnlockButton(uint32_t durationInMilliseconds);
+  bool enqueueCommand(SmartKeyCommand command);
+  void cancelPendingCommand(SmartKeyCommand command);
+  void processNextCommand();
+  void runCommandScript();
+  bool waitForEngineState(bool expectedState, int64_t* changedMicros);
+  void recordEngineResponse(bool isConfirmed, int64_t changedMicros);
+  void recordEngineStateTransition(bool state, int64_t timestampMicros, uint16_t edgeCount);
+  void completeCurrentCommand(bool isSucceeded = true);
+  void failCurrentCommand();
+  void restartPowerHoldTimer();
 };
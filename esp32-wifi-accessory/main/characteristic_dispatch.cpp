@@ -0,0 +1,98 @@
+#include "log_config.h"
+#include "characteristic_dispatch.h"
+
+#include <cstring>
+
+extern "C" {
+  #include "util.h"
+}
+
+static const char* TAG = "CharacteristicDispatch";
+
+static int dispatchRead(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv);
+static int dispatchWrite(hap_write_data_t write_data[], int count, void* serv_priv, void* write_priv);
+
+void setCharacteristicHandlers(hap_serv_t* service, const CharacteristicHandler* handlers, size_t count, void* owner) {
+  bool isWritable = false;
+
+  for (size_t i = 0; i < count; i++) {
+    const CharacteristicHandler* handler = &handlers[i];
+    hap_char_t* hc = hap_serv_get_char_by_uuid(service, handler->uuid);
+
+    if (hc == NULL) {
+      ESP_LOGE(TAG, "characteristic %s is not in the service", handler->uuid);
+      continue;
+    }
+
+    hap_char_set_priv(hc, (void*)handler);
+    isWritable |= handler->write != NULL;
+  }
+
+  hap_serv_set_read_cb(service, dispatchRead);
+  if (isWritable) {
+    hap_serv_set_write_cb(service, dispatchWrite);
+  }
+
+  // Allow access to the owner from the handlers
+  hap_serv_set_priv(service, owner);
+}
+
+// The value is set when the characteristic is created and never changes,
+// so it is updated only if it differs, which never allocates in the steady state
+// unlike duplicating the string on every read.
+static void serveConstantString(hap_char_t* hc, const char* string) {
+  const hap_val_t* currentValue = hap_char_get_val(hc);
+  if (currentValue != NULL && currentValue->s != NULL && strcmp(currentValue->s, string) == 0) {
+    return;
+  }
+
+  hap_val_t value;
+  value.s = strdup(string);
+  hap_char_update_val(hc, &value);
+}
+
+static int dispatchRead(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv) {
+  const CharacteristicHandler* handler = (const CharacteristicHandler*)hap_char_get_priv(hc);
+
+  if (handler == NULL) {
+    ESP_LOGE(TAG, "unsupported characteristic %s", hap_char_get_type_uuid(hc));
+    *status_code = HAP_STATUS_RES_ABSENT;
+    return HAP_FAIL;
+  }
+
+  ESP_LOGD(TAG, "read: %s", handler->uuid);
+
+  if (handler->read != NULL) {
+    *status_code = handler->read(hc, serv_priv);
+  } else {
+    if (handler->constantString != NULL) {
+      serveConstantString(hc, handler->constantString);
+    }
+    *status_code = HAP_STATUS_SUCCESS;
+  }
+
+  return *status_code == HAP_STATUS_SUCCESS ? HAP_SUCCESS : HAP_FAIL;
+}
+
+static int dispatchWrite(hap_write_data_t write_data[], int count, void* serv_priv, void* write_priv) {
+  int entireResult = HAP_SUCCESS;
+
+  for (int i = 0; i < count; i++) {
+    hap_write_data_t* data = &write_data[i];
+    const CharacteristicHandler* handler = (const CharacteristicHandler*)hap_char_get_priv(data->hc);
+
+    if (handler == NULL || handler->write == NULL) {
+      ESP_LOGE(TAG, "unsupported characteristic %s", hap_char_get_type_uuid(data->hc));
+      *(data->status) = HAP_STATUS_RES_ABSENT;
+      entireResult = HAP_FAIL;
+      continue;
+    }
+
+    *(data->status) = handler->write(data, serv_priv);
+    if (*(data->status) != HAP_STATUS_SUCCESS) {
+      entireResult = HAP_FAIL;
+    }
+  }
+
+  return entireResult;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <hap.h>
+#include <stddef.h>
+
+// owner is the service private data, e.g. the accessory instance.
+// Returns the status for the characteristic.
+typedef hap_status_t (*CharacteristicReadHandler)(hap_char_t* hc, void* owner);
+typedef hap_status_t (*CharacteristicWriteHandler)(hap_write_data_t* data, void* owner);
+
+typedef struct {
+  const char* uuid;
+  // NULL if the value is kept up to date by the owner, or constantString is served instead
+  CharacteristicReadHandler read;
+  // NULL if the characteristic is not writable
+  CharacteristicWriteHandler write;
+  // Served on reads if read is NULL, e.g. the service name, without allocation
+  const char* constantString;
+} CharacteristicHandler;
+
+// Resolves each characteristic in the service to its handler once here
+// and stores it on the characteristic with hap_char_set_priv(),
+// so that the read/write callbacks don't compare UUID strings on every request.
+// The handlers must be static since they are referenced until the service is deleted.
+void setCharacteristicHandlers(hap_serv_t* service, const CharacteristicHandler* handlers, size_t count, void* owner);
@@ -3,106 +3,105 @@
 
 #include <hap_apple_servs.h>
 #include <hap_apple_chars.h>
-#include <hap_fw_upgrade.h>
-#include <esp_timer.h>
 #include <cstring>
-#include "util.h"
+#include "homekit_accessory.h"
 
 static const char* TAG = "GarageRemote";
 
-static const char* kSetupID = "GRGR"; // This must be unique
-
-static const char* kServiceName = "Garage";
-
-static esp_timer_handle_t timer;
-typedef void (*callback_with_arg_t)(void*);
-
-static void _turnOffOpenButton(void* arg);
-static int identifyAccessory(hap_acc_t* ha);
-static int readCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv);
-static int writeTargetDoorState(hap_write_data_t write_data[], int count, void* serv_priv, void* write_priv);
-static void performLater(uint32_t milliseconds, callback_with_arg_t callback, void* arg);
+static const char kServiceName[] = "Garage";
+
+static const AccessoryDefinition kAccessoryDefinition = {
+  .name = "Garage",
+  .protocolVersion = "1.1.0",
+  .category = HAP_CID_GARAGE_DOOR_OPENER,
+  .setupID = "GRGR",
+};
+
+static const uint32_t kDefaultDoorTravelMillis = 15 * 1000;
+static const uint32_t kDefaultAutoCloseMillis = 60 * 1000;
+
+static const PulseSegment kPowerButtonSegments[] = {
+  {1, 100},
+};
+
+// Press the open button after the remote wakes up by the power button
+static const PulseSegment kOpenButtonSegments[] = {
+  {0, 200},
+  {1, 3000},
+};
+
+static hap_status_t readTargetDoorState(GarageRemote* garageRemote, hap_char_t* hc);
+static hap_status_t readCurrentDoorState(GarageRemote* garageRemote, hap_char_t* hc);
+static hap_status_t readObstructionDetected(GarageRemote* garageRemote, hap_char_t* hc);
+static hap_status_t writeTargetDoorState(GarageRemote* garageRemote, hap_write_data_t* data);
+
+static const CharacteristicHandler kGarageDoorOpenerServiceHandlers[] = {
+  {
+    .uuid = HAP_CHAR_UUID_TARGET_DOOR_STATE,
+    .read = readTrampoline<GarageRemote, readTargetDoorState>,
+    .write = writeTrampoline<GarageRemote, writeTargetDoorState>,
+    .constantString = NULL,
+  },
+  {
+    .uuid = HAP_CHAR_UUID_CURRENT_DOOR_STATE,
+    .read = readTrampoline<GarageRemote, readCurrentDoorState>,
+    .write = NULL,
+    .constantString = NULL,
+  },
+  {
+    .uuid = HAP_CHAR_UUID_OBSTRUCTION_DETECTED,
+    .read = readTrampoline<GarageRemote, readObstructionDetected>,
+    .write = NULL,
+    .constantString = NULL,
+  },
+  { .uuid = HAP_CHAR_UUID_NAME, .read = NULL, .write = NULL, .constantString = kServiceName },
+};
+
+// The generation at the time the transition was scheduled
+struct DoorStateTransition {
+  GarageRemote* garageRemote;
+  uint32_t generation;
+};
+
+static void _advanceDoorState(void* arg);
 
 GarageRemote::GarageRemote(gpio_num_t powerButtonPin, gpio_num_t openButtonPin) {
   this->powerButtonPin = powerButtonPin;
   this->openButtonPin = openButtonPin;
 
-  gpio_set_direction(powerButtonPin, GPIO_MODE_OUTPUT);
-  gpio_set_direction(openButtonPin, GPIO_MODE_OUTPUT);
+  this->powerButtonOutput = new RMTPulseOutput(RMT_CHANNEL_0, powerButtonPin);
+  this->openButtonOutput = new RMTPulseOutput(RMT_CHANNEL_1, openButtonPin);
 
-  this->targetDoorState = TargetDoorStateClosed;
+  this->doorTravelMillis = kDefaultDoorTravelMillis;
+  this->autoCloseMillis = kDefaultAutoCloseMillis;
+  vPortCPUInitializeMutex(&this->doorStateMux);
+  this->doorStateGeneration = 0;
+  this->doorStateTransitionHandle = 0;
+  this->doorStateTransition = NULL;
+
+  // The states are not kept across reboots on purpose. How long the power was lost is unknown,
+  // and an open door closes by itself, so Closed is the only state worth restoring.
   this->currentDoorState = CurrentDoorStateClosed;
+  this->targetDoorState = TargetDoorStateClosed;
 }
 
 void GarageRemote::registerBridgedHomeKitAccessory() {
   ESP_LOGI(TAG, "registerBridgedHomeKitAccessory");
 
-  this->createAccessory();
-  this->addGarageDoorOpenerService();
-  this->addFirmwareUpgradeService();
-  /* Add the Accessory to the HomeKit Database */
-  hap_add_bridged_accessory(this->accessory, hap_get_unique_aid(kSetupID));
-}
-
-void GarageRemote::createAccessory() {
-  /* Initialise the mandatory parameters for Accessory which will be added as
-   * the mandatory services internally
-   */
-  hap_acc_cfg_t config = {
-    .name = (char*)"Garage",
-    .model = (char*)"Model",
-    .manufacturer = (char*)"Yuji Nakayama",
-    .serial_num = (char*)"Serial Number",
-    .fw_rev = (char*)"Firmware Version",
-    .hw_rev = NULL,
-    .pv = (char*)"1.1.0",
-    .cid = HAP_CID_GARAGE_DOOR_OPENER,
-    .identify_routine = identifyAccessory,
+  static const ServiceDefinition<GarageRemote> kServiceDefinitions[] = {
+    defineService(&GarageRemote::createGarageDoorOpenerService, kServiceName, kGarageDoorOpenerServiceHandlers),
   };
 
-  /* Create accessory object */
-  this->accessory = hap_acc_create(&config);
-
-  /* Add a dummy Product Data */
-  uint8_t product_data[] = {'E','S','P','3','2','H','A','P'};
-  hap_acc_add_product_data(accessory, product_data, sizeof(product_data));
+  this->accessory = createAccessory(this, kAccessoryDefinition, kServiceDefinitions);
+  addBridgedAccessory(this->accessory, kAccessoryDefinition);
 }
 
-void GarageRemote::addGarageDoorOpenerService() {
-  /* Create the Fan Service. Include the "name" since this is a user visible service  */
+hap_serv_t* GarageRemote::createGarageDoorOpenerService() {
+  /* Create the Garage Door Opener Service */
   hap_serv_t* service = hap_serv_garage_door_opener_create(this->currentDoorState, this->targetDoorState, false);
-
-  hap_serv_add_char(service, hap_char_name_create(strdup(kServiceName)));
-
-  /* Set the write callback for the service */
-  hap_serv_set_write_cb(service, writeTargetDoorState);
-
-  /* Set the read callback for the service (optional) */
-  hap_serv_set_read_cb(service, readCharacteristic);
-
-  // Allow access to GarageRemote instance from the read/write callbals
-  hap_serv_set_priv(service, this);
-
-  /* Add the Fan Service to the Accessory Object */
-  hap_acc_add_serv(this->accessory, service);
-}
-
-/* Create the Firmware Upgrade HomeKit Custom Service.
- * Please refer the FW Upgrade documentation under components/homekit/extras/include/hap_fw_upgrade.h
- * and the top level README for more information.
- */
-void GarageRemote::addFirmwareUpgradeService() {
-  /*  Required for server verification during OTA, PEM format as string  */
-  char server_cert[] = {};
-
-  hap_fw_upgrade_config_t ota_config = {
-    .server_cert_pem = server_cert,
-  };
-
-  hap_serv_t* service = hap_serv_fw_upgrade_create(&ota_config);
-
-  /* Add the service to the Accessory Object */
-  hap_acc_add_serv(accessory, service);
+  this->currentDoorStateCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_CURRENT_DOOR_STATE);
+  this->targetDoorStateCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_TARGET_DOOR_STATE);
+  return service;
 }
 
 TargetDoorState GarageRemote::getTargetDoorState() {
@@ -116,7 +115,11 @@ void GarageRemote::setTargetDoorState(TargetDoorState state) {
 
   switch (state) {
   case TargetDoorStateOpen:
-    this->open();
+    if (this->open()) {
+      this->startOpeningDoor();
+    } else {
+      ESP_LOGW(TAG, "Ignored since the remote is already being pressed");
+    }
     break;
   case TargetDoorStateClosed:
     // We cannot close the garage by ourselves; it closes automatically/
@@ -130,107 +133,178 @@ CurrentDoorState GarageRemote::getCurrentDoorState() {
   return state;
 }
 
-void GarageRemote::open() {
+// This returns as soon as the waveforms are queued to the RMT peripheral
+bool GarageRemote::open() {
   ESP_LOGD(TAG, "open");
 
-  gpio_set_level(this->powerButtonPin, 1);
-  delay(100);
-  gpio_set_level(this->powerButtonPin, 0);
-
-  delay(100);
+  if (this->powerButtonOutput->isBusy() || this->openButtonOutput->isBusy()) {
+    return false;
+  }
 
-  gpio_set_level(this->openButtonPin, 1);
-  performLater(3000, _turnOffOpenButton, this);
+  // Both waveforms start at the same time within a few microseconds
+  return this->powerButtonOutput->write(kPowerButtonSegments, PULSE_SEGMENT_COUNT(kPowerButtonSegments))
+    && this->openButtonOutput->write(kOpenButtonSegments, PULSE_SEGMENT_COUNT(kOpenButtonSegments));
 }
 
-void GarageRemote::turnOffOpenButton() {
-  ESP_LOGD(TAG, "turnOffOpenButton");
-  gpio_set_level(this->openButtonPin, 0);
-}
+// Opening -> Open -> (auto close) -> Closing -> Closed
+void GarageRemote::startOpeningDoor() {
+  portENTER_CRITICAL(&this->doorStateMux);
 
-static void _turnOffOpenButton(void* arg) {
-  GarageRemote* garageRemote = (GarageRemote*)arg;
-  garageRemote->turnOffOpenButton();
-}
+  uint32_t generation = ++this->doorStateGeneration;
+  ScheduledCallbackHandle handle = this->doorStateTransitionHandle;
+  DoorStateTransition* transition = this->doorStateTransition;
+  this->doorStateTransitionHandle = 0;
+  this->doorStateTransition = NULL;
+
+  bool isOpen = this->currentDoorState == CurrentDoorStateOpen;
+  if (!isOpen) {
+    this->currentDoorState = CurrentDoorStateOpening;
+    this->targetDoorState = TargetDoorStateOpen;
+  }
+
+  portEXIT_CRITICAL(&this->doorStateMux);
+
+  this->cancelDoorStateTransition(handle, transition);
+
+  if (isOpen) {
+    // Pressing the remote while open restarts the auto close timer
+    this->scheduleDoorStateTransition(generation, this->autoCloseMillis);
+    return;
+  }
 
-/* Mandatory identify routine for the accessory.
- * In a real accessory, something like LED blink should be implemented
- * got visual identification
- */
-static int identifyAccessory(hap_acc_t* ha) {
-  ESP_LOGI(TAG, "Accessory identified");
-  return HAP_SUCCESS;
+  if (this->scheduleDoorStateTransition(generation, this->doorTravelMillis)) {
+    this->notifyDoorStates(CurrentDoorStateOpening, TargetDoorStateOpen);
+  }
 }
 
-static int readCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv) {
-  const char* characteristicUUID = hap_char_get_type_uuid(hc);
-  ESP_LOGD(TAG, "readCharacteristic: %s", characteristicUUID);
+// Invoked in the esp_timer task by the scheduler
+void GarageRemote::advanceDoorState(const DoorStateTransition* transition) {
+  uint32_t nextTransitionMillis = 0;
 
-  int entireResult = HAP_SUCCESS;
+  portENTER_CRITICAL(&this->doorStateMux);
+
+  // The state has changed after this was scheduled, and cancelling it was too late
+  if (transition->generation != this->doorStateGeneration) {
+    portEXIT_CRITICAL(&this->doorStateMux);
+    ESP_LOGD(TAG, "Ignored a stale door state transition");
+    return;
+  }
 
-  GarageRemote* garageRemote = (GarageRemote*)serv_priv;
-  hap_val_t value;
+  uint32_t generation = ++this->doorStateGeneration;
+  this->doorStateTransitionHandle = 0;
+  this->doorStateTransition = NULL;
 
-  if (strcmp(characteristicUUID, HAP_CHAR_UUID_TARGET_DOOR_STATE) == 0) {
-    value.u = garageRemote->getTargetDoorState();
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_CURRENT_DOOR_STATE) == 0) {
-    value.u = garageRemote->getCurrentDoorState();
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_OBSTRUCTION_DETECTED) == 0) {
-    value.b = false;
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_NAME) == 0) {
-    value.s = strdup(kServiceName);
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else {
-    ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-    *status_code = HAP_STATUS_RES_ABSENT;
-    entireResult = HAP_FAIL;
+  switch (this->currentDoorState) {
+  case CurrentDoorStateOpening:
+    this->currentDoorState = CurrentDoorStateOpen;
+    nextTransitionMillis = this->autoCloseMillis;
+    break;
+  case CurrentDoorStateOpen:
+    this->currentDoorState = CurrentDoorStateClosing;
+    this->targetDoorState = TargetDoorStateClosed;
+    nextTransitionMillis = this->doorTravelMillis;
+    break;
+  case CurrentDoorStateClosing:
+    this->currentDoorState = CurrentDoorStateClosed;
+    break;
+  default:
+    break;
+  }
+
+  CurrentDoorState currentState = this->currentDoorState;
+  TargetDoorState targetState = this->targetDoorState;
+
+  portEXIT_CRITICAL(&this->doorStateMux);
+
+  if (nextTransitionMillis > 0 && !this->scheduleDoorStateTransition(generation, nextTransitionMillis)) {
+    return;
   }
 
-  return entireResult;
+  ESP_LOGI(TAG, "Estimated door state: %i", currentState);
+  this->notifyDoorStates(currentState, targetState);
 }
 
-static int writeTargetDoorState(hap_write_data_t write_data[], int count, void* serv_priv, void* write_priv) {
-  int entireResult = HAP_SUCCESS;
-  GarageRemote *garageRemote = (GarageRemote *)serv_priv;
+// Returns false and falls back to Closed if the transition cannot be scheduled,
+// since the estimated state would be stuck otherwise
+bool GarageRemote::scheduleDoorStateTransition(uint32_t generation, uint32_t delayMillis) {
+  DoorStateTransition* transition = new DoorStateTransition;
+  transition->garageRemote = this;
+  transition->generation = generation;
+
+  ScheduledCallbackHandle handle = scheduleCallback(delayMillis, _advanceDoorState, transition);
+  if (handle == 0) {
+    delete transition;
+    ESP_LOGE(TAG, "Failed to schedule the door state transition; assuming the door is closed");
+    this->fallBackToClosedDoor(generation);
+    return false;
+  }
 
-  for (int i = 0; i < count; i++) {
-    hap_write_data_t *data = &write_data[i];
-    const char* characteristicUUID = hap_char_get_type_uuid(data->hc);
+  portENTER_CRITICAL(&this->doorStateMux);
 
-    if (strcmp(characteristicUUID, HAP_CHAR_UUID_TARGET_DOOR_STATE) == 0) {
-      TargetDoorState state = (TargetDoorState)data->val.u;
-      garageRemote->setTargetDoorState(state);
-      *(data->status) = HAP_STATUS_SUCCESS;
-    } else {
-      ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-      *(data->status) = HAP_STATUS_RES_ABSENT;
-      entireResult = HAP_FAIL;
-    }
+  // Otherwise the transition is already stale and ignores itself
+  if (this->doorStateGeneration == generation) {
+    this->doorStateTransitionHandle = handle;
+    this->doorStateTransition = transition;
   }
 
-  return entireResult;
+  portEXIT_CRITICAL(&this->doorStateMux);
+
+  return true;
 }
 
-static void performLater(uint32_t milliseconds, callback_with_arg_t callback, void* arg) {
-  esp_timer_create_args_t config = {
-    .callback = callback,
-    .arg = reinterpret_cast<void*>(arg),
-    .dispatch_method = ESP_TIMER_TASK,
-    .name = "Ticker",
-  };
+// The transition is freed by the callback if it's too late to cancel
+void GarageRemote::cancelDoorStateTransition(ScheduledCallbackHandle handle, DoorStateTransition* transition) {
+  if (cancelScheduledCallback(handle)) {
+    delete transition;
+  }
+}
+
+void GarageRemote::fallBackToClosedDoor(uint32_t generation) {
+  portENTER_CRITICAL(&this->doorStateMux);
 
-  if (timer) {
-    esp_timer_stop(timer);
-    esp_timer_delete(timer);
+  if (this->doorStateGeneration != generation) {
+    portEXIT_CRITICAL(&this->doorStateMux);
+    return;
   }
 
-  esp_timer_create(&config, &timer);
-  esp_timer_start_once(timer, milliseconds * 1000ULL);
+  this->doorStateGeneration++;
+  this->currentDoorState = CurrentDoorStateClosed;
+  this->targetDoorState = TargetDoorStateClosed;
+
+  portEXIT_CRITICAL(&this->doorStateMux);
+
+  this->notifyDoorStates(CurrentDoorStateClosed, TargetDoorStateClosed);
+}
+
+// Push the states so that controllers don't need to poll them
+void GarageRemote::notifyDoorStates(CurrentDoorState currentState, TargetDoorState targetState) {
+  notifyCharacteristicValueImmediately(this->currentDoorStateCharacteristic, (uint32_t)currentState);
+  notifyCharacteristicValueImmediately(this->targetDoorStateCharacteristic, (uint32_t)targetState);
+}
+
+static void _advanceDoorState(void* arg) {
+  DoorStateTransition* transition = (DoorStateTransition*)arg;
+  transition->garageRemote->advanceDoorState(transition);
+  delete transition;
+}
+
+static hap_status_t readTargetDoorState(GarageRemote* garageRemote, hap_char_t* hc) {
+  updateCharacteristicValue(hc, (uint32_t)garageRemote->getTargetDoorState());
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t readCurrentDoorState(GarageRemote* garageRemote, hap_char_t* hc) {
+  updateCharacteristicValue(hc, (uint32_t)garageRemote->getCurrentDoorState());
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t readObstructionDetected(GarageRemote* garageRemote, hap_char_t* hc) {
+  updateCharacteristicValue(hc, false);
+  return HAP_STATUS_SUCCESS;
+}
+
+static hap_status_t writeTargetDoorState(GarageRemote* garageRemote, hap_write_data_t* data) {
+  TargetDoorState state = (TargetDoorState)data->val.u;
+  garageRemote->setTargetDoorState(state);
+  return HAP_STATUS_SUCCESS;
 }
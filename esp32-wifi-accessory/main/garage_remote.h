@@ -1,7 +1,10 @@
 #pragma once
 
 #include <hap.h>
+#include <freertos/FreeRTOS.h>
 #include <driver/gpio.h>
+#include <scheduler.h>
+#include "pulse_output.h"
 
 typedef enum {
   CurrentDoorStateOpen = 0,
@@ -16,14 +19,22 @@ typedef enum {
   TargetDoorStateClosed
 } TargetDoorState;
 
+struct DoorStateTransition;
+
 class GarageRemote {
 public:
   gpio_num_t powerButtonPin;
   gpio_num_t openButtonPin;
+  PulseOutput* powerButtonOutput;
+  PulseOutput* openButtonOutput;
   hap_acc_t* accessory;
   TargetDoorState targetDoorState;
   CurrentDoorState currentDoorState;
 
+  // The door state is not sensed but estimated with these durations
+  uint32_t doorTravelMillis;
+  uint32_t autoCloseMillis; // From fully opened to starting closing
+
   GarageRemote(gpio_num_t powerButtonPin, gpio_num_t openButtonPin);
   void registerBridgedHomeKitAccessory();
 
@@ -32,11 +43,22 @@ public:
 
   CurrentDoorState getCurrentDoorState();
 
-  void turnOffOpenButton();
+  void advanceDoorState(const DoorStateTransition* transition);
 
 private:
-  void createAccessory();
-  void addGarageDoorOpenerService();
-  void addFirmwareUpgradeService();
-  void open();
+  hap_char_t* currentDoorStateCharacteristic;
+  hap_char_t* targetDoorStateCharacteristic;
+  portMUX_TYPE doorStateMux;
+  // Incremented by every door state change so that transitions scheduled before it are ignored
+  uint32_t doorStateGeneration;
+  ScheduledCallbackHandle doorStateTransitionHandle;
+  DoorStateTransition* doorStateTransition;
+
+  hap_serv_t* createGarageDoorOpenerService();
+  bool open();
+  void startOpeningDoor();
+  bool scheduleDoorStateTransition(uint32_t generation, uint32_t delayMillis);
+  void cancelDoorStateTransition(ScheduledCallbackHandle handle, DoorStateTransition* transition);
+  void fallBackToClosedDoor(uint32_t generation);
+  void notifyDoorStates(CurrentDoorState currentState, TargetDoorState targetState);
 };
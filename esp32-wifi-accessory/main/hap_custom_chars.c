@@ -54,3 +54,61 @@ hap_char_t *hap_char_current_temperature_with_negative_value_create(float curr_t
 
     return hc;
 }
+
+hap_char_t *hap_char_air_pressure_tendency_create(float tendency)
+{
+    hap_char_t *hc = hap_char_float_create(HAP_CHAR_UUID_AIR_PRESSURE_TENDENCY,
+                                           HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV, tendency);
+    if (!hc) {
+        return NULL;
+    }
+
+    // -100 - 100 hPa / 3h
+    hap_char_float_set_constraints(hc, -10000, 10000, 1);
+    hap_char_add_unit(hc, HAP_CHAR_UNIT_PASCALS);
+
+    return hc;
+}
+
+hap_char_t *hap_char_dew_point_create(float dew_point)
+{
+    hap_char_t *hc = hap_char_float_create(HAP_CHAR_UUID_DEW_POINT,
+                                           HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV, dew_point);
+    if (!hc) {
+        return NULL;
+    }
+
+    hap_char_float_set_constraints(hc, -100.0, 100.0, 0.1);
+    hap_char_add_unit(hc, HAP_CHAR_UNIT_CELSIUS);
+
+    return hc;
+}
+
+hap_char_t *hap_char_altitude_change_create(float altitude_change)
+{
+    hap_char_t *hc = hap_char_float_create(HAP_CHAR_UUID_ALTITUDE_CHANGE,
+                                           HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV, altitude_change);
+    if (!hc) {
+        return NULL;
+    }
+
+    hap_char_float_set_constraints(hc, -10000, 10000, 1);
+    hap_char_add_unit(hc, HAP_CHAR_UNIT_METERS);
+
+    return hc;
+}
+
+hap_char_t *hap_char_air_pressure_range_create(float range)
+{
+    hap_char_t *hc = hap_char_float_create(HAP_CHAR_UUID_AIR_PRESSURE_RANGE,
+                                           HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV, range);
+    if (!hc) {
+        return NULL;
+    }
+
+    // 0 - 100 hPa
+    hap_char_float_set_constraints(hc, 0, 10000, 1);
+    hap_char_add_unit(hc, HAP_CHAR_UNIT_PASCALS);
+
+    return hc;
+}
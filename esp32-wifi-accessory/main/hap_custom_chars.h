@@ -11,9 +11,14 @@ extern "C" {
 #endif
 
 #define HAP_CHAR_UNIT_PASCALS "pascals"
+#define HAP_CHAR_UNIT_METERS "meters"
 
 // https://github.com/apple/HomeKitADK/blob/fb201f98f5fdc7fef6a455054f08b59cca5d1ec8/HAP/HAPUUID.h#L27-L28
 #define HAP_CHAR_UUID_CURRENT_AIR_PRESSURE "00000001-3420-4EDC-90D1-E326457409CF"
+#define HAP_CHAR_UUID_AIR_PRESSURE_TENDENCY "00000002-3420-4EDC-90D1-E326457409CF"
+#define HAP_CHAR_UUID_DEW_POINT "00000003-3420-4EDC-90D1-E326457409CF"
+#define HAP_CHAR_UUID_ALTITUDE_CHANGE "00000004-3420-4EDC-90D1-E326457409CF"
+#define HAP_CHAR_UUID_AIR_PRESSURE_RANGE "00000005-3420-4EDC-90D1-E326457409CF"
 
 /** Current Air Pressure Characteristic
  *
@@ -39,6 +44,48 @@ hap_char_t *hap_char_current_air_pressure_create(float curr_pressure);
  */
 hap_char_t *hap_char_current_temperature_with_negative_value_create(float curr_temp);
 
+/** Air Pressure Tendency Characteristic
+ *
+ * Change of the air pressure in pascals per 3 hours (positive: rising, negative: falling)
+ *
+ * @param[in] tendency Initial value of air pressure tendency characteristic
+ *
+ * @return Pointer to the characteristic object on success
+ * @return NULL on failure
+ */
+hap_char_t *hap_char_air_pressure_tendency_create(float tendency);
+
+/** Dew Point Characteristic
+ *
+ * @param[in] dew_point Initial value of dew point characteristic in celsius
+ *
+ * @return Pointer to the characteristic object on success
+ * @return NULL on failure
+ */
+hap_char_t *hap_char_dew_point_create(float dew_point);
+
+/** Altitude Change Characteristic
+ *
+ * Altitude change in meters estimated from the air pressure change since the boot
+ *
+ * @param[in] altitude_change Initial value of altitude change characteristic
+ *
+ * @return Pointer to the characteristic object on success
+ * @return NULL on failure
+ */
+hap_char_t *hap_char_altitude_change_create(float altitude_change);
+
+/** Air Pressure Range Characteristic
+ *
+ * Difference between the highest and the lowest air pressure in pascals over the last 3 hours
+ *
+ * @param[in] range Initial value of air pressure range characteristic
+ *
+ * @return Pointer to the characteristic object on success
+ * @return NULL on failure
+ */
+hap_char_t *hap_char_air_pressure_range_create(float range);
+
 #ifdef __cplusplus
 }
 #endif
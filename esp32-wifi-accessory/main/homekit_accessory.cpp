@@ -0,0 +1,66 @@
+#include "log_config.h"
+#include "homekit_accessory.h"
+
+#include <hap_fw_upgrade.h>
+
+static const char* TAG = "HomeKitAccessory";
+
+/* Mandatory identify routine for the accessory.
+ * In a real accessory, something like LED blink should be implemented
+ * got visual identification
+ */
+static int identifyAccessory(hap_acc_t* ha) {
+  ESP_LOGI(TAG, "Accessory identified");
+  return HAP_SUCCESS;
+}
+
+hap_acc_t* createAccessoryObject(const AccessoryDefinition& definition) {
+  /* Initialise the mandatory parameters for Accessory which will be added as
+   * the mandatory services internally
+   */
+  hap_acc_cfg_t config = {
+    .name = (char*)definition.name,
+    .model = (char*)"Model",
+    .manufacturer = (char*)"Yuji Nakayama",
+    .serial_num = (char*)"Serial Number",
+    .fw_rev = (char*)"Firmware Version",
+    .hw_rev = NULL,
+    .pv = (char*)definition.protocolVersion,
+    .cid = definition.category,
+    .identify_routine = identifyAccessory,
+  };
+
+  /* Create accessory object */
+  hap_acc_t* accessory = hap_acc_create(&config);
+
+  /* Add a dummy Product Data */
+  uint8_t product_data[] = {'E','S','P','3','2','H','A','P'};
+  hap_acc_add_product_data(accessory, product_data, sizeof(product_data));
+
+  return accessory;
+}
+
+/* Create the Firmware Upgrade HomeKit Custom Service.
+ * Please refer the FW Upgrade documentation under components/homekit/extras/include/hap_fw_upgrade.h
+ * and the top level README for more information.
+ */
+void addFirmwareUpgradeService(hap_acc_t* accessory) {
+  /*  Required for server verification during OTA, PEM format as string  */
+  char server_cert[] = {};
+
+  hap_fw_upgrade_config_t ota_config = {
+    .server_cert_pem = server_cert,
+  };
+
+  hap_serv_t* service = hap_serv_fw_upgrade_create(&ota_config);
+
+  /* Add the service to the Accessory Object */
+  hap_acc_add_serv(accessory, service);
+}
+
+void addBridgedAccessory(hap_acc_t* accessory, const AccessoryDefinition& definition) {
+  ESP_LOGI(TAG, "Adding bridged accessory %s", definition.name);
+
+  /* Add the Accessory to the HomeKit Database */
+  hap_add_bridged_accessory(accessory, hap_get_unique_aid(definition.setupID));
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <hap.h>
+#include <stddef.h>
+#include "characteristic_dispatch.h"
+#include "notification_batcher.h"
+
+extern "C" {
+  #include "util.h"
+}
+
+// Declarative accessory registration shared by the accessories.
+// Everything is resolved at compile time with templates; no virtual functions or RTTI.
+
+typedef struct {
+  const char* name;
+  const char* protocolVersion;
+  hap_cid_t category;
+  const char* setupID; // This must be unique
+} AccessoryDefinition;
+
+template <typename Owner>
+struct ServiceDefinition {
+  // Creates the service with the initial values, and keeps the characteristics in the owner if needed.
+  // The Name characteristic and the read/write callbacks are set by the framework.
+  hap_serv_t* (Owner::*create)();
+  const char* name; // NULL for services without a Name characteristic
+  const CharacteristicHandler* handlers;
+  size_t handlerCount;
+};
+
+template <typename Owner, size_t HandlerCount>
+constexpr ServiceDefinition<Owner> defineService(hap_serv_t* (Owner::*create)(), const char* name, const CharacteristicHandler (&handlers)[HandlerCount]) {
+  return { create, name, handlers, HandlerCount };
+}
+
+// Typed trampolines for CharacteristicHandler so that handlers take the owner without casting void*
+template <typename Owner, hap_status_t (*Read)(Owner* owner, hap_char_t* hc)>
+hap_status_t readTrampoline(hap_char_t* hc, void* owner) {
+  return Read(static_cast<Owner*>(owner), hc);
+}
+
+template <typename Owner, hap_status_t (*Write)(Owner* owner, hap_write_data_t* data)>
+hap_status_t writeTrampoline(hap_write_data_t* data, void* owner) {
+  return Write(static_cast<Owner*>(owner), data);
+}
+
+// Creates the accessory object with the common information and product data
+hap_acc_t* createAccessoryObject(const AccessoryDefinition& definition);
+void addFirmwareUpgradeService(hap_acc_t* accessory);
+
+// Creates the accessory with the services in order, followed by the Firmware Upgrade service
+template <typename Owner, size_t ServiceCount>
+hap_acc_t* createAccessory(Owner* owner, const AccessoryDefinition& definition, const ServiceDefinition<Owner> (&services)[ServiceCount]) {
+  hap_acc_t* accessory = createAccessoryObject(definition);
+
+  for (size_t i = 0; i < ServiceCount; i++) {
+    const ServiceDefinition<Owner>& serviceDefinition = services[i];
+    hap_serv_t* service = (owner->*serviceDefinition.create)();
+
+    if (serviceDefinition.name != NULL) {
+      hap_serv_add_char(service, hap_char_name_create(strdup(serviceDefinition.name)));
+    }
+
+    setCharacteristicHandlers(service, serviceDefinition.handlers, serviceDefinition.handlerCount, owner);
+    hap_acc_add_serv(accessory, service);
+  }
+
+  addFirmwareUpgradeService(accessory);
+
+  return accessory;
+}
+
+// Adds the accessory to the HomeKit database of the bridge
+void addBridgedAccessory(hap_acc_t* accessory, const AccessoryDefinition& definition);
+
+// Updates the value right away, e.g. in read callbacks
+inline void updateCharacteristicValue(hap_char_t* hc, bool value) {
+  hap_val_t hapValue;
+  hapValue.b = value;
+  hap_char_update_val(hc, &hapValue);
+}
+
+inline void updateCharacteristicValue(hap_char_t* hc, uint32_t value) {
+  hap_val_t hapValue;
+  hapValue.u = value;
+  hap_char_update_val(hc, &hapValue);
+}
+
+inline void updateCharacteristicValue(hap_char_t* hc, float value) {
+  hap_val_t hapValue;
+  hapValue.f = value;
+  hap_char_update_val(hc, &hapValue);
+}
+
+// Pushes a changed value to the subscribed controllers through the notification batcher
+inline void notifyCharacteristicValue(hap_char_t* hc, bool value) {
+  hap_val_t hapValue;
+  hapValue.b = value;
+  notifyCharacteristicValue(hc, &hapValue);
+}
+
+inline void notifyCharacteristicValue(hap_char_t* hc, uint32_t value) {
+  hap_val_t hapValue;
+  hapValue.u = value;
+  notifyCharacteristicValue(hc, &hapValue);
+}
+
+inline void notifyCharacteristicValue(hap_char_t* hc, float value) {
+  hap_val_t hapValue;
+  hapValue.f = value;
+  notifyCharacteristicValue(hc, &hapValue);
+}
+
+inline void notifyCharacteristicValueImmediately(hap_char_t* hc, uint32_t value) {
+  hap_val_t hapValue;
+  hapValue.u = value;
+  notifyCharacteristicValueImmediately(hc, &hapValue);
+}
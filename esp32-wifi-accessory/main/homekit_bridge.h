@@ -11,6 +11,5 @@ public:
   void printSetupQRCode();
 
 private:
-  void createAccessory();
   void configureHomeKitSetupCode();
 };
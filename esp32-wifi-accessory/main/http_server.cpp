@@ -2,23 +2,171 @@
 #include "http_server.h"
 
 #include <esp_http_server.h>
+#include <deferred_log.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 static const char* TAG = "HTTPServer";
 
 static const char* kDoorsLockPath = "/doors/lock";
+static const char* kLogLevelPath = "/log/level";
+static const char* kWeatherHistoryPath = "/weather/history";
+static const char* kWeatherCurrentPath = "/weather/current";
+
+static const size_t kWeatherHistoryQueryBatchSize = 32;
+// Clients polling the current values are expected to come back within this period
+static const uint32_t kHTTPClientDemandMillis = 60 * 1000;
 
 static esp_err_t doorsLockHandler(httpd_req_t* request) {
   ESP_LOGI(TAG, "POST %s", kDoorsLockPath);
 
   CarSmartKey* smartKey = (CarSmartKey*)request->user_ctx;
-  smartKey->lockDoors();
+
+  // This returns immediately without waiting for the actuation
+  if (!smartKey->lockDoors()) {
+    httpd_resp_set_status(request, "503 Service Unavailable");
+    httpd_resp_send(request, "Busy", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+
+  const char response[] = "OK";
+  httpd_resp_send(request, response, HTTPD_RESP_USE_STRLEN);
+  return ESP_OK;
+}
+
+// PUT /log/level?level=4 changes the deferred log level (0: none - 5: verbose) without reflashing
+static esp_err_t logLevelHandler(httpd_req_t* request) {
+  ESP_LOGI(TAG, "PUT %s", kLogLevelPath);
+
+  char query[32];
+  char levelString[4];
+
+  if (httpd_req_get_url_query_str(request, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "level", levelString, sizeof(levelString)) != ESP_OK) {
+    httpd_resp_send_err(request, HTTPD_400_BAD_REQUEST, "level is required");
+    return ESP_FAIL;
+  }
+
+  // atoi() would take non-numeric input as 0, which silently disables logging
+  char* end = NULL;
+  long level = strtol(levelString, &end, 10);
+
+  if (end == levelString || *end != '\0' || level < ESP_LOG_NONE || level > ESP_LOG_VERBOSE) {
+    httpd_resp_send_err(request, HTTPD_400_BAD_REQUEST, "level must be 0-5");
+    return ESP_FAIL;
+  }
+
+  setDeferredLogLevel((esp_log_level_t)level);
 
   const char response[] = "OK";
   httpd_resp_send(request, response, HTTPD_RESP_USE_STRLEN);
   return ESP_OK;
 }
 
-void startHTTPServer(uint16_t port, CarSmartKey* smartKey) {
+static uint32_t getQueryUInt32(const char* query, const char* key, uint32_t defaultValue) {
+  char valueString[12];
+
+  if (httpd_query_key_value(query, key, valueString, sizeof(valueString)) != ESP_OK) {
+    return defaultValue;
+  }
+
+  return strtoul(valueString, NULL, 10);
+}
+
+// GET /weather/history?tier=1&from=0&to=3600 returns CSV of the samples in the range.
+// tier is 0: 1 second, 1: 1 minute or 2: 15 minutes, and from/to are in seconds since boot.
+static esp_err_t weatherHistoryHandler(httpd_req_t* request) {
+  ESP_LOGI(TAG, "GET %s", kWeatherHistoryPath);
+
+  WeatherSensor* sensor = (WeatherSensor*)request->user_ctx;
+
+  if (sensor == NULL || !sensor->isFound()) {
+    httpd_resp_send_err(request, HTTPD_404_NOT_FOUND, "Weather sensor is not available");
+    return ESP_FAIL;
+  }
+
+  // The client is likely to poll the current values next
+  sensor->requestFastSampling(kHTTPClientDemandMillis);
+
+  WeatherHistory* history = sensor->history;
+
+  char query[64] = "";
+  httpd_req_get_url_query_str(request, query, sizeof(query));
+
+  uint32_t tier = getQueryUInt32(query, "tier", WeatherHistoryTierMinute);
+  uint32_t fromTime = getQueryUInt32(query, "from", 0);
+  uint32_t toTime = getQueryUInt32(query, "to", UINT32_MAX);
+
+  if (tier >= WeatherHistoryTierCount) {
+    httpd_resp_send_err(request, HTTPD_400_BAD_REQUEST, "tier must be 0-2");
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(request, "text/csv");
+  httpd_resp_send_chunk(request, "time,temperature,humidity,pressure\n", HTTPD_RESP_USE_STRLEN);
+
+  WeatherHistorySample samples[kWeatherHistoryQueryBatchSize];
+  char line[64];
+
+  while (true) {
+    size_t count = history->query((WeatherHistoryTier)tier, fromTime, toTime, samples, kWeatherHistoryQueryBatchSize);
+    if (count == 0) {
+      break;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      WeatherHistorySample* sample = &samples[i];
+      snprintf(
+        line,
+        sizeof(line),
+        "%u,%.2f,%.2f,%.1f\n",
+        sample->time,
+        sample->values[WeatherHistoryValueTemperature] / 100.0,
+        sample->values[WeatherHistoryValueHumidity] / 1024.0,
+        (uint32_t)sample->values[WeatherHistoryValuePressure] / 256.0
+      );
+      httpd_resp_send_chunk(request, line, HTTPD_RESP_USE_STRLEN);
+    }
+
+    fromTime = samples[count - 1].time + 1;
+  }
+
+  httpd_resp_send_chunk(request, NULL, 0);
+  return ESP_OK;
+}
+
+// GET /weather/current returns CSV of the latest sample,
+// and keeps the sensor sampled at the fast rate while the client keeps polling.
+static esp_err_t weatherCurrentHandler(httpd_req_t* request) {
+  ESP_LOGD(TAG, "GET %s", kWeatherCurrentPath);
+
+  WeatherSensor* sensor = (WeatherSensor*)request->user_ctx;
+
+  if (sensor == NULL || !sensor->isFound()) {
+    httpd_resp_send_err(request, HTTPD_404_NOT_FOUND, "Weather sensor is not available");
+    return ESP_FAIL;
+  }
+
+  sensor->requestFastSampling(kHTTPClientDemandMillis);
+
+  SensorData data = sensor->getSensorData();
+  char body[96];
+  snprintf(
+    body,
+    sizeof(body),
+    "time,temperature,humidity,pressure\n%lu,%.2f,%.2f,%.1f\n",
+    data.time / 1000,
+    data.temperature / 100.0,
+    data.humidity / 1024.0,
+    data.pressure / 256.0
+  );
+
+  httpd_resp_set_type(request, "text/csv");
+  httpd_resp_send(request, body, HTTPD_RESP_USE_STRLEN);
+  return ESP_OK;
+}
+
+void startHTTPServer(uint16_t port, CarSmartKey* smartKey, WeatherSensor* weatherSensor) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = port;
 
@@ -33,6 +181,30 @@ void startHTTPServer(uint16_t port, CarSmartKey* smartKey) {
         };
         httpd_register_uri_handler(server, &doorsLockEndpoint);
 
+        httpd_uri_t logLevelEndpoint = {
+          .uri      = kLogLevelPath,
+          .method = HTTP_PUT,
+          .handler  = logLevelHandler,
+          .user_ctx = NULL,
+        };
+        httpd_register_uri_handler(server, &logLevelEndpoint);
+
+        httpd_uri_t weatherHistoryEndpoint = {
+          .uri      = kWeatherHistoryPath,
+          .method = HTTP_GET,
+          .handler  = weatherHistoryHandler,
+          .user_ctx = weatherSensor,
+        };
+        httpd_register_uri_handler(server, &weatherHistoryEndpoint);
+
+        httpd_uri_t weatherCurrentEndpoint = {
+          .uri      = kWeatherCurrentPath,
+          .method = HTTP_GET,
+          .handler  = weatherCurrentHandler,
+          .user_ctx = weatherSensor,
+        };
+        httpd_register_uri_handler(server, &weatherCurrentEndpoint);
+
         ESP_LOGI(TAG, "HTTP server running on port %d", port);
     }
 }
@@ -1,5 +1,7 @@
 #pragma once
 
 #include "car_smart_key.h"
+#include "weather_sensor.h"
 
-void startHTTPServer(uint16_t port, CarSmartKey* smartKey);
+// The weather endpoints respond 404 until weatherSensor is found
+void startHTTPServer(uint16_t port, CarSmartKey* smartKey, WeatherSensor* weatherSensor);
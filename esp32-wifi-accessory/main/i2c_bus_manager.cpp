@@ -0,0 +1,160 @@
+#include "log_config.h"
+#include "i2c_bus_manager.h"
+
+#include <cstring>
+#include <esp_timer.h>
+
+static const char* TAG = "I2CBusManager";
+
+static void _processTransactions(void* arg);
+
+I2CBusManager::I2CBusManager(i2c_port_t port) {
+  this->port = port;
+  memset(this->deviceStatistics, 0, sizeof(this->deviceStatistics));
+  this->deviceCount = 0;
+  this->startMicros = esp_timer_get_time();
+
+  ESP_ERROR_CHECK(i2cdev_init());
+
+  this->queue = xQueueCreate(kQueueLength, sizeof(I2CTransaction*));
+  xTaskCreate(_processTransactions, "I2CBusManager", 3 * 1024, this, tskIDLE_PRIORITY + 2, &this->task);
+}
+
+int I2CBusManager::registerDevice(i2c_dev_t* device, const char* name) {
+  if (this->deviceCount >= kMaxDeviceCount) {
+    ESP_LOGE(TAG, "Cannot register %s; too many devices", name);
+    return -1;
+  }
+
+  I2CDeviceStatistics* statistics = &this->deviceStatistics[this->deviceCount];
+  statistics->name = name;
+  statistics->device = device;
+
+  return this->deviceCount++;
+}
+
+bool I2CBusManager::submit(I2CTransaction* transaction) {
+  if (transaction->deviceIndex < 0 || transaction->deviceIndex >= (int)this->deviceCount) {
+    ESP_LOGE(TAG, "Invalid device index %d", transaction->deviceIndex);
+    return false;
+  }
+
+  transaction->enqueuedMicros = esp_timer_get_time();
+
+  if (xQueueSend(this->queue, &transaction, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "Queue is full; transaction for %s is rejected", this->deviceStatistics[transaction->deviceIndex].name);
+    return false;
+  }
+
+  return true;
+}
+
+// Waits on a semaphore of this transaction rather than the task notification,
+// which other tasks also give to the caller, e.g. to wake up the sampling task early.
+// Returning on such a notification would let the bus task write into a dead stack frame later.
+esp_err_t I2CBusManager::perform(I2CTransaction* transaction) {
+  StaticSemaphore_t completionBuffer;
+  transaction->completion = xSemaphoreCreateBinaryStatic(&completionBuffer);
+
+  if (!this->submit(transaction)) {
+    vSemaphoreDelete(transaction->completion);
+    return ESP_ERR_NO_MEM;
+  }
+
+  xSemaphoreTake(transaction->completion, portMAX_DELAY);
+  vSemaphoreDelete(transaction->completion);
+  return transaction->result;
+}
+
+void I2CBusManager::processTransactions() {
+  while (true) {
+    I2CTransaction* transaction;
+    xQueueReceive(this->queue, &transaction, portMAX_DELAY);
+
+    // Drain everything queued meanwhile back to back
+    do {
+      this->performTransaction(transaction);
+    } while (xQueueReceive(this->queue, &transaction, 0) == pdTRUE);
+  }
+}
+
+void I2CBusManager::performTransaction(I2CTransaction* transaction) {
+  I2CDeviceStatistics* statistics = &this->deviceStatistics[transaction->deviceIndex];
+  int64_t startMicros = esp_timer_get_time();
+
+  switch (transaction->type) {
+  case I2CTransactionTypeRead:
+    // The device mutex is taken as the drivers do
+    i2c_dev_take_mutex(statistics->device);
+    transaction->result = i2c_dev_read_reg(statistics->device, transaction->reg, transaction->buffer, transaction->size);
+    i2c_dev_give_mutex(statistics->device);
+    break;
+  case I2CTransactionTypeWrite:
+    i2c_dev_take_mutex(statistics->device);
+    transaction->result = i2c_dev_write_reg(statistics->device, transaction->reg, transaction->buffer, transaction->size);
+    i2c_dev_give_mutex(statistics->device);
+    break;
+  case I2CTransactionTypeCustom:
+    transaction->result = transaction->perform(transaction->context);
+    break;
+  default:
+    transaction->result = ESP_ERR_INVALID_ARG;
+    break;
+  }
+
+  int64_t endMicros = esp_timer_get_time();
+  uint32_t latencyMicros = endMicros - transaction->enqueuedMicros;
+
+  statistics->transactionCount++;
+  if (transaction->result != ESP_OK) {
+    statistics->errorCount++;
+  }
+  statistics->totalLatencyMicros += latencyMicros;
+  if (latencyMicros > statistics->maxLatencyMicros) {
+    statistics->maxLatencyMicros = latencyMicros;
+  }
+  statistics->busyMicros += endMicros - startMicros;
+
+  // The transaction may be freed by the submitter right after signaled, so copy what's needed first
+  I2CTransactionCallback callback = transaction->callback;
+  SemaphoreHandle_t completion = transaction->completion;
+
+  if (callback != NULL) {
+    callback(transaction);
+  }
+
+  if (completion != NULL) {
+    xSemaphoreGive(completion);
+  }
+}
+
+void I2CBusManager::logStatistics() {
+  uint64_t elapsedMicros = esp_timer_get_time() - this->startMicros;
+  uint64_t totalBusyMicros = 0;
+
+  for (size_t i = 0; i < this->deviceCount; i++) {
+    I2CDeviceStatistics* statistics = &this->deviceStatistics[i];
+    totalBusyMicros += statistics->busyMicros;
+
+    if (statistics->transactionCount == 0) {
+      continue;
+    }
+
+    ESP_LOGI(
+      TAG,
+      "%s: %u transactions, %u errors, latency average %u us, max %u us",
+      statistics->name,
+      statistics->transactionCount,
+      statistics->errorCount,
+      (uint32_t)(statistics->totalLatencyMicros / statistics->transactionCount),
+      statistics->maxLatencyMicros
+    );
+  }
+
+  ESP_LOGI(TAG, "Bus %d utilization: %u.%02u%%", this->port, (uint32_t)(totalBusyMicros * 100 / elapsedMicros), (uint32_t)(totalBusyMicros * 10000 / elapsedMicros % 100));
+}
+
+static void _processTransactions(void* arg) {
+  I2CBusManager* busManager = (I2CBusManager*)arg;
+  busManager->processTransactions();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <i2cdev.h>
+
+typedef enum {
+  I2CTransactionTypeRead = 0, // Read size bytes from the register into the buffer
+  I2CTransactionTypeWrite, // Write size bytes from the buffer to the register
+  I2CTransactionTypeCustom, // Call perform(), e.g. a driver function performing multiple accesses
+} I2CTransactionType;
+
+struct I2CTransaction;
+
+typedef void (*I2CTransactionCallback)(I2CTransaction* transaction);
+typedef esp_err_t (*I2CTransactionFunction)(void* context);
+
+// Descriptors are owned by the submitters and must live until the completion.
+struct I2CTransaction {
+  int deviceIndex; // Returned by I2CBusManager::registerDevice()
+  I2CTransactionType type;
+  uint8_t reg;
+  void* buffer;
+  size_t size;
+  I2CTransactionFunction perform;
+  void* context;
+
+  // Either or both of them are signaled on completion in the bus manager task
+  I2CTransactionCallback callback;
+  SemaphoreHandle_t completion; // Binary semaphore given once
+
+  // Filled by the bus manager
+  esp_err_t result;
+  int64_t enqueuedMicros;
+};
+
+typedef struct {
+  const char* name;
+  i2c_dev_t* device;
+  uint32_t transactionCount;
+  uint32_t errorCount;
+  uint64_t totalLatencyMicros; // From the submission to the completion
+  uint32_t maxLatencyMicros;
+  uint64_t busyMicros; // Time occupying the bus
+} I2CDeviceStatistics;
+
+// Owns an I2C port and performs transactions from any driver back to back in a single task,
+// so that multiple devices can share the bus without blocking each other's callers.
+class I2CBusManager {
+public:
+  static const size_t kMaxDeviceCount = 4;
+
+  i2c_port_t port;
+  I2CDeviceStatistics deviceStatistics[kMaxDeviceCount];
+  size_t deviceCount;
+
+  I2CBusManager(i2c_port_t port);
+
+  // Returns the device index for transactions, or -1 if there are too many devices
+  int registerDevice(i2c_dev_t* device, const char* name);
+
+  // Returns immediately; false if the queue is full
+  bool submit(I2CTransaction* transaction);
+  // Blocks the caller until the completion
+  esp_err_t perform(I2CTransaction* transaction);
+
+  void processTransactions();
+  void logStatistics();
+
+private:
+  static const size_t kQueueLength = 8;
+
+  QueueHandle_t queue;
+  TaskHandle_t task;
+  int64_t startMicros;
+
+  void performTransaction(I2CTransaction* transaction);
+};
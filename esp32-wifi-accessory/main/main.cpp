@@ -25,17 +25,40 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <driver/gpio.h>
+#include <deferred_log.h>
+#include <heap_monitor.h>
+#include <scheduler.h>
 
 #include "car_smart_key.h"
 #include "garage_remote.h"
 #include "homekit_bridge.h"
 #include "homekit.h"
 #include "http_server.h"
+#include "i2c_bus_manager.h"
 #include "log_config.h"
+#include "notification_batcher.h"
+#include "persistent_state.h"
 #include "util.h"
 #include "weather_sensor.h"
 #include "wifi.h"
 
+static const uint32_t kStatisticsLoggingIntervalMillis = 10 * 60 * 1000;
+
+// Updates pushed within this window are sent in a single event
+static const uint32_t kNotificationBatchWindowMillis = 50;
+
+// State changes within this delay are written to NVS with a single commit
+static const uint32_t kStateFlushDelayMillis = 2000;
+
+static PersistentStateStore* stateStore = NULL;
+
+static void _logStatistics(void* arg) {
+  logSchedulerStatistics();
+  logHeapStatistics();
+  logNotificationBatcherStatistics();
+  stateStore->logStatistics();
+}
+
 static void configureGPIOPins() {
   // Configure 12-15 GPIO pins since they cannot be used as output pins by default.
   // https://esp32.com/viewtopic.php?f=14&t=2687
@@ -56,6 +79,14 @@ static void mainTask(void *p) {
   // If you need to change log level of specific module,
   // call esp_log_level_set() with the TAG for the module.
   esp_log_level_set("*", LOG_LOCAL_LEVEL);
+  startDeferredLogging();
+  setDeferredLogLevel(LOG_LOCAL_LEVEL);
+
+  startHeapMonitor();
+
+  // This needs to be prior to any accessory initialization
+  startScheduler();
+  startNotificationBatcher(kNotificationBatchWindowMillis);
 
   configureGPIOPins();
 
@@ -67,21 +98,22 @@ static void mainTask(void *p) {
   /* Initialize the HAP core */
   hap_init(HAP_TRANSPORT_WIFI);
 
+  // This needs to be after hap_init(), which initializes NVS,
+  // and prior to the accessories, which restore their states from it
+  stateStore = new PersistentStateStore("accessories", kStateFlushDelayMillis);
+
   HomeKitBridge* bridge = new HomeKitBridge();
   bridge->registerHomeKitAccessory();
 
-  CarSmartKey* smartKey = new CarSmartKey(GPIO_NUM_14, GPIO_NUM_27, GPIO_NUM_26, GPIO_NUM_32);
+  CarSmartKey* smartKey = new CarSmartKey(stateStore, GPIO_NUM_14, GPIO_NUM_27, GPIO_NUM_26, GPIO_NUM_32);
   smartKey->registerBridgedHomeKitAccessory();
 
   GarageRemote* garageRemote = new GarageRemote(GPIO_NUM_13, GPIO_NUM_12);
   garageRemote->registerBridgedHomeKitAccessory();
 
-  WeatherSensor* weatherSensor = new WeatherSensor(GPIO_NUM_21, GPIO_NUM_22, 0);
-  // Do not crash even if the sensor is not found
-  if (weatherSensor->isFound()) {
-    weatherSensor->registerBridgedHomeKitAccessory();
-    weatherSensor->startMonitoringSensor();
-  }
+  I2CBusManager* i2cBusManager = new I2CBusManager(I2C_NUM_0);
+
+  WeatherSensor* weatherSensor = new WeatherSensor(stateStore, i2cBusManager, GPIO_NUM_21, GPIO_NUM_22, 0);
 
   startWiFiAccessPoint();
   /* After all the initializations are done, start the HAP core */
@@ -89,7 +121,13 @@ static void mainTask(void *p) {
 
   bridge->printSetupQRCode();
 
-  startHTTPServer(8888, smartKey);
+  // The accessory is registered when the sensor is found, which can be after a while or never
+  weatherSensor->startDiscovery();
+
+  startHTTPServer(8888, smartKey, weatherSensor);
+
+  // Live bytes growing over time indicate a leak; fragmentation growing indicates churn
+  scheduleRepeatingCallback(kStatisticsLoggingIntervalMillis, _logStatistics, NULL);
 
   /* The task ends here. The read/write callbacks will be invoked by the HAP Framework */
   vTaskDelete(NULL);
@@ -0,0 +1,168 @@
+#include "log_config.h"
+#include "notification_batcher.h"
+
+#include <cstring>
+#include <freertos/FreeRTOS.h>
+#include <scheduler.h>
+
+static const char* TAG = "NotificationBatcher";
+
+static const size_t kCapacity = 16;
+
+// "EVENT/1.0 200 OK", Content-Type and Content-Length headers, and {"characteristics":[]}
+static const uint32_t kEstimatedFrameOverheadBytes = 100;
+// The length prefix and the authentication tag of the session encryption
+static const uint32_t kEstimatedEncryptionOverheadBytes = 2 + 16;
+// {"aid":2,"iid":10,"value":21.5},
+static const uint32_t kEstimatedCharacteristicBytes = 32;
+
+typedef struct {
+  hap_char_t* hc;
+  hap_val_t value;
+} PendingUpdate;
+
+static PendingUpdate pendingUpdates[kCapacity];
+static size_t pendingUpdateCount = 0;
+static uint32_t flushWindowMillis = 0;
+static bool isStarted = false;
+static bool isFlushScheduled = false;
+static NotificationBatcherStatistics statistics;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void flush(void* arg);
+
+void startNotificationBatcher(uint32_t windowMillis) {
+  memset(&statistics, 0, sizeof(statistics));
+  flushWindowMillis = windowMillis;
+  isStarted = true;
+}
+
+void notifyCharacteristicValue(hap_char_t* hc, const hap_val_t* value) {
+  if (!isStarted) {
+    hap_char_update_val(hc, (hap_val_t*)value);
+    return;
+  }
+
+  bool isFull = false;
+  bool needsScheduling = false;
+
+  portENTER_CRITICAL(&mux);
+
+  statistics.updateCount++;
+
+  size_t index;
+  for (index = 0; index < pendingUpdateCount; index++) {
+    if (pendingUpdates[index].hc == hc) {
+      break;
+    }
+  }
+
+  if (index < pendingUpdateCount) {
+    // Only the latest value matters to the controllers
+    pendingUpdates[index].value = *value;
+    statistics.coalescedCount++;
+  } else {
+    pendingUpdates[pendingUpdateCount].hc = hc;
+    pendingUpdates[pendingUpdateCount].value = *value;
+    pendingUpdateCount++;
+  }
+
+  isFull = pendingUpdateCount == kCapacity;
+
+  if (!isFull && !isFlushScheduled) {
+    isFlushScheduled = true;
+    needsScheduling = true;
+  }
+
+  portEXIT_CRITICAL(&mux);
+
+  if (isFull) {
+    flush(NULL);
+  } else if (needsScheduling && scheduleCallback(flushWindowMillis, flush, NULL) == 0) {
+    // Never leave the updates pending
+    flush(NULL);
+  }
+}
+
+void notifyCharacteristicValueImmediately(hap_char_t* hc, const hap_val_t* value) {
+  if (isStarted) {
+    portENTER_CRITICAL(&mux);
+
+    statistics.updateCount++;
+    statistics.immediateCount++;
+
+    for (size_t i = 0; i < pendingUpdateCount; i++) {
+      if (pendingUpdates[i].hc == hc) {
+        pendingUpdates[i] = pendingUpdates[--pendingUpdateCount];
+        statistics.coalescedCount++;
+        break;
+      }
+    }
+
+    statistics.estimatedFrameCount++;
+    statistics.estimatedBatchedBytes +=
+      kEstimatedFrameOverheadBytes + kEstimatedEncryptionOverheadBytes + kEstimatedCharacteristicBytes;
+
+    portEXIT_CRITICAL(&mux);
+  }
+
+  hap_char_update_val(hc, (hap_val_t*)value);
+}
+
+// Invoked in the esp_timer task by the scheduler, or in the caller's task when the batch is full
+static void flush(void* arg) {
+  PendingUpdate updates[kCapacity];
+
+  portENTER_CRITICAL(&mux);
+
+  size_t count = pendingUpdateCount;
+  memcpy(updates, pendingUpdates, count * sizeof(PendingUpdate));
+  pendingUpdateCount = 0;
+  isFlushScheduled = false;
+
+  if (count > 0) {
+    statistics.estimatedFrameCount++;
+    if (count > statistics.maxBatchSize) {
+      statistics.maxBatchSize = count;
+    }
+
+    uint32_t frameOverheadBytes = kEstimatedFrameOverheadBytes + kEstimatedEncryptionOverheadBytes;
+    statistics.estimatedBatchedBytes += frameOverheadBytes + count * kEstimatedCharacteristicBytes;
+  }
+
+  portEXIT_CRITICAL(&mux);
+
+  for (size_t i = 0; i < count; i++) {
+    hap_char_update_val(updates[i].hc, &updates[i].value);
+  }
+}
+
+NotificationBatcherStatistics getNotificationBatcherStatistics() {
+  portENTER_CRITICAL(&mux);
+  NotificationBatcherStatistics snapshot = statistics;
+  portEXIT_CRITICAL(&mux);
+
+  // Coalesced updates would also have been sent without batching
+  uint32_t frameOverheadBytes = kEstimatedFrameOverheadBytes + kEstimatedEncryptionOverheadBytes;
+  snapshot.estimatedUnbatchedBytes = (uint64_t)snapshot.updateCount * (frameOverheadBytes + kEstimatedCharacteristicBytes);
+
+  return snapshot;
+}
+
+void logNotificationBatcherStatistics() {
+  NotificationBatcherStatistics snapshot = getNotificationBatcherStatistics();
+
+  ESP_LOGI(
+    TAG,
+    "updates: %u (coalesced %u, immediate %u, max %u per batch), "
+    "estimated per session: %u frames, %llu bytes (%u frames, %llu bytes without batching)",
+    snapshot.updateCount,
+    snapshot.coalescedCount,
+    snapshot.immediateCount,
+    snapshot.maxBatchSize,
+    snapshot.estimatedFrameCount,
+    snapshot.estimatedBatchedBytes,
+    snapshot.updateCount,
+    snapshot.estimatedUnbatchedBytes
+  );
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <hap.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t updateCount; // Characteristic updates requested
+  uint32_t coalescedCount; // Updates replaced by a newer value of the same characteristic in the window
+  uint32_t immediateCount; // Updates that bypassed the window
+  uint32_t maxBatchSize;
+  // HAP does not report the events it sends, so these assume that each batch or immediate update
+  // becomes one event frame per subscribed controller session.
+  // Bytes include the HTTP header and the encryption overhead.
+  uint32_t estimatedFrameCount;
+  uint64_t estimatedUnbatchedBytes; // If every update were sent in its own frame
+  uint64_t estimatedBatchedBytes;
+} NotificationBatcherStatistics;
+
+// Collects characteristic updates pushed within a short window and passes them to HAP back to back
+// so that they are sent to each controller session in a single multi-characteristic event
+// instead of one encrypted frame per characteristic.
+// Updates in read callbacks must not be batched since the value is used for the response.
+// HAP keeps the previous value until the flush, so characteristics without a read callback
+// may be served up to one window stale, and the events are delayed by up to the same window.
+void startNotificationBatcher(uint32_t windowMillis);
+
+// Updates the value right away if the batcher is not started
+void notifyCharacteristicValue(hap_char_t* hc, const hap_val_t* value);
+// Bypasses the window for states that users watch change, such as locks and doors,
+// and drops any pending value of the characteristic so that it cannot overwrite this one
+void notifyCharacteristicValueImmediately(hap_char_t* hc, const hap_val_t* value);
+
+NotificationBatcherStatistics getNotificationBatcherStatistics();
+void logNotificationBatcherStatistics();
@@ -0,0 +1,85 @@
+#include "log_config.h"
+#include "notification_filter.h"
+#include "notification_batcher.h"
+
+#include <math.h>
+
+extern "C" {
+  #include "util.h"
+}
+
+static const char* TAG = "NotificationFilter";
+
+NotificationFilter::NotificationFilter(const char* name, hap_char_t* characteristic, NotificationFilterConfig config) {
+  this->name = name;
+  this->characteristic = characteristic;
+  this->config = config;
+  this->emittedCount = 0;
+  this->suppressedCount = 0;
+  this->hasEmitted = false;
+  this->lastEmittedValue = 0;
+  this->lastEmittedMillis = 0;
+}
+
+bool NotificationFilter::update(float value) {
+  unsigned long now = millis();
+
+  if (!this->hasEmitted) {
+    this->emit(this->round(value), now);
+    return true;
+  }
+
+  unsigned long elapsedMillis = now - this->lastEmittedMillis;
+  float roundedValue = this->round(value);
+
+  // Keep the last value until the raw value goes beyond the rounding boundary by the hysteresis
+  float threshold = this->config.step / 2 + this->config.hysteresis;
+  bool isBeyondHysteresis = fabsf(value - this->lastEmittedValue) >= threshold;
+  bool isBeyondDeadband = fabsf(roundedValue - this->lastEmittedValue) >= this->config.deadband;
+  bool isChanged = roundedValue != this->lastEmittedValue;
+
+  bool shouldEmit;
+  if (isChanged && isBeyondHysteresis && isBeyondDeadband) {
+    shouldEmit = elapsedMillis >= this->config.minIntervalMillis;
+  } else if (isChanged && this->config.maxStaleMillis > 0) {
+    shouldEmit = elapsedMillis >= this->config.maxStaleMillis;
+  } else {
+    shouldEmit = false;
+  }
+
+  if (!shouldEmit) {
+    this->suppressedCount++;
+    return false;
+  }
+
+  this->emit(roundedValue, now);
+  return true;
+}
+
+float NotificationFilter::getLastEmittedValue() {
+  return this->lastEmittedValue;
+}
+
+void NotificationFilter::logStatistics() {
+  uint32_t totalCount = this->emittedCount + this->suppressedCount;
+  ESP_LOGI(TAG, "%s: emitted %u, suppressed %u (%u%%)", this->name, this->emittedCount, this->suppressedCount, totalCount > 0 ? this->suppressedCount * 100 / totalCount : 0);
+}
+
+float NotificationFilter::round(float value) {
+  if (this->config.step <= 0) {
+    return value;
+  }
+
+  return roundf(value / this->config.step) * this->config.step;
+}
+
+void NotificationFilter::emit(float value, unsigned long now) {
+  this->hasEmitted = true;
+  this->lastEmittedValue = value;
+  this->lastEmittedMillis = now;
+  this->emittedCount++;
+
+  hap_val_t hapValue;
+  hapValue.f = value;
+  notifyCharacteristicValue(this->characteristic, &hapValue);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <hap.h>
+
+typedef struct {
+  float step; // Values are rounded to multiples of this; 0 for no rounding
+  float deadband; // Changes smaller than this from the last notified value are suppressed
+  float hysteresis; // How far the value must go beyond a rounding boundary to change the rounded value
+  uint32_t minIntervalMillis; // Minimum interval between notifications
+  uint32_t maxStaleMillis; // Changes suppressed by the deadband are notified after this; 0 to disable
+} NotificationFilterConfig;
+
+// Sits between sampling and the notification batcher
+// so that values hovering around a rounding boundary don't generate a HAP event every sample.
+class NotificationFilter {
+public:
+  const char* name;
+  hap_char_t* characteristic;
+  NotificationFilterConfig config;
+  uint32_t emittedCount;
+  uint32_t suppressedCount;
+
+  NotificationFilter(const char* name, hap_char_t* characteristic, NotificationFilterConfig config);
+
+  // Returns true if the value is passed to the characteristic
+  bool update(float value);
+  float getLastEmittedValue();
+  void logStatistics();
+
+private:
+  bool hasEmitted;
+  float lastEmittedValue;
+  unsigned long lastEmittedMillis;
+
+  float round(float value);
+  void emit(float value, unsigned long now);
+};
@@ -0,0 +1,235 @@
+#include "log_config.h"
+#include "persistent_state.h"
+
+#include <cstring>
+#include <esp_timer.h>
+
+static const char* TAG = "PersistentState";
+
+static void _processFlushes(void* arg);
+
+PersistentStateStore::PersistentStateStore(const char* namespaceName, uint32_t flushDelayMillis) {
+  memset(&this->statistics, 0, sizeof(this->statistics));
+  this->statistics.startMicros = esp_timer_get_time();
+  this->flushDelayMillis = flushDelayMillis;
+  memset(this->entries, 0, sizeof(this->entries));
+  this->entryCount = 0;
+  vPortCPUInitializeMutex(&this->mux);
+
+  // The states are still kept in RAM without NVS, so the accessories keep working
+  esp_err_t error = nvs_open(namespaceName, NVS_READWRITE, &this->handle);
+  this->isOpened = error == ESP_OK;
+  if (!this->isOpened) {
+    ESP_LOGE(TAG, "Failed to open the NVS namespace %s: %s", namespaceName, esp_err_to_name(error));
+  }
+
+  xTaskCreate(_processFlushes, "PersistentState", 3 * 1024, this, tskIDLE_PRIORITY + 1, &this->task);
+}
+
+uint32_t PersistentStateStore::restoreUInt32(const char* key, uint32_t defaultValue) {
+  uint32_t value = defaultValue;
+  bool isPersisted = false;
+
+  if (this->isOpened) {
+    int64_t startMicros = esp_timer_get_time();
+    esp_err_t error = nvs_get_u32(this->handle, key, &value);
+    uint32_t elapsedMicros = esp_timer_get_time() - startMicros;
+
+    if (error == ESP_OK) {
+      isPersisted = true;
+      ESP_LOGI(TAG, "Restored %s: %u in %u us", key, value, elapsedMicros);
+    } else if (error == ESP_ERR_NVS_NOT_FOUND) {
+      value = defaultValue;
+      ESP_LOGI(TAG, "%s is not stored yet", key);
+    } else {
+      value = defaultValue;
+      ESP_LOGE(TAG, "Failed to restore %s: %s", key, esp_err_to_name(error));
+    }
+
+    portENTER_CRITICAL(&this->mux);
+    this->statistics.restoreMicros += elapsedMicros;
+    if (isPersisted) {
+      this->statistics.restoreCount++;
+    }
+    portEXIT_CRITICAL(&this->mux);
+  }
+
+  portENTER_CRITICAL(&this->mux);
+
+  Entry* entry = this->findOrAddEntry(key);
+  if (entry != NULL) {
+    entry->value = value;
+    entry->persistedValue = value;
+    entry->isPersisted = isPersisted;
+    entry->isDirty = false;
+  }
+
+  portEXIT_CRITICAL(&this->mux);
+
+  return value;
+}
+
+bool PersistentStateStore::setUInt32(const char* key, uint32_t value) {
+  bool needsFlush = false;
+
+  portENTER_CRITICAL(&this->mux);
+
+  Entry* entry = this->findOrAddEntry(key);
+  if (entry == NULL) {
+    portEXIT_CRITICAL(&this->mux);
+    ESP_LOGE(TAG, "Cannot store %s; too many keys", key);
+    return false;
+  }
+
+  this->statistics.setCount++;
+  if (entry->isDirty) {
+    this->statistics.coalescedCount++;
+  }
+
+  entry->value = value;
+  // Changing back to the persisted value within the delay needs no write at all
+  entry->isDirty = !entry->isPersisted || entry->persistedValue != value;
+  needsFlush = entry->isDirty;
+
+  portEXIT_CRITICAL(&this->mux);
+
+  if (needsFlush) {
+    xTaskNotifyGive(this->task);
+  }
+
+  return true;
+}
+
+// Invoked in the flush task
+void PersistentStateStore::flush() {
+  Entry dirtyEntries[kMaxEntryCount];
+  size_t dirtyEntryCount = 0;
+
+  portENTER_CRITICAL(&this->mux);
+
+  for (size_t i = 0; i < this->entryCount; i++) {
+    Entry* entry = &this->entries[i];
+    if (!entry->isDirty) {
+      continue;
+    }
+
+    entry->isDirty = false;
+    dirtyEntries[dirtyEntryCount++] = *entry;
+  }
+
+  portEXIT_CRITICAL(&this->mux);
+
+  if (dirtyEntryCount == 0 || !this->isOpened) {
+    return;
+  }
+
+  size_t writtenEntryCount = 0;
+  bool needsFlush = false;
+
+  for (size_t i = 0; i < dirtyEntryCount; i++) {
+    Entry* dirtyEntry = &dirtyEntries[i];
+    esp_err_t error = nvs_set_u32(this->handle, dirtyEntry->key, dirtyEntry->value);
+
+    portENTER_CRITICAL(&this->mux);
+
+    Entry* entry = this->findOrAddEntry(dirtyEntry->key);
+    if (error == ESP_OK) {
+      entry->persistedValue = dirtyEntry->value;
+      entry->isPersisted = true;
+      // A value set during the write, even back to the previous one, still needs to be written
+      entry->isDirty = entry->value != entry->persistedValue;
+      needsFlush = needsFlush || entry->isDirty;
+      writtenEntryCount++;
+    } else {
+      // Retried with the next change
+      entry->isDirty = true;
+      this->statistics.errorCount++;
+    }
+
+    portEXIT_CRITICAL(&this->mux);
+
+    if (error != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to store %s: %s", dirtyEntry->key, esp_err_to_name(error));
+    }
+  }
+
+  esp_err_t error = nvs_commit(this->handle);
+
+  portENTER_CRITICAL(&this->mux);
+  this->statistics.flushCount++;
+  this->statistics.writeCount += writtenEntryCount;
+  if (error == ESP_OK) {
+    this->statistics.commitCount++;
+  } else {
+    this->statistics.errorCount++;
+  }
+  portEXIT_CRITICAL(&this->mux);
+
+  if (error != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to commit: %s", esp_err_to_name(error));
+  }
+
+  ESP_LOGD(TAG, "Flushed %u keys", writtenEntryCount);
+
+  if (needsFlush) {
+    xTaskNotifyGive(this->task);
+  }
+}
+
+void PersistentStateStore::processFlushes() {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // Changes within the delay are coalesced into this flush
+    vTaskDelay(pdMS_TO_TICKS(this->flushDelayMillis));
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    this->flush();
+  }
+}
+
+void PersistentStateStore::logStatistics() {
+  portENTER_CRITICAL(&this->mux);
+  PersistentStateStatistics statistics = this->statistics;
+  portEXIT_CRITICAL(&this->mux);
+
+  uint64_t elapsedMicros = esp_timer_get_time() - statistics.startMicros;
+  uint64_t microsPerHour = 3600ULL * 1000 * 1000;
+
+  ESP_LOGI(
+    TAG,
+    "%u sets, %u coalesced, %u flushes, %u NVS writes (%u.%02u per hour), %u commits, %u errors",
+    statistics.setCount,
+    statistics.coalescedCount,
+    statistics.flushCount,
+    statistics.writeCount,
+    (uint32_t)(statistics.writeCount * microsPerHour / elapsedMicros),
+    (uint32_t)(statistics.writeCount * microsPerHour * 100 / elapsedMicros % 100),
+    statistics.commitCount,
+    statistics.errorCount
+  );
+  ESP_LOGI(TAG, "Restored %u keys in %u us at boot", statistics.restoreCount, statistics.restoreMicros);
+}
+
+PersistentStateStore::Entry* PersistentStateStore::findOrAddEntry(const char* key) {
+  for (size_t i = 0; i < this->entryCount; i++) {
+    if (strcmp(this->entries[i].key, key) == 0) {
+      return &this->entries[i];
+    }
+  }
+
+  if (this->entryCount >= kMaxEntryCount) {
+    return NULL;
+  }
+
+  Entry* entry = &this->entries[this->entryCount++];
+  entry->key = key;
+  entry->isPersisted = false;
+  entry->isDirty = false;
+  return entry;
+}
+
+static void _processFlushes(void* arg) {
+  PersistentStateStore* store = (PersistentStateStore*)arg;
+  store->processFlushes();
+}
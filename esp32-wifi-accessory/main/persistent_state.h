@@ -0,0 +1,64 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <nvs.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t setCount; // Values passed to set*()
+  uint32_t coalescedCount; // Values replaced before they were flushed
+  uint32_t flushCount;
+  uint32_t writeCount; // Keys actually written to NVS
+  uint32_t commitCount;
+  uint32_t errorCount;
+  uint32_t restoreCount; // Keys found in NVS at boot
+  uint32_t restoreMicros; // Total time spent reading them
+  int64_t startMicros;
+} PersistentStateStatistics;
+
+// Keeps small accessory states in NVS so that they survive reboots and brownouts.
+// Values are restored synchronously at boot, prior to hap_start(),
+// while updates only mark them dirty in RAM and are written by a background task
+// after a short delay, so that bursts of changes result in a single NVS commit
+// and callers such as HAP write callbacks never wait for the flash.
+// NVS needs to be initialized in advance, which hap_init() does.
+class PersistentStateStore {
+public:
+  static const size_t kMaxEntryCount = 8;
+
+  PersistentStateStatistics statistics;
+
+  PersistentStateStore(const char* namespaceName, uint32_t flushDelayMillis);
+
+  // Keys must be string literals up to 15 characters long.
+  // Returns the default value if the key is not stored yet.
+  uint32_t restoreUInt32(const char* key, uint32_t defaultValue);
+  // Returns immediately; false if there are too many keys
+  bool setUInt32(const char* key, uint32_t value);
+
+  // Writes the dirty values to NVS with a single commit
+  void flush();
+  void processFlushes();
+  void logStatistics();
+
+private:
+  typedef struct {
+    const char* key;
+    uint32_t value;
+    uint32_t persistedValue;
+    bool isPersisted;
+    bool isDirty;
+  } Entry;
+
+  nvs_handle_t handle;
+  bool isOpened;
+  uint32_t flushDelayMillis;
+  Entry entries[kMaxEntryCount];
+  size_t entryCount;
+  portMUX_TYPE mux;
+  TaskHandle_t task;
+
+  // Must be called in the critical section
+  Entry* findOrAddEntry(const char* key);
+};
@@ -0,0 +1,49 @@
+#include "log_config.h"
+#include "pulse_output.h"
+
+static const char* TAG = "PulseOutput";
+
+// With RMT_CHANNEL_FLAGS_AWARE_DFS, the channel is clocked by the 1MHz REF_TICK,
+// which keeps the timing even when the APB clock frequency changes.
+static const uint8_t kClockDivider = 100;
+static const uint32_t kTickMicros = kClockDivider; // 1 tick = 100us
+
+RMTPulseOutput::RMTPulseOutput(rmt_channel_t channel, gpio_num_t pin) {
+  this->channel = channel;
+
+  rmt_config_t config = RMT_DEFAULT_CONFIG_TX(pin, channel);
+  config.clk_div = kClockDivider;
+  config.flags |= RMT_CHANNEL_FLAGS_AWARE_DFS;
+  config.tx_config.idle_output_en = true;
+  config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+
+  ESP_ERROR_CHECK(rmt_config(&config));
+  ESP_ERROR_CHECK(rmt_driver_install(channel, 0, 0));
+}
+
+bool RMTPulseOutput::write(const PulseSegment* segments, size_t segmentCount) {
+  if (this->isBusy()) {
+    ESP_LOGW(TAG, "Channel %d is busy", this->channel);
+    return false;
+  }
+
+  size_t itemCount = encodePulseSegments(segments, segmentCount, kTickMicros, this->encodedItems, kMaxItemCount);
+  if (itemCount == 0) {
+    ESP_LOGE(TAG, "Waveform is too long for channel %d", this->channel);
+    return false;
+  }
+
+  for (size_t i = 0; i < itemCount; i++) {
+    this->items[i].level0 = this->encodedItems[i].level0;
+    this->items[i].duration0 = this->encodedItems[i].duration0;
+    this->items[i].level1 = this->encodedItems[i].level1;
+    this->items[i].duration1 = this->encodedItems[i].duration1;
+  }
+
+  // The items are copied into the RMT memory before this returns since they fit in one block
+  return rmt_write_items(this->channel, this->items, itemCount, false) == ESP_OK;
+}
+
+bool RMTPulseOutput::isBusy() {
+  return rmt_wait_tx_done(this->channel, 0) == ESP_ERR_TIMEOUT;
+}
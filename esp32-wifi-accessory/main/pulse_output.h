@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <driver/gpio.h>
+#include <driver/rmt.h>
+#include "pulse_waveform.h"
+
+// Generates waveforms with the RMT peripheral, so the timing is exact and takes no CPU time.
+class RMTPulseOutput : public PulseOutput {
+public:
+  RMTPulseOutput(rmt_channel_t channel, gpio_num_t pin);
+
+  bool write(const PulseSegment* segments, size_t segmentCount);
+  bool isBusy();
+
+private:
+  static const size_t kMaxItemCount = 64; // 1 memory block
+
+  rmt_channel_t channel;
+  PulseItem encodedItems[kMaxItemCount];
+  rmt_item32_t items[kMaxItemCount];
+};
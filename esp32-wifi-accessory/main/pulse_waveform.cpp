@@ -0,0 +1,48 @@
+#include "pulse_waveform.h"
+
+size_t encodePulseSegments(const PulseSegment* segments, size_t segmentCount, uint32_t tickMicros, PulseItem* items, size_t maxItemCount) {
+  size_t halfCount = 0;
+
+  for (size_t i = 0; i < segmentCount; i++) {
+    uint32_t remainingTicks = (uint64_t)segments[i].durationMillis * 1000 / tickMicros;
+
+    while (remainingTicks > 0) {
+      uint32_t ticks = remainingTicks > kMaxPulseItemTicksPerHalf ? kMaxPulseItemTicksPerHalf : remainingTicks;
+      remainingTicks -= ticks;
+
+      size_t itemIndex = halfCount / 2;
+      if (itemIndex >= maxItemCount) {
+        return 0;
+      }
+
+      PulseItem* item = &items[itemIndex];
+      if (halfCount % 2 == 0) {
+        item->level0 = segments[i].level;
+        item->duration0 = ticks;
+      } else {
+        item->level1 = segments[i].level;
+        item->duration1 = ticks;
+      }
+
+      halfCount++;
+    }
+  }
+
+  // A zero duration half ends the transmission
+  if (halfCount % 2 == 1) {
+    items[halfCount / 2].level1 = 0;
+    items[halfCount / 2].duration1 = 0;
+    return halfCount / 2 + 1;
+  }
+
+  size_t endIndex = halfCount / 2;
+  if (endIndex >= maxItemCount) {
+    return 0;
+  }
+
+  items[endIndex].level0 = 0;
+  items[endIndex].duration0 = 0;
+  items[endIndex].level1 = 0;
+  items[endIndex].duration1 = 0;
+  return endIndex + 1;
+}
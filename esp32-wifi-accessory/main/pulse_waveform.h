@@ -0,0 +1,44 @@
+#pragma once
+
+// Waveform description, the output abstraction and the encoding into RMT items.
+// This has no ESP-IDF dependency so that the timing can be tested on a host.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A segment outputs the level for the duration.
+// The output goes back to low after the last segment.
+typedef struct {
+  uint8_t level;
+  uint32_t durationMillis;
+} PulseSegment;
+
+#define PULSE_SEGMENT_COUNT(segments) (sizeof(segments) / sizeof(segments[0]))
+
+// Hardware abstraction of a pin outputting timed pulses
+// so that accessories don't depend on how the waveforms are generated.
+class PulseOutput {
+public:
+  virtual ~PulseOutput() {}
+
+  // Returns immediately after the waveform is queued.
+  // Returns false if the previous waveform is still being output.
+  virtual bool write(const PulseSegment* segments, size_t segmentCount) = 0;
+  virtual bool isBusy() = 0;
+};
+
+// Same fields as rmt_item32_t: two halves of a level and a duration in ticks.
+// A half with zero duration ends the transmission.
+typedef struct {
+  uint32_t duration0 : 15;
+  uint32_t level0 : 1;
+  uint32_t duration1 : 15;
+  uint32_t level1 : 1;
+} PulseItem;
+
+// Each half of an RMT item has a 15-bit duration
+static const uint32_t kMaxPulseItemTicksPerHalf = 0x7FFF;
+
+// Converts segments into items with the tick duration, splitting long segments into multiple items.
+// Returns the item count including the end marker, or 0 if the items don't fit.
+size_t encodePulseSegments(const PulseSegment* segments, size_t segmentCount, uint32_t tickMicros, PulseItem* items, size_t maxItemCount);
@@ -0,0 +1,155 @@
+#include "streaming_estimators.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+SlidingLinearRegression::SlidingLinearRegression(size_t capacity) {
+  this->capacity = capacity;
+  this->xs = (float*)calloc(capacity, sizeof(float));
+  this->ys = (float*)calloc(capacity, sizeof(float));
+  this->count = 0;
+  this->nextIndex = 0;
+  this->additionsSinceRecomputation = 0;
+  this->sumX = 0;
+  this->sumY = 0;
+  this->sumXY = 0;
+  this->sumXX = 0;
+}
+
+void SlidingLinearRegression::add(float x, float y) {
+  if (this->count == this->capacity) {
+    float oldX = this->xs[this->nextIndex];
+    float oldY = this->ys[this->nextIndex];
+    this->sumX -= oldX;
+    this->sumY -= oldY;
+    this->sumXY -= (double)oldX * oldY;
+    this->sumXX -= (double)oldX * oldX;
+  } else {
+    this->count++;
+  }
+
+  this->xs[this->nextIndex] = x;
+  this->ys[this->nextIndex] = y;
+  this->nextIndex = (this->nextIndex + 1) % this->capacity;
+
+  this->sumX += x;
+  this->sumY += y;
+  this->sumXY += (double)x * y;
+  this->sumXX += (double)x * x;
+
+  // Subtracting evicted points accumulates rounding errors, so start over once per window
+  if (++this->additionsSinceRecomputation >= this->capacity) {
+    this->recomputeSums();
+  }
+}
+
+size_t SlidingLinearRegression::getCount() {
+  return this->count;
+}
+
+float SlidingLinearRegression::getSlope() {
+  if (this->count < 2) {
+    return 0;
+  }
+
+  double n = this->count;
+  double denominator = n * this->sumXX - this->sumX * this->sumX;
+  if (denominator == 0) {
+    return 0;
+  }
+
+  return (n * this->sumXY - this->sumX * this->sumY) / denominator;
+}
+
+void SlidingLinearRegression::recomputeSums() {
+  this->sumX = 0;
+  this->sumY = 0;
+  this->sumXY = 0;
+  this->sumXX = 0;
+
+  for (size_t i = 0; i < this->count; i++) {
+    this->sumX += this->xs[i];
+    this->sumY += this->ys[i];
+    this->sumXY += (double)this->xs[i] * this->ys[i];
+    this->sumXX += (double)this->xs[i] * this->xs[i];
+  }
+
+  this->additionsSinceRecomputation = 0;
+}
+
+ExponentialMovingAverage::ExponentialMovingAverage(float timeConstantSeconds) {
+  this->timeConstantSeconds = timeConstantSeconds;
+  this->value = 0;
+  this->lastTimeMillis = 0;
+  this->initialized = false;
+}
+
+float ExponentialMovingAverage::add(float value, uint32_t timeMillis) {
+  if (this->initialized) {
+    float elapsedSeconds = (uint32_t)(timeMillis - this->lastTimeMillis) / 1000.0f;
+    float alpha = 1 - expf(-elapsedSeconds / this->timeConstantSeconds);
+    this->value += alpha * (value - this->value);
+  } else {
+    this->value = value;
+    this->initialized = true;
+  }
+
+  this->lastTimeMillis = timeMillis;
+  return this->value;
+}
+
+float ExponentialMovingAverage::getValue() {
+  return this->value;
+}
+
+bool ExponentialMovingAverage::hasValue() {
+  return this->initialized;
+}
+
+SlidingMinMax::SlidingMinMax(size_t capacity) {
+  this->capacity = capacity;
+  this->values = (float*)calloc(capacity, sizeof(float));
+  this->minDeque = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+  this->maxDeque = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+  this->minHead = 0;
+  this->minCount = 0;
+  this->maxHead = 0;
+  this->maxCount = 0;
+  this->nextSequence = 0;
+}
+
+void SlidingMinMax::add(float value) {
+  uint32_t sequence = this->nextSequence++;
+  this->values[sequence % this->capacity] = value;
+
+  // Drop the values that fell out of the window from the fronts
+  if (this->minCount > 0 && sequence - this->minDeque[this->minHead] >= this->capacity) {
+    this->minHead = (this->minHead + 1) % this->capacity;
+    this->minCount--;
+  }
+  if (this->maxCount > 0 && sequence - this->maxDeque[this->maxHead] >= this->capacity) {
+    this->maxHead = (this->maxHead + 1) % this->capacity;
+    this->maxCount--;
+  }
+
+  // Drop the values that can never be the min/max anymore from the backs
+  while (this->minCount > 0 && this->values[this->minDeque[(this->minHead + this->minCount - 1) % this->capacity] % this->capacity] >= value) {
+    this->minCount--;
+  }
+  this->minDeque[(this->minHead + this->minCount) % this->capacity] = sequence;
+  this->minCount++;
+
+  while (this->maxCount > 0 && this->values[this->maxDeque[(this->maxHead + this->maxCount - 1) % this->capacity] % this->capacity] <= value) {
+    this->maxCount--;
+  }
+  this->maxDeque[(this->maxHead + this->maxCount) % this->capacity] = sequence;
+  this->maxCount++;
+}
+
+float SlidingMinMax::getMin() {
+  return this->minCount > 0 ? this->values[this->minDeque[this->minHead] % this->capacity] : 0;
+}
+
+float SlidingMinMax::getMax() {
+  return this->maxCount > 0 ? this->values[this->maxDeque[this->maxHead] % this->capacity] : 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Estimators updated in O(1) (amortized) per sample without scanning the window.
+
+// Linear regression over the last `capacity` points
+class SlidingLinearRegression {
+public:
+  SlidingLinearRegression(size_t capacity);
+
+  void add(float x, float y);
+  size_t getCount();
+  // Returns 0 if fewer than 2 points
+  float getSlope();
+
+private:
+  size_t capacity;
+  float* xs;
+  float* ys;
+  size_t count;
+  size_t nextIndex;
+  size_t additionsSinceRecomputation;
+  double sumX;
+  double sumY;
+  double sumXY;
+  double sumXX;
+
+  void recomputeSums();
+};
+
+// The weight of each sample follows the time since the previous one,
+// so the smoothing does not change with the sampling interval
+class ExponentialMovingAverage {
+public:
+  ExponentialMovingAverage(float timeConstantSeconds);
+
+  float add(float value, uint32_t timeMillis);
+  float getValue();
+  bool hasValue();
+
+private:
+  float timeConstantSeconds;
+  float value;
+  uint32_t lastTimeMillis;
+  bool initialized;
+};
+
+// Minimum and maximum over the last `capacity` values with monotonic deques
+class SlidingMinMax {
+public:
+  SlidingMinMax(size_t capacity);
+
+  void add(float value);
+  float getMin();
+  float getMax();
+
+private:
+  size_t capacity;
+  float* values; // Indexed by sequence % capacity
+  uint32_t* minDeque; // Sequences of increasing values
+  uint32_t* maxDeque; // Sequences of decreasing values
+  size_t minHead, minCount;
+  size_t maxHead, maxCount;
+  uint32_t nextSequence;
+};
@@ -0,0 +1,232 @@
+#include "log_config.h"
+#include "weather_history.h"
+
+#include <cstring>
+
+static const char* TAG = "WeatherHistory";
+
+static const size_t kMaxEncodedSampleSize = 5 * (1 + WeatherHistoryValueCount);
+
+// Each block holds around 40-50 samples
+static WeatherHistoryBlock secondBlocks[12]; // About 10 minutes
+static WeatherHistoryBlock minuteBlocks[10]; // About 8 hours
+static WeatherHistoryBlock quarterHourBlocks[6]; // About 3 days
+
+static const uint32_t kTierIntervalSeconds[WeatherHistoryTierCount] = {1, 60, 15 * 60};
+static const size_t kTierBlockCounts[WeatherHistoryTierCount] = {
+  sizeof(secondBlocks) / sizeof(secondBlocks[0]),
+  sizeof(minuteBlocks) / sizeof(minuteBlocks[0]),
+  sizeof(quarterHourBlocks) / sizeof(quarterHourBlocks[0]),
+};
+
+static size_t encodeVarint(int32_t value, uint8_t* buffer);
+static size_t decodeVarint(const uint8_t* buffer, int32_t* value);
+
+WeatherHistory::WeatherHistory() {
+  WeatherHistoryBlock* blocks[WeatherHistoryTierCount] = {secondBlocks, minuteBlocks, quarterHourBlocks};
+
+  memset(this->tiers, 0, sizeof(this->tiers));
+
+  for (size_t i = 0; i < WeatherHistoryTierCount; i++) {
+    WeatherHistoryTierStorage* tier = &this->tiers[i];
+    tier->intervalSeconds = kTierIntervalSeconds[i];
+    tier->blockCount = kTierBlockCounts[i];
+    tier->blocks = blocks[i];
+    tier->newestBlockIndex = tier->blockCount - 1;
+    memset(tier->blocks, 0, sizeof(WeatherHistoryBlock) * tier->blockCount);
+  }
+
+  this->mutex = xSemaphoreCreateMutex();
+}
+
+void WeatherHistory::append(const WeatherHistorySample* sample) {
+  xSemaphoreTake(this->mutex, portMAX_DELAY);
+  this->appendToTier(WeatherHistoryTierSecond, sample);
+  xSemaphoreGive(this->mutex);
+}
+
+void WeatherHistory::appendToTier(size_t tierIndex, const WeatherHistorySample* sample) {
+  WeatherHistoryTierStorage* tier = &this->tiers[tierIndex];
+  WeatherHistoryBlock* block = &tier->blocks[tier->newestBlockIndex];
+
+  if (block->sampleCount == 0 || sample->time <= tier->lastSample.time) {
+    // The time going backwards should not happen, but starting a new block keeps the encoding valid
+    this->startNewBlock(tier, sample);
+  } else {
+    uint8_t encoded[kMaxEncodedSampleSize];
+    size_t size = 0;
+
+    int32_t timeDelta = sample->time - tier->lastSample.time;
+    size += encodeVarint(timeDelta - tier->lastTimeDelta, &encoded[size]);
+    for (size_t i = 0; i < WeatherHistoryValueCount; i++) {
+      size += encodeVarint(sample->values[i] - tier->lastSample.values[i], &encoded[size]);
+    }
+
+    if (block->size + size > sizeof(block->data)) {
+      this->startNewBlock(tier, sample);
+    } else {
+      memcpy(&block->data[block->size], encoded, size);
+      block->size += size;
+      block->sampleCount++;
+      tier->lastTimeDelta = timeDelta;
+      tier->lastSample = *sample;
+    }
+  }
+
+  tier->sampleCount++;
+
+  if (tierIndex + 1 < WeatherHistoryTierCount) {
+    this->accumulateForNextTier(tierIndex, sample);
+  }
+}
+
+void WeatherHistory::startNewBlock(WeatherHistoryTierStorage* tier, const WeatherHistorySample* sample) {
+  tier->newestBlockIndex = (tier->newestBlockIndex + 1) % tier->blockCount;
+
+  WeatherHistoryBlock* block = &tier->blocks[tier->newestBlockIndex];
+  tier->evictedSampleCount += block->sampleCount;
+
+  block->firstSample = *sample;
+  block->sampleCount = 1;
+  block->size = 0;
+
+  tier->lastSample = *sample;
+  tier->lastTimeDelta = tier->intervalSeconds;
+}
+
+// Averages the samples in each interval of the next tier and appends it when the interval ends
+void WeatherHistory::accumulateForNextTier(size_t tierIndex, const WeatherHistorySample* sample) {
+  WeatherHistoryTierStorage* tier = &this->tiers[tierIndex];
+  uint32_t nextIntervalSeconds = this->tiers[tierIndex + 1].intervalSeconds;
+  uint32_t bucket = sample->time / nextIntervalSeconds;
+
+  if (tier->accumulatedCount > 0 && bucket != tier->accumulatedBucket) {
+    WeatherHistorySample average;
+    average.time = tier->accumulatedBucket * nextIntervalSeconds;
+    for (size_t i = 0; i < WeatherHistoryValueCount; i++) {
+      average.values[i] = tier->accumulatedValues[i] / (int64_t)tier->accumulatedCount;
+    }
+
+    tier->accumulatedCount = 0;
+    memset(tier->accumulatedValues, 0, sizeof(tier->accumulatedValues));
+
+    this->appendToTier(tierIndex + 1, &average);
+  }
+
+  tier->accumulatedBucket = bucket;
+  tier->accumulatedCount++;
+  for (size_t i = 0; i < WeatherHistoryValueCount; i++) {
+    tier->accumulatedValues[i] += sample->values[i];
+  }
+}
+
+size_t WeatherHistory::query(WeatherHistoryTier tier, uint32_t fromTime, uint32_t toTime, WeatherHistorySample* samples, size_t maxCount) {
+  if (tier >= WeatherHistoryTierCount || maxCount == 0) {
+    return 0;
+  }
+
+  size_t count = 0;
+
+  xSemaphoreTake(this->mutex, portMAX_DELAY);
+
+  WeatherHistoryTierStorage* storage = &this->tiers[tier];
+
+  // From the oldest block
+  for (size_t i = 1; i <= storage->blockCount && count < maxCount; i++) {
+    WeatherHistoryBlock* block = &storage->blocks[(storage->newestBlockIndex + i) % storage->blockCount];
+
+    if (block->sampleCount == 0 || block->firstSample.time > toTime) {
+      continue;
+    }
+
+    WeatherHistorySample sample = block->firstSample;
+    int32_t timeDelta = storage->intervalSeconds;
+    size_t offset = 0;
+
+    for (size_t j = 0; j < block->sampleCount && count < maxCount; j++) {
+      if (j > 0) {
+        int32_t timeDeltaOfDelta;
+        offset += decodeVarint(&block->data[offset], &timeDeltaOfDelta);
+        timeDelta += timeDeltaOfDelta;
+        sample.time += timeDelta;
+
+        for (size_t k = 0; k < WeatherHistoryValueCount; k++) {
+          int32_t valueDelta;
+          offset += decodeVarint(&block->data[offset], &valueDelta);
+          sample.values[k] += valueDelta;
+        }
+      }
+
+      if (sample.time > toTime) {
+        break;
+      }
+
+      if (sample.time >= fromTime) {
+        samples[count++] = sample;
+      }
+    }
+  }
+
+  xSemaphoreGive(this->mutex);
+
+  return count;
+}
+
+void WeatherHistory::logStatistics() {
+  xSemaphoreTake(this->mutex, portMAX_DELAY);
+
+  for (size_t i = 0; i < WeatherHistoryTierCount; i++) {
+    WeatherHistoryTierStorage* tier = &this->tiers[i];
+    uint32_t storedCount = 0;
+    uint32_t storedBytes = 0;
+
+    for (size_t j = 0; j < tier->blockCount; j++) {
+      storedCount += tier->blocks[j].sampleCount;
+      if (tier->blocks[j].sampleCount > 0) {
+        storedBytes += sizeof(WeatherHistorySample) + tier->blocks[j].size;
+      }
+    }
+
+    ESP_LOGI(
+      TAG,
+      "Tier %us: %u samples in %u bytes (%u.%02u bytes/sample), %u evicted",
+      tier->intervalSeconds,
+      storedCount,
+      storedBytes,
+      storedCount > 0 ? storedBytes / storedCount : 0,
+      storedCount > 0 ? storedBytes * 100 / storedCount % 100 : 0,
+      tier->evictedSampleCount
+    );
+  }
+
+  xSemaphoreGive(this->mutex);
+}
+
+static size_t encodeVarint(int32_t value, uint8_t* buffer) {
+  // Zigzag encoding maps small negative values to small unsigned values
+  uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  size_t size = 0;
+
+  while (zigzag >= 0x80) {
+    buffer[size++] = (zigzag & 0x7F) | 0x80;
+    zigzag >>= 7;
+  }
+
+  buffer[size++] = zigzag;
+  return size;
+}
+
+static size_t decodeVarint(const uint8_t* buffer, int32_t* value) {
+  uint32_t zigzag = 0;
+  size_t size = 0;
+  uint8_t byte;
+
+  do {
+    byte = buffer[size];
+    zigzag |= (uint32_t)(byte & 0x7F) << (7 * size);
+    size++;
+  } while (byte & 0x80);
+
+  *value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+  return size;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+typedef enum {
+  WeatherHistoryValueTemperature = 0, // In 0.01 degrees Celsius
+  WeatherHistoryValueHumidity, // In %RH, Q22.10 format
+  WeatherHistoryValuePressure, // In Pa, Q24.8 format
+  WeatherHistoryValueCount
+} WeatherHistoryValue;
+
+typedef enum {
+  WeatherHistoryTierSecond = 0,
+  WeatherHistoryTierMinute,
+  WeatherHistoryTierQuarterHour,
+  WeatherHistoryTierCount
+} WeatherHistoryTier;
+
+typedef struct {
+  uint32_t time; // In seconds since boot
+  int32_t values[WeatherHistoryValueCount];
+} WeatherHistorySample;
+
+// A block starts with a raw sample and the following samples are encoded as
+// zigzag varints of the delta-of-delta of the time and the deltas of the values,
+// which take 1 byte each for most of the samples.
+typedef struct {
+  WeatherHistorySample firstSample;
+  uint16_t sampleCount; // Including the first sample; 0 for unused blocks
+  uint16_t size;
+  uint8_t data[256];
+} WeatherHistoryBlock;
+
+typedef struct {
+  uint32_t intervalSeconds;
+  size_t blockCount;
+  WeatherHistoryBlock* blocks; // Ring buffer
+  size_t newestBlockIndex;
+
+  // State of the encoder for the newest block
+  WeatherHistorySample lastSample;
+  int32_t lastTimeDelta;
+
+  // Accumulation for the next tier
+  uint32_t accumulatedBucket;
+  uint32_t accumulatedCount;
+  int64_t accumulatedValues[WeatherHistoryValueCount];
+
+  uint32_t sampleCount;
+  uint32_t evictedSampleCount;
+} WeatherHistoryTierStorage;
+
+// Fixed-memory compressed history of the sensor values with downsampling tiers of 1s, 1min and 15min
+class WeatherHistory {
+public:
+  WeatherHistory();
+
+  void append(const WeatherHistorySample* sample);
+
+  // Copies up to maxCount samples in [fromTime, toTime] in the tier into the buffer in chronological order.
+  // Call again with fromTime = (last sample's time + 1) to get the rest.
+  size_t query(WeatherHistoryTier tier, uint32_t fromTime, uint32_t toTime, WeatherHistorySample* samples, size_t maxCount);
+
+  void logStatistics();
+
+private:
+  SemaphoreHandle_t mutex;
+  WeatherHistoryTierStorage tiers[WeatherHistoryTierCount];
+
+  void appendToTier(size_t tierIndex, const WeatherHistorySample* sample);
+  void accumulateForNextTier(size_t tierIndex, const WeatherHistorySample* sample);
+  void startNewBlock(WeatherHistoryTierStorage* tier, const WeatherHistorySample* sample);
+};
@@ -3,13 +3,14 @@
 
 #include <hap_apple_servs.h>
 #include <hap_apple_chars.h>
-#include <hap_fw_upgrade.h>
 
 #include "hap_custom_servs.h"
 #include "hap_custom_chars.h"
+#include "homekit_accessory.h"
 
 #include <cstring>
-#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
 
 extern "C" {
   #include "math.h"
@@ -18,188 +19,414 @@ extern "C" {
 
 static const char* TAG = "WeatherSensor";
 
-static const char* kSetupID = "WTHR"; // This must be unique
+static const char kTemperatureSensorServiceName[] = "Temperature Sensor";
+static const char kHumiditySensorServiceName[] = "Humidity Sensor";
+static const char kAirPressureSensorServiceName[] = "Air Pressure Sensor";
+
+static const AccessoryDefinition kAccessoryDefinition = {
+  .name = "Weather Sensor",
+  .protocolVersion = "1.0.0",
+  .category = HAP_CID_SENSOR,
+  .setupID = "WTHR",
+};
+
+static const char kBridgedKey[] = "weatherBridged";
+
+// Rounding to 0.5 degrees, 1 %RH and 1 hPa, following what HomeKit displays.
+// The hysteresis prevents values hovering around the rounding boundaries from being notified every second.
+static const NotificationFilterConfig kTemperatureFilterConfig = {
+  .step = 0.5,
+  .deadband = 0,
+  .hysteresis = 0.1,
+  .minIntervalMillis = 5 * 1000,
+  .maxStaleMillis = 10 * 60 * 1000,
+};
+
+static const NotificationFilterConfig kRelativeHumidityFilterConfig = {
+  .step = 1,
+  .deadband = 0,
+  .hysteresis = 0.3,
+  .minIntervalMillis = 5 * 1000,
+  .maxStaleMillis = 10 * 60 * 1000,
+};
+
+// In Pa
+static const NotificationFilterConfig kAirPressureFilterConfig = {
+  .step = 100,
+  .deadband = 0,
+  .hysteresis = 20,
+  .minIntervalMillis = 30 * 1000,
+  .maxStaleMillis = 10 * 60 * 1000,
+};
+
+// In Pa per 3 hours
+static const NotificationFilterConfig kPressureTendencyFilterConfig = {
+  .step = 10,
+  .deadband = 0,
+  .hysteresis = 2,
+  .minIntervalMillis = 60 * 1000,
+  .maxStaleMillis = 30 * 60 * 1000,
+};
+
+static const NotificationFilterConfig kDewPointFilterConfig = {
+  .step = 0.5,
+  .deadband = 0,
+  .hysteresis = 0.1,
+  .minIntervalMillis = 30 * 1000,
+  .maxStaleMillis = 10 * 60 * 1000,
+};
+
+// In meters
+static const NotificationFilterConfig kAltitudeChangeFilterConfig = {
+  .step = 1,
+  .deadband = 0,
+  .hysteresis = 0.5,
+  .minIntervalMillis = 30 * 1000,
+  .maxStaleMillis = 10 * 60 * 1000,
+};
+
+// In Pa
+static const NotificationFilterConfig kPressureRangeFilterConfig = {
+  .step = 10,
+  .deadband = 0,
+  .hysteresis = 2,
+  .minIntervalMillis = 60 * 1000,
+  .maxStaleMillis = 30 * 60 * 1000,
+};
+
+static const uint32_t kFilterStatisticsLoggingInterval = 60; // In samples
+
+static const uint32_t kMinDiscoveryBackoffMillis = 1000;
+static const uint32_t kMaxDiscoveryBackoffMillis = 5 * 60 * 1000;
+
+// The sensor sleeps between forced measurements.
+// It is sampled at the fast rate only while someone is looking at the values.
+static const uint32_t kFastSamplingIntervalMillis = 1000;
+static const uint32_t kSlowSamplingIntervalMillis = 60 * 1000;
+// Controllers read the values when the Home app shows them, and subscribe to the notifications at the same time
+static const uint32_t kReadCallbackDemandMillis = 5 * 60 * 1000;
+
+// Max measurement time in the datasheet with x8 oversampling of all the values:
+// 1.25 + 2.3 * 8 + (2.3 * 8 + 0.575) * 2 ms
+static const uint32_t kMeasurementMillis = 58;
+static const uint32_t kMeasurementPollingMillis = 5;
+static const int kMaxMeasurementPollingCount = 4;
+
+// Typical currents of BME280 in the datasheet, averaged over the measurement phases
+static const float kMeasurementCurrentMicroamps = 460;
+static const float kSleepCurrentMicroamps = 0.1;
+
+static void _sampleSensorData(void* arg);
+static void _discoverSensor(void* arg);
+static hap_status_t readSensorCharacteristic(WeatherSensor* sensor, hap_char_t* hc);
+
+static const CharacteristicHandler kTemperatureSensorServiceHandlers[] = {
+  { .uuid = HAP_CHAR_UUID_CURRENT_TEMPERATURE, .read = readTrampoline<WeatherSensor, readSensorCharacteristic>, .write = NULL, .constantString = NULL },
+  { .uuid = HAP_CHAR_UUID_NAME, .read = NULL, .write = NULL, .constantString = kTemperatureSensorServiceName },
+};
+
+static const CharacteristicHandler kHumiditySensorServiceHandlers[] = {
+  { .uuid = HAP_CHAR_UUID_CURRENT_RELATIVE_HUMIDITY, .read = readTrampoline<WeatherSensor, readSensorCharacteristic>, .write = NULL, .constantString = NULL },
+  { .uuid = HAP_CHAR_UUID_NAME, .read = NULL, .write = NULL, .constantString = kHumiditySensorServiceName },
+};
+
+static const CharacteristicHandler kAirPressureSensorServiceHandlers[] = {
+  { .uuid = HAP_CHAR_UUID_CURRENT_AIR_PRESSURE, .read = readTrampoline<WeatherSensor, readSensorCharacteristic>, .write = NULL, .constantString = NULL },
+  { .uuid = HAP_CHAR_UUID_AIR_PRESSURE_TENDENCY, .read = readTrampoline<WeatherSensor, readSensorCharacteristic>, .write = NULL, .constantString = NULL },
+  { .uuid = HAP_CHAR_UUID_DEW_POINT, .read = readTrampoline<WeatherSensor, readSensorCharacteristic>, .write = NULL, .constantString = NULL },
+  { .uuid = HAP_CHAR_UUID_ALTITUDE_CHANGE, .read = readTrampoline<WeatherSensor, readSensorCharacteristic>, .write = NULL, .constantString = NULL },
+  { .uuid = HAP_CHAR_UUID_AIR_PRESSURE_RANGE, .read = readTrampoline<WeatherSensor, readSensorCharacteristic>, .write = NULL, .constantString = NULL },
+  { .uuid = HAP_CHAR_UUID_NAME, .read = NULL, .write = NULL, .constantString = kAirPressureSensorServiceName },
+};
+
+typedef struct {
+  bmp280_t* bmp280;
+  SensorData* data;
+} ReadSensorDataContext;
+
+// Performed in the I2CBusManager task.
+// The measurement takes tens of milliseconds, so the bus is released while waiting for it.
+static esp_err_t forceMeasurementOnBus(void* context) {
+  return bmp280_force_measurement((bmp280_t*)context);
+}
 
-static const char* kTemperatureSensorServiceName = "Temperature Sensor";
-static const char* kHumiditySensorServiceName = "Humidity Sensor";
-static const char* kAirPressureSensorServiceName = "Air Pressure Sensor";
+// Performed in the I2CBusManager task
+static esp_err_t readSensorDataOnBus(void* context) {
+  ReadSensorDataContext* readContext = (ReadSensorDataContext*)context;
+  SensorData* data = readContext->data;
 
-static int identifyAccessory(hap_acc_t* ha);
-void monitoringTask(void* arg);
-static int readTemperatureSensorCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv);
-static int readHumiditySensorCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv);
-static int readAirPressureSensorCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv);
+  bool isMeasuring;
+  esp_err_t code = bmp280_is_measuring(readContext->bmp280, &isMeasuring);
+  if (code != ESP_OK) {
+    return code;
+  }
 
-bmp280_t* initBMP280(gpio_num_t sdaPin, gpio_num_t sdlPin) {
-  ESP_ERROR_CHECK(i2cdev_init());
+  if (isMeasuring) {
+    return ESP_ERR_NOT_FINISHED;
+  }
+
+  return bmp280_read_fixed(readContext->bmp280, &data->temperature, &data->pressure, &data->humidity);
+}
 
-  bmp280_t* bmp280 = (bmp280_t*)malloc(sizeof(bmp280_t));
-  memset(bmp280, 0, sizeof(bmp280_t));
-  ESP_ERROR_CHECK(bmp280_init_desc(bmp280, BMP280_I2C_ADDRESS_0, I2C_NUM_0, sdaPin, sdlPin));
+// Performed in the I2CBusManager task.
+// Fails quickly with a NACK unless the bus is stuck, but is retried in the background anyway.
+static esp_err_t initBMP280OnBus(void* context) {
+  bmp280_t* bmp280 = (bmp280_t*)context;
 
   // https://community.bosch-sensortec.com/t5/Knowledge-base/BME280-Sensor-Data-Interpretation/ta-p/13912
+  // The forced mode takes a single measurement on request and goes back to sleep.
+  // The IIR filter is off since the interval between measurements varies.
   bmp280_params_t params = {
-    .mode = BMP280_MODE_NORMAL,
-    .filter = BMP280_FILTER_4, // coefficient X means: currentValue = (prevValue * (X - 1) + sensorData) / X
+    .mode = BMP280_MODE_FORCED,
+    .filter = BMP280_FILTER_OFF,
     .oversampling_pressure = BMP280_HIGH_RES,
     .oversampling_temperature = BMP280_HIGH_RES,
     .oversampling_humidity = BMP280_HIGH_RES,
     .standby = BMP280_STANDBY_250
   };
 
-  if (bmp280_init(bmp280, &params) == ESP_OK) {
-    // Sensor found
-    return bmp280;
-  } else {
-    ESP_LOGE(TAG, "bmp280_init() failed. WeatherSensor cannot be used.");
-    // Sensor not found
-    return NULL;
-  }
+  return bmp280_init(bmp280, &params);
 }
 
-WeatherSensor::WeatherSensor(gpio_num_t sdaPin, gpio_num_t sdlPin, float temperatureCalidation) {
-  this->bmp280 = initBMP280(sdaPin, sdlPin);
+// i2cdev must have been initialized by I2CBusManager.
+// The sensor is not accessed until startDiscovery() is called.
+WeatherSensor::WeatherSensor(PersistentStateStore* stateStore, I2CBusManager* busManager, gpio_num_t sdaPin, gpio_num_t sdlPin, float temperatureCalidation) {
+  this->busManager = busManager;
+  this->bmp280 = (bmp280_t*)malloc(sizeof(bmp280_t));
+  memset(this->bmp280, 0, sizeof(bmp280_t));
+  ESP_ERROR_CHECK(bmp280_init_desc(this->bmp280, BMP280_I2C_ADDRESS_0, busManager->port, sdaPin, sdlPin));
+  this->busDeviceIndex = busManager->registerDevice(&this->bmp280->i2c_dev, "BMP280");
+  this->found = false;
+  this->discoveryAttemptCount = 0;
+  this->stateStore = stateStore;
+  this->wasBridged = stateStore->restoreUInt32(kBridgedKey, false);
   this->temperatureCalidation = temperatureCalidation;
-  memset(&this->lastData, 0, sizeof(SensorData));
-  this->lastDataMutex = xSemaphoreCreateMutex();
+  memset(&this->snapshot, 0, sizeof(SensorDataSnapshot));
+  memset(&this->samplingStatistics, 0, sizeof(SamplingStatistics));
+  this->samplingTask = NULL;
+  this->sampleCount = 0;
+  this->fastSamplingDeadlineMicros = 0;
+  vPortCPUInitializeMutex(&this->demandMux);
+  this->history = NULL;
+  this->trend = NULL;
 }
 
 bool WeatherSensor::isFound() {
-  return this->bmp280 != NULL;
+  return __atomic_load_n(&this->found, __ATOMIC_ACQUIRE);
 }
 
-void WeatherSensor::registerBridgedHomeKitAccessory() {
-  ESP_LOGI(TAG, "registerBridgedHomeKitAccessory");
-
-  this->createAccessory();
-  this->addTemperatureSensorService();
-  this->addHumiditySensorService();
-  this->addAirPressureSensorService();
-  this->addFirmwareUpgradeService();
-  /* Add the Accessory to the HomeKit Database */
-  hap_add_bridged_accessory(this->accessory, hap_get_unique_aid(kSetupID));
+// The sensor is probed in the background so that Wi-Fi and HAP come up without waiting for it,
+// and it can be connected after the boot.
+void WeatherSensor::startDiscovery() {
+  xTaskCreate(_discoverSensor, "WeatherSensor::discovery", 3 * 1024, this, tskIDLE_PRIORITY + 1, NULL);
 }
 
-void WeatherSensor::createAccessory() {
-  /* Initialise the mandatory parameters for Accessory which will be added as
-   * the mandatory services internally
-   */
-  hap_acc_cfg_t config = {
-    .name = (char*)"Weather Sensor",
-    .model = (char*)"Model",
-    .manufacturer = (char*)"Yuji Nakayama",
-    .serial_num = (char*)"Serial Number",
-    .fw_rev = (char*)"Firmware Version",
-    .hw_rev = NULL,
-    .pv = (char*)"1.0.0",
-    .cid = HAP_CID_SENSOR,
-    .identify_routine = identifyAccessory,
-  };
+void WeatherSensor::discoverSensor() {
+  uint32_t backoffMillis = kMinDiscoveryBackoffMillis;
 
-  /* Create accessory object */
-  this->accessory = hap_acc_create(&config);
+  while (true) {
+    this->discoveryAttemptCount++;
 
-  /* Add a dummy Product Data */
-  uint8_t product_data[] = {'E','S','P','3','2','H','A','P'};
-  hap_acc_add_product_data(accessory, product_data, sizeof(product_data));
-}
+    I2CTransaction transaction;
+    memset(&transaction, 0, sizeof(I2CTransaction));
+    transaction.deviceIndex = this->busDeviceIndex;
+    transaction.type = I2CTransactionTypeCustom;
+    transaction.perform = initBMP280OnBus;
+    transaction.context = this->bmp280;
 
-void WeatherSensor::addTemperatureSensorService() {
-  /*
-    Create a temperature sensor service with initial temperature value.
-    Include the "name" since this is a user visible service.
-   */
-  hap_serv_t* service = hap_serv_temperature_sensor_with_negative_value_create(0);
+    esp_err_t code = this->busManager->perform(&transaction);
+    if (code == ESP_OK) {
+      break;
+    }
 
-  hap_serv_add_char(service, hap_char_name_create(strdup(kTemperatureSensorServiceName)));
+    ESP_LOGW(TAG, "Sensor not found (attempt %u): %s. Retrying in %u ms", this->discoveryAttemptCount, esp_err_to_name(code), backoffMillis);
+    vTaskDelay(pdMS_TO_TICKS(backoffMillis));
 
-  /* Set the read callback for the service (optional) */
-  hap_serv_set_read_cb(service, readTemperatureSensorCharacteristic);
+    backoffMillis *= 2;
+    if (backoffMillis > kMaxDiscoveryBackoffMillis) {
+      backoffMillis = kMaxDiscoveryBackoffMillis;
+    }
+  }
 
-  // Allow access to WeatherSensor instance from the read/write callbacks
-  hap_serv_set_priv(service, this);
+  ESP_LOGI(TAG, "Sensor found after %u attempts", this->discoveryAttemptCount);
 
-  /* Add the sensor service to the accessory object */
-  hap_acc_add_serv(this->accessory, service);
+  // Allocated only when the sensor is available
+  this->history = new WeatherHistory();
+  this->trend = new WeatherTrend();
 
-  this->temperatureCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_CURRENT_TEMPERATURE);
+  this->registerBridgedHomeKitAccessory();
+
+  // The accessory is added after hap_start(), so the controllers need to fetch the accessory database again
+  // unless they already have it from an earlier boot. Bumping the config number on every boot would cost
+  // an NVS write and a database refetch by every controller on each ignition.
+  if (!this->wasBridged) {
+    hap_update_config_number();
+    this->stateStore->setUInt32(kBridgedKey, true);
+  }
+
+  this->startMonitoringSensor();
+  __atomic_store_n(&this->found, true, __ATOMIC_RELEASE);
 }
 
-void WeatherSensor::addHumiditySensorService() {
-  /*
-    Create a temperature sensor service with initial humidity value.
-    Include the "name" since this is a user visible service.
-   */
-  hap_serv_t* service = hap_serv_humidity_sensor_create(0);
+static void _discoverSensor(void* arg) {
+  WeatherSensor* sensor = (WeatherSensor*)arg;
+  sensor->discoverSensor();
+  vTaskDelete(NULL);
+}
 
-  hap_serv_add_char(service, hap_char_name_create(strdup(kHumiditySensorServiceName)));
+void WeatherSensor::registerBridgedHomeKitAccessory() {
+  ESP_LOGI(TAG, "registerBridgedHomeKitAccessory");
 
-  /* Set the read callback for the service (optional) */
-  hap_serv_set_read_cb(service, readHumiditySensorCharacteristic);
+  static const ServiceDefinition<WeatherSensor> kServiceDefinitions[] = {
+    defineService(&WeatherSensor::createTemperatureSensorService, kTemperatureSensorServiceName, kTemperatureSensorServiceHandlers),
+    defineService(&WeatherSensor::createHumiditySensorService, kHumiditySensorServiceName, kHumiditySensorServiceHandlers),
+    defineService(&WeatherSensor::createAirPressureSensorService, kAirPressureSensorServiceName, kAirPressureSensorServiceHandlers),
+  };
 
-  // Allow access to WeatherSensor instance from the read/write callbacks
-  hap_serv_set_priv(service, this);
+  this->accessory = createAccessory(this, kAccessoryDefinition, kServiceDefinitions);
+  addBridgedAccessory(this->accessory, kAccessoryDefinition);
+}
+
+hap_serv_t* WeatherSensor::createTemperatureSensorService() {
+  /* Create a temperature sensor service with initial temperature value */
+  hap_serv_t* service = hap_serv_temperature_sensor_with_negative_value_create(0);
 
-  /* Add the sensor service to the accessory object */
-  hap_acc_add_serv(this->accessory, service);
+  this->temperatureCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_CURRENT_TEMPERATURE);
+  this->temperatureFilter = new NotificationFilter("temperature", this->temperatureCharacteristic, kTemperatureFilterConfig);
+
+  return service;
+}
+
+hap_serv_t* WeatherSensor::createHumiditySensorService() {
+  /* Create a humidity sensor service with initial humidity value */
+  hap_serv_t* service = hap_serv_humidity_sensor_create(0);
 
   this->relativeHumidityCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_CURRENT_RELATIVE_HUMIDITY);
+  this->relativeHumidityFilter = new NotificationFilter("humidity", this->relativeHumidityCharacteristic, kRelativeHumidityFilterConfig);
+
+  return service;
 }
 
-void WeatherSensor::addAirPressureSensorService() {
-  /*
-    Create a temperature sensor service with initial humidity value.
-    Include the "name" since this is a user visible service.
-   */
+hap_serv_t* WeatherSensor::createAirPressureSensorService() {
+  /* Create an air pressure sensor service with initial pressure value */
   hap_serv_t* service = hap_serv_air_pressure_sensor_create(0);
 
-  hap_serv_add_char(service, hap_char_name_create(strdup(kAirPressureSensorServiceName)));
+  // Derived metrics; not displayed by the Home app but available to third-party controllers
+  hap_char_t* pressureTendencyCharacteristic = hap_char_air_pressure_tendency_create(0);
+  hap_char_t* dewPointCharacteristic = hap_char_dew_point_create(0);
+  hap_char_t* altitudeChangeCharacteristic = hap_char_altitude_change_create(0);
+  hap_char_t* pressureRangeCharacteristic = hap_char_air_pressure_range_create(0);
+  hap_serv_add_char(service, pressureTendencyCharacteristic);
+  hap_serv_add_char(service, dewPointCharacteristic);
+  hap_serv_add_char(service, altitudeChangeCharacteristic);
+  hap_serv_add_char(service, pressureRangeCharacteristic);
 
-  /* Set the read callback for the service (optional) */
-  hap_serv_set_read_cb(service, readAirPressureSensorCharacteristic);
+  this->airPressureCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_CURRENT_AIR_PRESSURE);
+  this->airPressureFilter = new NotificationFilter("pressure", this->airPressureCharacteristic, kAirPressureFilterConfig);
+  this->pressureTendencyFilter = new NotificationFilter("pressure tendency", pressureTendencyCharacteristic, kPressureTendencyFilterConfig);
+  this->dewPointFilter = new NotificationFilter("dew point", dewPointCharacteristic, kDewPointFilterConfig);
+  this->altitudeChangeFilter = new NotificationFilter("altitude change", altitudeChangeCharacteristic, kAltitudeChangeFilterConfig);
+  this->pressureRangeFilter = new NotificationFilter("pressure range", pressureRangeCharacteristic, kPressureRangeFilterConfig);
 
-  // Allow access to WeatherSensor instance from the read/write callbacks
-  hap_serv_set_priv(service, this);
+  return service;
+}
 
-  /* Add the sensor service to the accessory object */
-  hap_acc_add_serv(this->accessory, service);
+// I2C is accessed only by the sampling task,
+// and the others including HAP read callbacks just copy the last snapshot.
+// The task sleeps until the next sample is due, so nothing wakes up the CPU periodically for this.
+void WeatherSensor::startMonitoringSensor() {
+  this->samplingStatistics.startMicros = esp_timer_get_time();
+  xTaskCreate(_sampleSensorData, "WeatherSensor", 3 * 1024, this, tskIDLE_PRIORITY + 1, &this->samplingTask);
+}
 
-  this->airPressureCharacteristic = hap_serv_get_char_by_uuid(service, HAP_CHAR_UUID_CURRENT_AIR_PRESSURE);
+static void _sampleSensorData(void* arg) {
+  WeatherSensor* sensor = (WeatherSensor*)arg;
+  sensor->sampleSensorData();
 }
 
-/* Create the Firmware Upgrade HomeKit Custom Service.
- * Please refer the FW Upgrade documentation under components/homekit/extras/include/hap_fw_upgrade.h
- * and the top level README for more information.
- */
-void WeatherSensor::addFirmwareUpgradeService() {
-  /*  Required for server verification during OTA, PEM format as string  */
-  char server_cert[] = {};
+void WeatherSensor::sampleSensorData() {
+  while (true) {
+    bool isFast = this->isFastSamplingRequested();
+    if (isFast) {
+      this->samplingStatistics.fastSampleCount++;
+    } else {
+      this->samplingStatistics.slowSampleCount++;
+    }
+
+    SensorData data;
+    if (this->readSensorData(&data)) {
+      // Calibrated once here so that the snapshot, the trend and the history agree
+      data.temperature += (int32_t)(this->temperatureCalidation * 100);
+      this->publishSensorData(&data);
+      this->updateCharacteristicValues();
+      this->appendToHistory(&data);
+      this->sampleCount++;
+
+      if (this->sampleCount % kFilterStatisticsLoggingInterval == 0) {
+        this->temperatureFilter->logStatistics();
+        this->relativeHumidityFilter->logStatistics();
+        this->airPressureFilter->logStatistics();
+        this->pressureTendencyFilter->logStatistics();
+        this->dewPointFilter->logStatistics();
+        this->altitudeChangeFilter->logStatistics();
+        this->pressureRangeFilter->logStatistics();
+        this->trend->logStatistics();
+        this->busManager->logStatistics();
+        this->history->logStatistics();
+        this->logSamplingStatistics();
+      }
+    }
+
+    // Woken up early by requestFastSampling() when switching from the slow rate
+    uint32_t intervalMillis = isFast ? kFastSamplingIntervalMillis : kSlowSamplingIntervalMillis;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(intervalMillis));
+  }
+}
 
-  hap_fw_upgrade_config_t ota_config = {
-      .server_cert_pem = server_cert,
-  };
+void WeatherSensor::requestFastSampling(uint32_t durationMillis) {
+  int64_t nowMicros = esp_timer_get_time();
+  int64_t deadlineMicros = nowMicros + durationMillis * 1000LL;
 
-  hap_serv_t* service = hap_serv_fw_upgrade_create(&ota_config);
+  portENTER_CRITICAL(&this->demandMux);
+  bool wasFast = this->fastSamplingDeadlineMicros > nowMicros;
+  if (deadlineMicros > this->fastSamplingDeadlineMicros) {
+    this->fastSamplingDeadlineMicros = deadlineMicros;
+  }
+  portEXIT_CRITICAL(&this->demandMux);
 
-  /* Add the service to the Accessory Object */
-  hap_acc_add_serv(accessory, service);
+  if (!wasFast && this->samplingTask != NULL) {
+    ESP_LOGD(TAG, "Switching to the fast sampling rate");
+    xTaskNotifyGive(this->samplingTask);
+  }
 }
 
-void WeatherSensor::startMonitoringSensor() {
-  esp_timer_create_args_t args = {
-    .callback = &monitoringTask,
-    .arg = this,
-    .name = "updateData" // name is optional, but may help identify the timer when debugging
-  };
+bool WeatherSensor::isFastSamplingRequested() {
+  portENTER_CRITICAL(&this->demandMux);
+  int64_t deadlineMicros = this->fastSamplingDeadlineMicros;
+  portEXIT_CRITICAL(&this->demandMux);
 
-  esp_timer_handle_t timer;
-  ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
-  ESP_ERROR_CHECK(esp_timer_start_periodic(timer, 1 * 1000 * 1000)); // every second
+  return deadlineMicros > esp_timer_get_time();
 }
 
-void monitoringTask(void* arg) {
-  WeatherSensor* sensor = (WeatherSensor*)arg;
-  sensor->updateCharacteristicValues();
+void WeatherSensor::logSamplingStatistics() {
+  SamplingStatistics statistics = this->samplingStatistics;
+  float elapsedMillis = (esp_timer_get_time() - statistics.startMicros) / 1000.0f;
+  if (elapsedMillis <= 0) {
+    return;
+  }
+
+  float measuringRatio = statistics.wakeCount * kMeasurementMillis / elapsedMillis;
+  float averageCurrent = kSleepCurrentMicroamps + kMeasurementCurrentMicroamps * measuringRatio;
+
+  ESP_LOGI(
+    TAG,
+    "Sensor wakes: %u (fast %u, slow %u), I2C transfers: %.0f/hour, estimated sensor current: %.2f uA",
+    statistics.wakeCount,
+    statistics.fastSampleCount,
+    statistics.slowSampleCount,
+    statistics.i2cTransferCount * 3600000.0f / elapsedMillis,
+    averageCurrent
+  );
 }
 
 void WeatherSensor::updateCharacteristicValues() {
@@ -207,143 +434,128 @@ void WeatherSensor::updateCharacteristicValues() {
   this->updateTemperatureCharacteristicValue(data);
   this->updateRelativeHumidityCharacteristicValue(data);
   this->updateAirPressureCharacteristicValue(data);
+  this->updateTrendCharacteristicValues(data);
 }
 
+// The filters round the values so that small changes won't be notified in HomeKit
+// to prevent wasteful Wi-Fi communication.
+// https://github.com/espressif/esp-homekit-sdk/blob/bd236e710c658d3bea47bbcc0fb0ce6c80171527/components/homekit/esp_hap_core/src/esp_hap_char.c#L195-L200
 void WeatherSensor::updateTemperatureCharacteristicValue(SensorData data) {
-  hap_val_t value;
-  // Round value with 0.5 step so that small changes won't be notified in HomeKit
-  // to prevent wasteful Wi-Fi communication.
-  // https://github.com/espressif/esp-homekit-sdk/blob/bd236e710c658d3bea47bbcc0fb0ce6c80171527/components/homekit/esp_hap_core/src/esp_hap_char.c#L195-L200
-  value.f = round(data.temperature * 2) / 2;
-  hap_char_update_val(this->temperatureCharacteristic, &value);
+  this->temperatureFilter->update(data.temperature / 100.0f);
 }
 
 void WeatherSensor::updateRelativeHumidityCharacteristicValue(SensorData data) {
-  hap_val_t value;
-  value.f = round(data.humidity);
-  hap_char_update_val(this->relativeHumidityCharacteristic, &value);
+  this->relativeHumidityFilter->update(data.humidity / 1024.0f);
 }
 
 void WeatherSensor::updateAirPressureCharacteristicValue(SensorData data) {
-  hap_val_t value;
-  // Round to hPa
-  value.f = round(data.pressure / 100) * 100;
-  hap_char_update_val(this->airPressureCharacteristic, &value);
+  this->airPressureFilter->update(data.pressure / 256.0f);
 }
 
+// The estimators are updated in O(1) per sample so that the sampling task never stalls
+void WeatherSensor::updateTrendCharacteristicValues(SensorData data) {
+  this->trend->add(data.time, data.temperature, data.humidity, data.pressure);
+  this->pressureTendencyFilter->update(this->trend->getPressureTendency());
+  this->dewPointFilter->update(this->trend->getDewPoint());
+  this->altitudeChangeFilter->update(this->trend->getAltitudeChange());
+  this->pressureRangeFilter->update(this->trend->getPressureRange());
+}
+
+// Never blocks; retries only if the sampling task is publishing on the other core at the moment
 SensorData WeatherSensor::getSensorData() {
-  xSemaphoreTake(this->lastDataMutex, 100 / portTICK_PERIOD_MS);
-  if (!this->hasValidLastSensorData()) {
-    this->lastData = this->readSensorData();
-  }
+  SensorData data;
+  uint32_t sequence;
+
+  do {
+    sequence = __atomic_load_n(&this->snapshot.sequence, __ATOMIC_ACQUIRE);
+    data = this->snapshot.data;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((sequence & 1) != 0 || sequence != __atomic_load_n(&this->snapshot.sequence, __ATOMIC_RELAXED));
 
-  SensorData calibratedData = this->lastData;
-  xSemaphoreGive(this->lastDataMutex);
-  calibratedData.temperature += this->temperatureCalidation;
-  return calibratedData;
+  return data;
 }
 
-bool WeatherSensor::hasValidLastSensorData() {
-  if (this->lastData.time == 0) {
-    return false;
-  }
+void WeatherSensor::publishSensorData(const SensorData* data) {
+  // Preemption is disabled while publishing
+  // so that a higher priority reader on the same core never spins waiting for this.
+  static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  portENTER_CRITICAL(&mux);
 
-  unsigned long elapsedTime = millis() - this->lastData.time;
-  return elapsedTime <= 100;
+  __atomic_store_n(&this->snapshot.sequence, this->snapshot.sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  this->snapshot.data = *data;
+  __atomic_store_n(&this->snapshot.sequence, this->snapshot.sequence + 1, __ATOMIC_RELEASE);
+
+  portEXIT_CRITICAL(&mux);
 }
 
-SensorData WeatherSensor::readSensorData() {
-  SensorData data;
-  esp_err_t code = bmp280_read_float(this->bmp280, &data.temperature, &data.pressure, &data.humidity);
-  if (code == ESP_OK) {
-    data.time = millis();
-    ESP_LOGI(TAG, "temperature: %f, pressure: %f, humidity: %f", data.temperature, data.pressure, data.humidity);
-  } else {
-    ESP_LOGW(TAG, "Failed reading sensor: %s", esp_err_to_name(code));
+// bmp280_read_fixed() reads all the data registers in a single burst I2C transaction
+// and compensates them with the 32/64-bit integer formulas in the datasheet,
+// which avoids the float math in bmp280_read_float().
+bool WeatherSensor::readSensorData(SensorData* data) {
+  // Reading and writing the control register
+  if (!this->performOnBus(forceMeasurementOnBus, this->bmp280, 2)) {
+    return false;
   }
-  return data;
-}
+  this->samplingStatistics.wakeCount++;
 
-/* Mandatory identify routine for the accessory.
- * In a real accessory, something like LED blink should be implemented
- * got visual identification
- */
-static int identifyAccessory(hap_acc_t* ha) {
-  ESP_LOGI(TAG, "Accessory identified");
-  return HAP_SUCCESS;
-}
+  vTaskDelay(pdMS_TO_TICKS(kMeasurementMillis));
 
-static int readTemperatureSensorCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv) {
-  const char* characteristicUUID = hap_char_get_type_uuid(hc);
-  ESP_LOGD(TAG, "readTemperatureSensorCharacteristic: %s", characteristicUUID);
-
-  int entireResult = HAP_SUCCESS;
-
-  WeatherSensor* sensor = (WeatherSensor*)serv_priv;
-
-  if (strcmp(characteristicUUID, HAP_CHAR_UUID_CURRENT_TEMPERATURE) == 0) {
-    sensor->updateTemperatureCharacteristicValue(sensor->getSensorData());
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_NAME) == 0) {
-    hap_val_t value;
-    value.s = strdup(kTemperatureSensorServiceName);
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else {
-    ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-    *status_code = HAP_STATUS_RES_ABSENT;
-    entireResult = HAP_FAIL;
+  ReadSensorDataContext context = {
+    .bmp280 = this->bmp280,
+    .data = data,
+  };
+
+  bool isRead = false;
+  for (int i = 0; i < kMaxMeasurementPollingCount && !isRead; i++) {
+    if (i > 0) {
+      vTaskDelay(pdMS_TO_TICKS(kMeasurementPollingMillis));
+    }
+    // Reading the status register and the data registers
+    isRead = this->performOnBus(readSensorDataOnBus, &context, 2);
+  }
+
+  if (!isRead) {
+    return false;
   }
 
-  return entireResult;
+  data->time = millis();
+  ESP_LOGI(TAG, "temperature: %d/100, pressure: %u/256, humidity: %u/1024", data->temperature, data->pressure, data->humidity);
+  return true;
 }
 
-static int readHumiditySensorCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv) {
-  const char* characteristicUUID = hap_char_get_type_uuid(hc);
-  ESP_LOGD(TAG, "readHumiditySensorCharacteristic: %s", characteristicUUID);
-
-  int entireResult = HAP_SUCCESS;
-
-  WeatherSensor* sensor = (WeatherSensor*)serv_priv;
-
-  if (strcmp(characteristicUUID, HAP_CHAR_UUID_CURRENT_RELATIVE_HUMIDITY) == 0) {
-    sensor->updateRelativeHumidityCharacteristicValue(sensor->getSensorData());
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_NAME) == 0) {
-    hap_val_t value;
-    value.s = strdup(kHumiditySensorServiceName);
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else {
-    ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-    *status_code = HAP_STATUS_RES_ABSENT;
-    entireResult = HAP_FAIL;
+bool WeatherSensor::performOnBus(I2CTransactionFunction function, void* context, uint32_t i2cTransferCount) {
+  I2CTransaction transaction;
+  memset(&transaction, 0, sizeof(I2CTransaction));
+  transaction.deviceIndex = this->busDeviceIndex;
+  transaction.type = I2CTransactionTypeCustom;
+  transaction.perform = function;
+  transaction.context = context;
+
+  esp_err_t code = this->busManager->perform(&transaction);
+  this->samplingStatistics.i2cTransferCount += i2cTransferCount;
+
+  if (code != ESP_OK) {
+    if (code != ESP_ERR_NOT_FINISHED) {
+      ESP_LOGW(TAG, "Failed accessing sensor: %s", esp_err_to_name(code));
+    }
+    return false;
   }
 
-  return entireResult;
+  return true;
 }
 
-static int readAirPressureSensorCharacteristic(hap_char_t* hc, hap_status_t* status_code, void* serv_priv, void* read_priv) {
-  const char* characteristicUUID = hap_char_get_type_uuid(hc);
-  ESP_LOGD(TAG, "readHumiditySensorCharacteristic: %s", characteristicUUID);
-
-  int entireResult = HAP_SUCCESS;
-
-  WeatherSensor* sensor = (WeatherSensor*)serv_priv;
-
-  if (strcmp(characteristicUUID, HAP_CHAR_UUID_CURRENT_AIR_PRESSURE) == 0) {
-    sensor->updateAirPressureCharacteristicValue(sensor->getSensorData());
-    *status_code = HAP_STATUS_SUCCESS;
-  } else if (strcmp(characteristicUUID, HAP_CHAR_UUID_NAME) == 0) {
-    hap_val_t value;
-    value.s = strdup(kHumiditySensorServiceName);
-    hap_char_update_val(hc, &value);
-    *status_code = HAP_STATUS_SUCCESS;
-  } else {
-    ESP_LOGE(TAG, "unsupported characteristic %s", characteristicUUID);
-    *status_code = HAP_STATUS_RES_ABSENT;
-    entireResult = HAP_FAIL;
-  }
+void WeatherSensor::appendToHistory(const SensorData* data) {
+  WeatherHistorySample sample;
+  sample.time = data->time / 1000;
+  sample.values[WeatherHistoryValueTemperature] = data->temperature;
+  sample.values[WeatherHistoryValueHumidity] = data->humidity;
+  sample.values[WeatherHistoryValuePressure] = data->pressure;
+  this->history->append(&sample);
+}
 
-  return entireResult;
+// The values are kept up to date through the filters by the sampling task
+static hap_status_t readSensorCharacteristic(WeatherSensor* sensor, hap_char_t* hc) {
+  sensor->requestFastSampling(kReadCallbackDemandMillis);
+  return HAP_STATUS_SUCCESS;
 }
@@ -3,44 +3,93 @@
 #include <hap.h>
 #include <driver/gpio.h>
 #include "bmp280.h"
+#include "i2c_bus_manager.h"
+#include "notification_filter.h"
+#include "persistent_state.h"
+#include "weather_history.h"
+#include "weather_trend.h"
 
+// Fixed-point values from the integer compensation of the sensor.
+// They are converted to float only when passed to HomeKit.
 typedef struct {
   unsigned long time; // In milliseconds
-  float temperature;
-  float humidity;
-  float pressure; // In Pa (pascal)
+  int32_t temperature; // In 0.01 degrees Celsius
+  uint32_t humidity; // In %RH, Q22.10 format
+  uint32_t pressure; // In Pa (pascal), Q24.8 format
 } SensorData;
 
+// Single writer, multiple readers.
+// The sequence is odd while the writer is updating the data.
+typedef struct {
+  volatile uint32_t sequence;
+  SensorData data;
+} SensorDataSnapshot;
+
+typedef struct {
+  uint32_t wakeCount; // Forced measurements
+  uint32_t i2cTransferCount;
+  uint32_t fastSampleCount;
+  uint32_t slowSampleCount;
+  int64_t startMicros;
+} SamplingStatistics;
+
 class WeatherSensor {
 public:
   bmp280_t* bmp280;
+  I2CBusManager* busManager;
+  int busDeviceIndex;
   hap_acc_t* accessory;
   float temperatureCalidation;
-  SensorData lastData;
-  SemaphoreHandle_t lastDataMutex;
+  SensorDataSnapshot snapshot;
+  TaskHandle_t samplingTask;
+  SamplingStatistics samplingStatistics;
+  WeatherHistory* history;
+  WeatherTrend* trend;
+  PersistentStateStore* stateStore;
 
-  WeatherSensor(gpio_num_t sdaPin, gpio_num_t sdlPin, float temperatureCalidation);
+  WeatherSensor(PersistentStateStore* stateStore, I2CBusManager* busManager, gpio_num_t sdaPin, gpio_num_t sdlPin, float temperatureCalidation);
   bool isFound();
+  void startDiscovery();
+  void discoverSensor();
   void registerBridgedHomeKitAccessory();
 
   void startMonitoringSensor();
+  void sampleSensorData();
+  // Keeps sampling at the fast rate until durationMillis later. Can be called from any task.
+  void requestFastSampling(uint32_t durationMillis);
+  bool isFastSamplingRequested();
   void updateCharacteristicValues();
   void updateTemperatureCharacteristicValue(SensorData data);
   void updateRelativeHumidityCharacteristicValue(SensorData data);
   void updateAirPressureCharacteristicValue(SensorData data);
+  void updateTrendCharacteristicValues(SensorData data);
   SensorData getSensorData();
+  void logSamplingStatistics();
 
 private:
   hap_char_t* temperatureCharacteristic;
   hap_char_t* relativeHumidityCharacteristic;
   hap_char_t* airPressureCharacteristic;
+  NotificationFilter* temperatureFilter;
+  NotificationFilter* relativeHumidityFilter;
+  NotificationFilter* airPressureFilter;
+  NotificationFilter* pressureTendencyFilter;
+  NotificationFilter* dewPointFilter;
+  NotificationFilter* altitudeChangeFilter;
+  NotificationFilter* pressureRangeFilter;
+  bool found;
+  bool wasBridged; // At the last boot, so that the controllers have it in their accessory database
+  uint32_t discoveryAttemptCount;
+  uint32_t sampleCount;
+  int64_t fastSamplingDeadlineMicros;
+  portMUX_TYPE demandMux;
 
-  void createAccessory();
-  void addTemperatureSensorService();
-  void addHumiditySensorService();
-  void addAirPressureSensorService();
-  void addFirmwareUpgradeService();
-  bool hasValidLastSensorData();
-  SensorData readSensorData();
+  hap_serv_t* createTemperatureSensorService();
+  hap_serv_t* createHumiditySensorService();
+  hap_serv_t* createAirPressureSensorService();
+  bool readSensorData(SensorData* data);
+  bool performOnBus(I2CTransactionFunction function, void* context, uint32_t i2cTransferCount);
+  void publishSensorData(const SensorData* data);
+  void appendToHistory(const SensorData* data);
 };
 
@@ -0,0 +1,107 @@
+#include "log_config.h"
+#include "weather_trend.h"
+
+#include <math.h>
+
+static const char* TAG = "WeatherTrend";
+
+static const size_t kPressureWindowMinutes = 3 * 60;
+// Those of the former 1 s sampling, where the weights were 0.05 and 0.1 per sample
+static const float kPressureTimeConstantSeconds = 20;
+static const float kDewPointTimeConstantSeconds = 10;
+
+// Magnus formula coefficients
+// https://en.wikipedia.org/wiki/Dew_point#Calculating_the_dew_point
+static const float kMagnusB = 17.62;
+static const float kMagnusC = 243.12;
+
+static float calculateDewPoint(float temperature, float relativeHumidity);
+static float calculateAltitudeChange(float pressure, float referencePressure);
+
+WeatherTrend::WeatherTrend()
+  : pressureRegression(kPressureWindowMinutes),
+    pressureMinMax(kPressureWindowMinutes),
+    smoothedPressure(kPressureTimeConstantSeconds),
+    smoothedDewPoint(kDewPointTimeConstantSeconds) {
+  this->referencePressure = 0;
+  this->pressureMinute = 0;
+  this->pressureSampleCount = 0;
+  this->pressureSum = 0;
+}
+
+void WeatherTrend::add(uint32_t timeMillis, int32_t temperature, uint32_t humidity, uint32_t pressure) {
+  float temperatureCelsius = temperature / 100.0f;
+  float relativeHumidity = humidity / 1024.0f;
+  float pressurePascals = pressure / 256.0f;
+
+  if (relativeHumidity > 0) {
+    this->smoothedDewPoint.add(calculateDewPoint(temperatureCelsius, relativeHumidity), timeMillis);
+  }
+
+  this->smoothedPressure.add(pressurePascals, timeMillis);
+  if (this->referencePressure == 0) {
+    this->referencePressure = pressurePascals;
+  }
+
+  // The regression takes per-minute averages to keep the window small
+  uint32_t minute = timeMillis / (60 * 1000);
+
+  if (this->pressureSampleCount > 0 && minute != this->pressureMinute) {
+    float average = this->pressureSum / this->pressureSampleCount;
+    this->pressureRegression.add(this->pressureMinute, average);
+    this->pressureMinMax.add(average);
+    this->pressureSampleCount = 0;
+    this->pressureSum = 0;
+  }
+
+  this->pressureMinute = minute;
+  this->pressureSampleCount++;
+  this->pressureSum += pressurePascals;
+}
+
+bool WeatherTrend::hasValues() {
+  return this->smoothedPressure.hasValue();
+}
+
+float WeatherTrend::getPressureTendency() {
+  return this->pressureRegression.getSlope() * kPressureWindowMinutes;
+}
+
+float WeatherTrend::getDewPoint() {
+  return this->smoothedDewPoint.getValue();
+}
+
+float WeatherTrend::getAltitudeChange() {
+  return calculateAltitudeChange(this->smoothedPressure.getValue(), this->referencePressure);
+}
+
+float WeatherTrend::getPressureRange() {
+  return this->pressureMinMax.getMax() - this->pressureMinMax.getMin();
+}
+
+void WeatherTrend::logStatistics() {
+  ESP_LOGI(
+    TAG,
+    "pressure tendency: %.1f Pa/3h (%u minutes, min %.1f, max %.1f), dew point: %.1f, altitude change: %.1f m",
+    this->getPressureTendency(),
+    this->pressureRegression.getCount(),
+    this->pressureMinMax.getMin(),
+    this->pressureMinMax.getMax(),
+    this->getDewPoint(),
+    this->getAltitudeChange()
+  );
+}
+
+static float calculateDewPoint(float temperature, float relativeHumidity) {
+  float gamma = logf(relativeHumidity / 100) + kMagnusB * temperature / (kMagnusC + temperature);
+  return kMagnusC * gamma / (kMagnusB - gamma);
+}
+
+// International barometric formula
+static float calculateAltitudeChange(float pressure, float referencePressure) {
+  if (referencePressure <= 0) {
+    return 0;
+  }
+
+  return 44330 * (1 - powf(pressure / referencePressure, 1 / 5.255f));
+}
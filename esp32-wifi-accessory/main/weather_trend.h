@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include "streaming_estimators.h"
+
+// Derived metrics updated incrementally on each sensor sample
+class WeatherTrend {
+public:
+  WeatherTrend();
+
+  // Values in the units of the sensor: 0.01 degrees Celsius, Q22.10 %RH and Q24.8 Pa
+  void add(uint32_t timeMillis, int32_t temperature, uint32_t humidity, uint32_t pressure);
+
+  bool hasValues();
+  float getPressureTendency(); // In Pa per 3 hours
+  float getDewPoint(); // In degrees Celsius
+  float getAltitudeChange(); // In meters since the first sample
+  float getPressureRange(); // In Pa between the highest and the lowest per-minute averages over 3 hours
+  void logStatistics();
+
+private:
+  SlidingLinearRegression pressureRegression; // Per-minute averages over 3 hours
+  SlidingMinMax pressureMinMax;
+  ExponentialMovingAverage smoothedPressure;
+  ExponentialMovingAverage smoothedDewPoint;
+  float referencePressure;
+
+  uint32_t pressureMinute;
+  uint32_t pressureSampleCount;
+  double pressureSum;
+};